@@ -141,7 +141,8 @@ bool GuiApp::handleEvent(const SDL_Event& e) {
 
 void GuiApp::update() {
     if (m_playing) {
-        m_inst.runSteps(static_cast<std::size_t>(m_stepsPerFrame));
+        // Pause on HALT, a fault or a breakpoint instead of spinning on it.
+        if (m_inst.runSteps(static_cast<std::size_t>(m_stepsPerFrame)) != RunOutcome::StepLimit) m_playing = false;
         m_dirtyTitle = true;
     }
     
@@ -0,0 +1,116 @@
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vm/Assembler.hpp"
+#include "vm/Layout.hpp"
+#include "vm/Linker.hpp"
+#include "vm/ObjectFile.hpp"
+#include "vm/Profiler.hpp"
+#include "vm/ProgramLoader.hpp"
+
+namespace {
+
+bool hasExtension(const std::string& path, const char* ext) {
+    return std::filesystem::path(path).extension() == ext;
+}
+
+std::string_view asText(const std::vector<unsigned char>& bytes) {
+    return {reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        std::vector<std::string> inputs;
+        std::string outputPath = "a.bin";
+        bool withHeader = false;
+        std::optional<std::string> entryOpt;
+        std::optional<std::string> symbolsPath;
+        std::optional<std::string> cacheDir = std::string(".vmcache");
+        std::optional<std::string> profilePath;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "-o" && i + 1 < argc) outputPath = argv[++i];
+            else if (arg == "--with-header") withHeader = true;
+            else if (arg == "--entry" && i + 1 < argc) entryOpt = argv[++i];
+            else if (arg == "--symbols" && i + 1 < argc) symbolsPath = argv[++i];
+            else if (arg == "--cache" && i + 1 < argc) cacheDir = argv[++i];
+            else if (arg == "--no-cache") cacheDir.reset();
+            else if (arg == "--profile" && i + 1 < argc) profilePath = argv[++i];
+            else if (!arg.empty() && arg[0] == '-') throw std::runtime_error("Unknown option: " + arg);
+            else inputs.push_back(arg);
+        }
+        if (inputs.empty()) {
+            std::cerr << "Usage: vm_ld <module.asm|module.vmo>... [-o output.bin] [--with-header] [--entry <symbol|addr>]\n"
+                         "             [--symbols <file>] [--cache <dir>] [--no-cache] [--profile <file.folded>]\n"
+                         "Modules are laid out in command-line order from address 0. .asm sources are\n"
+                         "assembled through the object cache (default .vmcache), keyed by content hash.\n"
+                         "--profile reorders each module's blocks by a vm_app --profile run of the\n"
+                         "program as linked without it.\n";
+            return 2;
+        }
+
+        std::optional<vm::ObjectCache> cache;
+        if (cacheDir) cache.emplace(*cacheDir);
+        std::vector<vm::ObjectFile> objects;
+        std::size_t assembled = 0;
+        for (const std::string& path : inputs) {
+            if (hasExtension(path, ".vmo")) {
+                objects.push_back(vm::readObjectFile(path));
+                continue;
+            }
+            const std::string name = std::filesystem::path(path).stem().string();
+            const std::vector<unsigned char> source = vm::loadBinaryFile(path);
+            try {
+                objects.push_back(cache ? cache->get(asText(source), name) : vm::assembleObject(asText(source), name));
+            } catch (const vm::AssemblyError& ex) {
+                throw std::runtime_error(path + ": " + ex.what());
+            }
+            if (!cache) ++assembled;
+        }
+        if (cache) assembled = cache->misses();
+
+        if (profilePath) {
+            // Profile PCs are addresses in the unoptimized link: module bases
+            // come from the original sizes.
+            const vm::ExecutionProfile profile = vm::ExecutionProfile::loadFolded(*profilePath);
+            vm::u32 base = 0;
+            std::size_t inverted = 0, removed = 0, added = 0;
+            for (vm::ObjectFile& obj : objects) {
+                const vm::u32 size = static_cast<vm::u32>(obj.code.size());
+                vm::LayoutReport report;
+                obj = vm::layoutObject(obj, profile, base, &report);
+                inverted += report.branchesInverted;
+                removed += report.jumpsRemoved;
+                added += report.jumpsAdded;
+                base += size;
+            }
+            std::cout << "Layout: " << inverted << " branches inverted, " << removed << " jumps removed, " << added
+                      << " added\n";
+        }
+
+        const vm::AssembledProgram prog = vm::link(objects);
+        const std::vector<unsigned char> out = withHeader ? prog.image(entryOpt ? prog.address(*entryOpt) : 0) : prog.code;
+        std::ofstream ofs(outputPath, std::ios::binary);
+        if (!ofs) throw std::runtime_error("Failed to open output: " + outputPath);
+        ofs.write(reinterpret_cast<const char*>(out.data()), static_cast<std::streamsize>(out.size()));
+        std::cout << "Linked " << objects.size() << " modules (" << assembled << " assembled";
+        if (cache) std::cout << ", " << cache->hits() << " cached";
+        std::cout << "), wrote " << out.size() << " bytes to " << outputPath << "\n";
+        if (symbolsPath) {
+            std::ofstream sfs(*symbolsPath);
+            if (!sfs) throw std::runtime_error("Failed to open symbols output: " + *symbolsPath);
+            prog.writeSymbols(sfs);
+        }
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "ld error: " << ex.what() << "\n";
+        return 1;
+    }
+}
@@ -0,0 +1,54 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "vm/Trace.hpp"
+
+using namespace vm;
+
+static void usage() {
+    std::cerr << "Usage: vm_tracedump <trace.vmtr> [--tail N] [--pc ADDR]\n"
+                 "  --tail N   print only the last N records\n"
+                 "  --pc ADDR  print only records for this instruction address" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    try {
+        std::string path;
+        std::size_t tail = 0;
+        bool filterPc = false;
+        u32 pc = 0;
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "--tail" && i + 1 < argc) {
+                tail = static_cast<std::size_t>(std::stoull(argv[++i]));
+            } else if (arg == "--pc" && i + 1 < argc) {
+                pc = static_cast<u32>(std::stoul(argv[++i], nullptr, 0));
+                filterPc = true;
+            } else if (!arg.empty() && arg[0] != '-') {
+                path = arg;
+            } else {
+                usage();
+                return 1;
+            }
+        }
+        if (path.empty()) {
+            usage();
+            return 1;
+        }
+
+        const std::vector<TraceRecord> records = readTraceFile(path);
+        const std::size_t first = (tail && tail < records.size()) ? records.size() - tail : 0;
+        for (std::size_t i = first; i < records.size(); ++i) {
+            if (filterPc && records[i].pc != pc) continue;
+            std::cout << formatTraceRecord(records[i]) << '\n';
+        }
+        if (!records.empty() && records.front().seq != 0) {
+            std::cout << "(" << records.front().seq << " earlier records were overwritten)" << '\n';
+        }
+        return 0;
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+}
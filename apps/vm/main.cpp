@@ -18,15 +18,11 @@
 #include "vm/Config.hpp"
 #include "vm/Instance.hpp"
 #include "vm/Opcodes.hpp"
+#include "vm/BatchRunner.hpp"
+#include "vm/Profiler.hpp"
 
 using namespace vm;
 
-static std::vector<unsigned char> load_file_bytes(const std::string& path) {
-    std::ifstream ifs(path, std::ios::binary);
-    if (!ifs) throw std::runtime_error("Failed to open file: " + path);
-    return std::vector<unsigned char>((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-}
-
 static void disassemble(const std::vector<unsigned char>& bytes) {
     auto rd8 = [&](std::size_t addr) -> unsigned int {
         return addr < bytes.size() ? static_cast<unsigned int>(bytes[addr]) : 0;
@@ -156,6 +152,73 @@ static void dump_cpu_state(const ICPU* cpu) {
     }
 }
 
+// Interactive-mode status line for a run that stopped short of HALT.
+static void report_stop(RunOutcome outcome, const VMInstance& instance) {
+    const ICPU* cpu = instance.cpu();
+    if (outcome == RunOutcome::Breakpoint) std::cout << "BREAK at 0x" << std::hex << cpu->getPC() << std::dec << std::endl;
+    else if (outcome == RunOutcome::Fault) std::cout << "FAULT at 0x" << std::hex << cpu->getPC() << std::dec << std::endl;
+    else if (outcome == RunOutcome::Watchpoint) {
+        const WatchHit& hit = instance.lastWatchHit();
+        const char* kind = hit.kind == WatchKind::Read ? "read" : hit.kind == WatchKind::Write ? "write" : "change";
+        std::cout << "WATCH " << kind << " 0x" << std::hex << hit.addr << " by pc 0x" << hit.pc << std::dec
+                  << " old=" << hit.oldValue;
+        if (hit.kind != WatchKind::Read) std::cout << " new=" << hit.newValue;
+        std::cout << std::endl;
+    }
+}
+
+static void dump_fusion_stats(const ICPU* cpu) {
+    const auto* simple = dynamic_cast<const SimpleCPU*>(cpu);
+    if (!simple) return;
+    std::cout << "=== FUSION ===\n";
+    std::cout << "CMP+JZ=" << simple->fusionCount(Fusion::CmpJz)
+              << " CMP+JNZ=" << simple->fusionCount(Fusion::CmpJnz)
+              << " LOADI+ALU=" << simple->fusionCount(Fusion::LoadiAlu)
+              << " PUSH+PUSH=" << simple->fusionCount(Fusion::PushPush)
+              << " POP+POP=" << simple->fusionCount(Fusion::PopPop) << "\n";
+}
+
+static void dump_perf_counters(const VMInstance& instance) {
+    std::cout << "=== PERF ===\n";
+    if (!PerfCounters::ENABLED) {
+        std::cout << "(built without VM_PERF_COUNTERS)\n";
+        return;
+    }
+    const PerfCounters perf = instance.cpu()->perfCounters();
+    std::cout << "retired=" << perf.totalRetired() << " seconds=" << static_cast<double>(perf.runNanos) / 1e9
+              << " MIPS=" << perf.mips() << "\n";
+    for (std::size_t op = 0; op < perf.retired.size(); ++op) {
+        if (perf.retired[op]) std::cout << opcodeToString(static_cast<Opcode>(op)) << "=" << perf.retired[op] << " ";
+    }
+    std::cout << "\nbranches taken=" << perf.branchesTaken << " not-taken=" << perf.branchesNotTaken
+              << " loads=" << perf.loads() << " stores=" << perf.stores()
+              << " max-stack-depth=" << perf.maxStackDepth() << "\n";
+    const auto& maps = instance.devices();
+    for (std::size_t i = 0; i < maps.size() && i < perf.deviceAccesses.size(); ++i) {
+        std::cout << "device 0x" << std::hex << maps[i].base << "+0x" << maps[i].size << std::dec
+                  << " accesses=" << perf.deviceAccesses[i] << "\n";
+    }
+}
+
+// Writes the profile as folded stacks or pprof and prints the hottest labels.
+static void write_profile(VMInstance& instance, const std::string& path, const std::string& format,
+                          const std::optional<std::string>& symbolsPath) {
+    const ExecutionProfile* profile = instance.profile();
+    const SymbolMap symbols = symbolsPath.has_value() ? SymbolMap::load(*symbolsPath) : SymbolMap{};
+    std::ofstream out(path, std::ios::binary);
+    if (!out) throw std::runtime_error("Failed to open profile output: " + path);
+    if (format == "pprof") writePprof(out, *profile, symbols);
+    else writeFoldedStacks(out, *profile, symbols);
+
+    const u64 total = profile->total();
+    const std::vector<LabelCount> labels = aggregateByLabel(*profile, symbols);
+    std::cout << "=== PROFILE === " << total << " instructions\n";
+    for (std::size_t i = 0; i < labels.size() && i < 10; ++i) {
+        std::cout << labels[i].label << "=" << labels[i].count << " ("
+                  << (total ? labels[i].count * 100 / total : 0) << "%)\n";
+    }
+}
+
 int main(int argc, char** argv) {
     try {
         ConsoleLogger logger;
@@ -172,6 +235,17 @@ int main(int argc, char** argv) {
         std::optional<std::string> configPath;
         bool verifyHeader = false;
         bool quiet = false;
+        bool stats = false;
+        std::optional<std::string> tracePath;
+        std::optional<std::string> profilePath;
+        std::string profileFormat = "folded";
+        std::optional<std::string> symbolsPath;
+        std::optional<std::string> batchPath;
+        std::optional<std::string> jsonPath;
+        std::size_t jobs = 0; // 0 => hardware concurrency
+        std::size_t traceRecords = 1 << 20;
+        CpuEngine engine = CpuEngine::Interpreter;
+        MemoryBackend memBackend = MemoryBackend::Dense;
 
         auto parseMem = [](const std::string& s) -> std::size_t {
             if (s.empty()) return 0;
@@ -180,9 +254,23 @@ int main(int argc, char** argv) {
             char last = static_cast<char>(std::tolower(s.back()));
             if (last == 'k') { mult = 1024; num = s.substr(0, s.size()-1); }
             else if (last == 'm') { mult = 1024*1024; num = s.substr(0, s.size()-1); }
+            else if (last == 'g') { mult = 1024*1024*1024; num = s.substr(0, s.size()-1); }
             return static_cast<std::size_t>(std::stoull(num)) * mult;
         };
 
+        auto parseEngine = [](const std::string& s) -> CpuEngine {
+            if (s == "interp" || s == "interpreter") return CpuEngine::Interpreter;
+            if (s == "threaded") return CpuEngine::Threaded;
+            if (s == "jit") return CpuEngine::Jit;
+            throw std::runtime_error("Unknown engine: " + s + " (expected interp|threaded|jit)");
+        };
+
+        auto parseMemBackend = [](const std::string& s) -> MemoryBackend {
+            if (s == "dense") return MemoryBackend::Dense;
+            if (s == "sparse") return MemoryBackend::Sparse;
+            throw std::runtime_error("Unknown memory backend: " + s + " (expected dense|sparse)");
+        };
+
         for (int i = 1; i < argc; ++i) {
             std::string arg = argv[i];
             if (arg == "--steps" && i + 1 < argc) {
@@ -205,6 +293,31 @@ int main(int argc, char** argv) {
                 verifyHeader = true;
             } else if (arg == "--quiet") {
                 quiet = true;
+            } else if (arg == "--stats") {
+                stats = true;
+            } else if (arg == "--trace" && i + 1 < argc) {
+                tracePath = argv[++i];
+            } else if (arg == "--profile" && i + 1 < argc) {
+                profilePath = argv[++i];
+            } else if (arg == "--profile-format" && i + 1 < argc) {
+                profileFormat = argv[++i];
+                if (profileFormat != "folded" && profileFormat != "pprof") {
+                    throw std::runtime_error("Unknown profile format: " + profileFormat + " (expected folded|pprof)");
+                }
+            } else if (arg == "--symbols" && i + 1 < argc) {
+                symbolsPath = argv[++i];
+            } else if (arg == "--batch" && i + 1 < argc) {
+                batchPath = argv[++i];
+            } else if (arg == "--jobs" && i + 1 < argc) {
+                jobs = static_cast<std::size_t>(std::stoull(argv[++i]));
+            } else if (arg == "--json" && i + 1 < argc) {
+                jsonPath = argv[++i];
+            } else if (arg == "--trace-records" && i + 1 < argc) {
+                traceRecords = static_cast<std::size_t>(std::stoull(argv[++i]));
+            } else if (arg == "--engine" && i + 1 < argc) {
+                engine = parseEngine(argv[++i]);
+            } else if (arg == "--mem-backend" && i + 1 < argc) {
+                memBackend = parseMemBackend(argv[++i]);
             } else if (arg == "--config" && i + 1 < argc) {
                 configPath = argv[++i];
             } else if (!arg.empty() && arg[0] != '-') {
@@ -236,7 +349,36 @@ int main(int argc, char** argv) {
                 else if (key == "program") binaryPath = val;
                 else if (key == "steps") steps = static_cast<std::size_t>(std::stoull(val));
                 else if (key == "dump") dumpAfter = (val == "1" || val == "true" || val == "yes");
+                else if (key == "engine") engine = parseEngine(val);
+                else if (key == "mem_backend") memBackend = parseMemBackend(val);
+                else if (key == "trace") tracePath = val;
+                else if (key == "profile") profilePath = val;
+                else if (key == "symbols") symbolsPath = val;
+            }
+        }
+
+        // Batch mode: many isolated instances on a thread pool, results as JSON
+        if (batchPath.has_value()) {
+            std::ifstream mfs(*batchPath);
+            if (!mfs) throw std::runtime_error("Failed to open manifest: " + *batchPath);
+            BatchJob defaults;
+            defaults.memSize = memSize;
+            defaults.steps = steps;
+            defaults.engine = engine;
+            defaults.memBackend = memBackend;
+            const std::vector<BatchJob> batch = parseBatchManifest(mfs, defaults);
+            const BatchSummary summary = runBatch(batch, jobs);
+            if (jsonPath.has_value()) {
+                std::ofstream jfs(*jsonPath);
+                if (!jfs) throw std::runtime_error("Failed to open JSON output: " + *jsonPath);
+                writeBatchJson(jfs, batch, summary);
+            } else {
+                writeBatchJson(std::cout, batch, summary);
             }
+            // Non-zero if any job failed to load, faulted or hit its step limit
+            const bool allOk = std::all_of(summary.results.begin(), summary.results.end(),
+                                           [](const BatchResult& r) { return r.ok; });
+            return allOk ? 0 : 1;
         }
 
         // Build VM config and instance
@@ -248,6 +390,10 @@ int main(int argc, char** argv) {
         cfg.interactive = interactive;
         cfg.dumpAfter = dumpAfter;
         cfg.steps = steps;
+        cfg.engine = engine;
+        cfg.memBackend = memBackend;
+        cfg.traceRecords = tracePath.has_value() ? traceRecords : 0;
+        cfg.profile = profilePath.has_value();
 
         if (!quiet) std::cout << "Launching VM instance '" << cfg.name << "' with memory " << cfg.memSize << " bytes" << std::endl;
         ILogger* loggerPtr = quiet ? nullptr : &logger;
@@ -258,14 +404,15 @@ int main(int argc, char** argv) {
         }
 
         auto loadProgram = [&](const std::optional<std::string>& path) -> std::vector<unsigned char> {
-            if (path.has_value()) return load_file_bytes(*path);
+            if (path.has_value()) return loadBinaryFile(*path);
             return build_demo_program();
         };
 
         if (interactive) {
-            std::cout << "Entering interactive mode. Commands: load <file>, start [steps], step [n], reset, dump, disasm [file],\n"
-                         "  break add <addr>|del <addr>|list, mem read <addr> <len>|write <addr> <b0> [b1...],\n"
-                         "  regs set Rn <val>, save <file>, loadsnap <file>, quit" << std::endl;
+            std::cout << "Entering interactive mode. Commands: load <file>, start [steps], cont, step [n], reset, dump, disasm [file],\n"
+                         "  break add <addr>|del <addr>|list, watch add|del <addr> <len> [r|w|c] / list,\n"
+                         "  mem read <addr> <len>|write <addr> <b0> [b1...],\n"
+                         "  regs set Rn <val>, save <file> [rle|map], delta <file>, loadsnap <file>, quit" << std::endl;
             std::vector<unsigned char> program = loadProgram(binaryPath);
             instance.loadProgramBytes(program);
             std::string line;
@@ -278,15 +425,17 @@ int main(int argc, char** argv) {
                 else if (cmd == "reset") { instance.loadProgramBytes(program); std::cout << "OK" << std::endl; }
                 else if (cmd == "dump") { dump_cpu_state(instance.cpu()); }
                 else if (cmd == "start") {
-                    std::size_t s = 0; iss >> s; if (s == 0) { instance.loadProgramBytes(program); instance.runUntilHalt(); } else { instance.loadProgramBytes(program); instance.runSteps(s); }
+                    std::size_t s = 0; iss >> s; instance.loadProgramBytes(program); report_stop(instance.runSteps(s), instance);
                     std::cout << "DONE" << std::endl;
+                } else if (cmd == "cont") {
+                    report_stop(instance.runUntilHalt(), instance); std::cout << "DONE" << std::endl;
                 } else if (cmd == "step") {
-                    std::size_t n = 1; iss >> n; if (n == 0) n = 1; instance.runSteps(n); std::cout << "STEPPED " << n << std::endl;
+                    std::size_t n = 1; iss >> n; if (n == 0) n = 1; report_stop(instance.runSteps(n), instance); std::cout << "STEPPED " << n << std::endl;
                 } else if (cmd == "load") {
                     std::string p; iss >> p; if (p.empty()) { std::cout << "No file" << std::endl; continue; }
-                    program = load_file_bytes(p); instance.loadProgramBytes(program); std::cout << "LOADED" << std::endl;
+                    program = loadBinaryFile(p); instance.loadProgramBytes(program); std::cout << "LOADED" << std::endl;
                 } else if (cmd == "disasm") {
-                    std::string p; iss >> p; if (!p.empty()) { auto b = load_file_bytes(p); disassemble(b); } else { disassemble(program); }
+                    std::string p; iss >> p; if (!p.empty()) { auto b = loadBinaryFile(p); disassemble(b); } else { disassemble(program); }
                 } else if (cmd == "break") {
                     std::string sub; iss >> sub;
                     auto parseNum = [](const std::string& s)->u32{ if (s.rfind("0x",0)==0||s.rfind("0X",0)==0) return static_cast<u32>(std::stoul(s,nullptr,16)); return static_cast<u32>(std::stoul(s,nullptr,10)); };
@@ -294,6 +443,16 @@ int main(int argc, char** argv) {
                     else if (sub == "del") { std::string a; iss >> a; if (a.empty()) { std::cout << "Usage: break del <addr>" << std::endl; } else { instance.removeBreakpoint(parseNum(a)); std::cout << "BP removed" << std::endl; } }
                     else if (sub == "list") { for (auto a : instance.breakpoints()) std::cout << std::hex << "0x" << a << std::dec << "\n"; if (instance.breakpoints().empty()) std::cout << "(none)" << std::endl; }
                     else { std::cout << "Usage: break add|del|list" << std::endl; }
+                } else if (cmd == "watch") {
+                    std::string sub, a, k; std::size_t len = 0; iss >> sub;
+                    auto parseNum = [](const std::string& s)->u32{ if (s.rfind("0x",0)==0||s.rfind("0X",0)==0) return static_cast<u32>(std::stoul(s,nullptr,16)); return static_cast<u32>(std::stoul(s,nullptr,10)); };
+                    auto kindName = [](WatchKind kind) { return kind == WatchKind::Read ? "r" : kind == WatchKind::Write ? "w" : "c"; };
+                    if (sub == "list") { for (const auto& w : instance.watches()) std::cout << std::hex << "0x" << w.base << std::dec << " " << w.size << " " << kindName(w.kind) << "\n"; if (instance.watches().empty()) std::cout << "(none)" << std::endl; }
+                    else if ((sub == "add" || sub == "del") && (iss >> a >> len) && len > 0) {
+                        iss >> k; const WatchKind kind = k == "r" ? WatchKind::Read : k == "c" ? WatchKind::Change : WatchKind::Write;
+                        if (sub == "add") { instance.addWatch(parseNum(a), len, kind); std::cout << "WATCH added" << std::endl; }
+                        else { instance.removeWatch(parseNum(a), len, kind); std::cout << "WATCH removed" << std::endl; }
+                    } else { std::cout << "Usage: watch add|del <addr> <len> [r|w|c] / watch list" << std::endl; }
                 } else if (cmd == "mem") {
                     std::string sub; iss >> sub;
                     auto parseNum = [](const std::string& s)->u32{ if (s.rfind("0x",0)==0||s.rfind("0X",0)==0) return static_cast<u32>(std::stoul(s,nullptr,16)); return static_cast<u32>(std::stoul(s,nullptr,10)); };
@@ -303,13 +462,27 @@ int main(int argc, char** argv) {
                 } else if (cmd == "regs") {
                     std::string sub; iss >> sub; if (sub == "set") { std::string r; unsigned long val; iss >> r >> val; if (r.size()<2 || (r[0]!='R' && r[0]!='r')) { std::cout << "Usage: regs set Rn <val>" << std::endl; } else { size_t idx = std::stoul(r.substr(1)); instance.cpu()->setReg(idx, (u32)val); std::cout << "OK" << std::endl; } } else { std::cout << "Usage: regs set Rn <val>" << std::endl; }
                 } else if (cmd == "save") {
-                    std::string p; iss >> p; if (p.empty()) { std::cout << "Usage: save <file>" << std::endl; } else { instance.saveSnapshot(p); std::cout << "SAVED" << std::endl; }
+                    std::string p, mode; iss >> p >> mode; if (p.empty()) { std::cout << "Usage: save <file> [rle|map]" << std::endl; } else { instance.saveSnapshot(p, mode == "rle" ? SnapshotEncoding::Rle : mode == "map" ? SnapshotEncoding::Mappable : SnapshotEncoding::Raw); std::cout << "SAVED" << std::endl; }
+                } else if (cmd == "delta") {
+                    std::string p; iss >> p; if (p.empty()) { std::cout << "Usage: delta <file>" << std::endl; } else { instance.appendSnapshotDelta(p); std::cout << "APPENDED" << std::endl; }
                 } else if (cmd == "loadsnap") {
                     std::string p; iss >> p; if (p.empty()) { std::cout << "Usage: loadsnap <file>" << std::endl; } else { instance.loadSnapshot(p); std::cout << "LOADED" << std::endl; }
                 } else {
                     std::cout << "Unknown command" << std::endl;
                 }
             }
+            if (tracePath.has_value()) instance.writeTrace(*tracePath);
+            if (profilePath.has_value()) write_profile(instance, *profilePath, profileFormat, symbolsPath);
+        } else if (binaryPath.has_value() && !disasmOnly) {
+            // Map the image: the header is checked in place and the payload
+            // copied into guest RAM once.
+            instance.loadProgramFile(*binaryPath, verifyHeader);
+            if (steps == 0) instance.runUntilHalt();
+            else instance.runSteps(steps);
+            if (dumpAfter) dump_cpu_state(instance.cpu());
+            if (stats) { dump_fusion_stats(instance.cpu()); dump_perf_counters(instance); }
+            if (tracePath.has_value()) instance.writeTrace(*tracePath);
+            if (profilePath.has_value()) write_profile(instance, *profilePath, profileFormat, symbolsPath);
         } else {
             std::vector<unsigned char> program = loadProgram(binaryPath);
             // Optional strict verification
@@ -324,6 +497,9 @@ int main(int argc, char** argv) {
                 if (steps == 0) { instance.loadProgramBytes(program); instance.runUntilHalt(); }
                 else { instance.loadProgramBytes(program); instance.runSteps(steps); }
                 if (dumpAfter) dump_cpu_state(instance.cpu());
+                if (stats) { dump_fusion_stats(instance.cpu()); dump_perf_counters(instance); }
+                if (tracePath.has_value()) instance.writeTrace(*tracePath);
+                if (profilePath.has_value()) write_profile(instance, *profilePath, profileFormat, symbolsPath);
             }
         }
         return 0;
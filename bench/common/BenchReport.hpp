@@ -0,0 +1,154 @@
+#pragma once
+
+// JSON results, baselines and the regression check shared by vm_bench and
+// vm_microbench, so both tools read and write the same format.
+
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vm::bench {
+
+// A flat JSON object; fields are written in the order they are added.
+class JsonObject {
+public:
+    JsonObject& add(const std::string& key, const std::string& value) {
+        m_fields.emplace_back(key, '"' + value + '"');
+        return *this;
+    }
+    JsonObject& add(const std::string& key, const char* value) { return add(key, std::string(value)); }
+    template <typename T>
+    JsonObject& add(const std::string& key, const T& value) {
+        std::ostringstream os;
+        os << value;
+        m_fields.emplace_back(key, os.str());
+        return *this;
+    }
+
+    const std::vector<std::pair<std::string, std::string>>& fields() const { return m_fields; }
+
+    // {"key": value, ...} on one line.
+    std::string str() const {
+        std::string out = "{";
+        for (std::size_t i = 0; i < m_fields.size(); ++i) {
+            out += (i ? ", \"" : "\"") + m_fields[i].first + "\": " + m_fields[i].second;
+        }
+        return out + '}';
+    }
+
+private:
+    std::vector<std::pair<std::string, std::string>> m_fields;
+};
+
+// { <top-level fields>, "results": [ one object per line ] }
+inline void writeResultsJson(std::ostream& out, const JsonObject& top, const std::vector<JsonObject>& results) {
+    out << "{\n";
+    for (const auto& [key, value] : top.fields()) out << "  \"" << key << "\": " << value << ",\n";
+    out << "  \"results\": [";
+    for (std::size_t i = 0; i < results.size(); ++i) out << (i ? ",\n    " : "\n    ") << results[i].str();
+    out << (results.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
+
+// Result key (the values of the key fields, in order) => baseline value.
+using Baseline = std::map<std::vector<std::string>, double>;
+
+// Reads back the result objects writeResultsJson() produces. Objects without
+// the first key field or the value field are skipped.
+inline Baseline readBaseline(const std::string& path, const std::vector<std::string>& keyFields,
+                             const std::string& valueField) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Failed to open baseline: " + path);
+    std::stringstream ss;
+    ss << in.rdbuf();
+    const std::string text = ss.str();
+    auto field = [](const std::string& obj, const std::string& key) -> std::string {
+        const std::string tag = "\"" + key + "\":";
+        auto pos = obj.find(tag);
+        if (pos == std::string::npos) return {};
+        pos = obj.find_first_not_of(" \t", pos + tag.size());
+        if (pos == std::string::npos) return {};
+        if (obj[pos] == '"') return obj.substr(pos + 1, obj.find('"', pos + 1) - pos - 1);
+        return obj.substr(pos, obj.find_first_of(",}", pos) - pos);
+    };
+    Baseline base;
+    for (std::size_t open = text.find('{', 1); open != std::string::npos; open = text.find('{', open + 1)) {
+        const std::string obj = text.substr(open, text.find('}', open) - open + 1);
+        std::vector<std::string> key;
+        for (const std::string& f : keyFields) key.push_back(field(obj, f));
+        const std::string value = field(obj, valueField);
+        if (!key.empty() && !key.front().empty() && !value.empty()) base[key] = std::stod(value);
+    }
+    return base;
+}
+
+// --json / --baseline / --tolerance, parsed the same way by every tool.
+struct BaselineOptions {
+    std::optional<std::string> jsonPath;
+    std::optional<std::string> baselinePath;
+    double tolerance{10.0};
+
+    // Consumes argv[i] (and its value) if it is one of these options.
+    bool parse(int argc, char** argv, int& i) {
+        const std::string arg = argv[i];
+        if (i + 1 >= argc) return false;
+        if (arg == "--json") jsonPath = argv[++i];
+        else if (arg == "--baseline") baselinePath = argv[++i];
+        else if (arg == "--tolerance") tolerance = std::stod(argv[++i]);
+        else return false;
+        return true;
+    }
+
+    static std::string usage(const std::string& metric) {
+        return "  --json FILE       write results as JSON (a baseline for --baseline)\n"
+               "  --baseline FILE   compare " + metric + " against an earlier --json file\n"
+               "  --tolerance PCT   slowdown that counts as a regression (default 10)\n";
+    }
+};
+
+// Compares results against a baseline, where larger values are slower.
+class RegressionCheck {
+public:
+    RegressionCheck(Baseline baseline, double tolerance) : m_baseline(std::move(baseline)), m_tolerance(tolerance) {}
+
+    bool active() const { return !m_baseline.empty(); }
+
+    // Prints the change against the baseline, if it has this key, and
+    // "REGRESSION" when it exceeds the tolerance.
+    void compare(std::ostream& out, const std::vector<std::string>& key, double value) {
+        auto it = m_baseline.find(key);
+        if (it == m_baseline.end() || it->second <= 0) return;
+        const double change = (value / it->second - 1.0) * 100.0;
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+        out << "  " << std::fixed << std::showpos << std::setprecision(1) << change << "%";
+        out.flags(flags);
+        out.precision(precision);
+        if (change > m_tolerance) {
+            out << " REGRESSION";
+            ++m_regressions;
+        }
+    }
+
+    // Prints a summary if anything regressed; returns the exit code (0 or 1).
+    int finish(std::ostream& out, const std::string& what) const {
+        if (!m_regressions) return 0;
+        out << m_regressions << ' ' << what << " slower than the baseline by more than " << m_tolerance << "%"
+            << std::endl;
+        return 1;
+    }
+
+private:
+    Baseline m_baseline;
+    double m_tolerance;
+    std::size_t m_regressions{0};
+};
+
+} // namespace vm::bench
@@ -0,0 +1,357 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "vm/Config.hpp"
+#include "vm/Instance.hpp"
+#include "vm/Opcodes.hpp"
+#include "vm/PerfCounters.hpp"
+#include "vm/Profiler.hpp"
+#include "common/BenchReport.hpp"
+
+using namespace vm;
+using namespace vm::bench;
+
+namespace {
+
+// Guest code builder with forward label references (32-bit absolute targets).
+class Program {
+public:
+    void label(const std::string& name) { m_labels[name] = static_cast<u32>(m_code.size()); }
+
+    void loadi(u8 r, u32 imm) { op(Opcode::LOADI); byte(r); imm32(imm); }
+    void load(u8 d, u8 base, u16 off) { op(Opcode::LOAD); byte(d); byte(base); imm16(off); }
+    void store(u8 base, u16 off, u8 src) { op(Opcode::STORE); byte(base); byte(src); imm16(off); }
+    void alu(Opcode o, u8 d, u8 a, u8 b) { op(o); byte(d); byte(a); byte(b); }
+    void cmp(u8 a, u8 b) { op(Opcode::CMP); byte(a); byte(b); }
+    void push(u8 r) { op(Opcode::PUSH); byte(r); }
+    void pop(u8 r) { op(Opcode::POP); byte(r); }
+    void jump(Opcode o, const std::string& target) {
+        op(o);
+        m_fixups.emplace_back(m_code.size(), target);
+        imm32(0);
+    }
+    void ret() { op(Opcode::RET); }
+    void halt() { op(Opcode::HALT); }
+
+    std::vector<unsigned char> finish() const {
+        std::vector<unsigned char> out = m_code;
+        for (const auto& [at, name] : m_fixups) {
+            const u32 addr = m_labels.at(name);
+            for (int i = 0; i < 4; ++i) out[at + i] = static_cast<unsigned char>(addr >> (8 * i));
+        }
+        return out;
+    }
+
+private:
+    void op(Opcode o) { byte(static_cast<u8>(o)); }
+    void byte(u8 b) { m_code.push_back(b); }
+    void imm16(u16 v) { byte(static_cast<u8>(v)); byte(static_cast<u8>(v >> 8)); }
+    void imm32(u32 v) { for (int i = 0; i < 4; ++i) byte(static_cast<u8>(v >> (8 * i))); }
+
+    std::vector<unsigned char> m_code;
+    std::map<std::string, u32> m_labels;
+    std::vector<std::pair<std::size_t, std::string>> m_fixups;
+};
+
+struct Workload {
+    std::string name;
+    std::string description;
+    std::size_t memSize;
+    std::vector<unsigned char> program;
+};
+
+u32 scaled(u32 n, double scale) { return std::max<u32>(1, static_cast<u32>(std::lround(n * scale))); }
+
+// R6 holds 0 and R1 holds 1 in every workload; loop counters count down to R6.
+std::vector<Workload> buildCorpus(double scale) {
+    std::vector<Workload> corpus;
+    {
+        Program p;
+        p.loadi(1, 1); p.loadi(6, 0); p.loadi(2, scaled(3000000, scale)); p.loadi(0, 7);
+        p.label("loop");
+        p.alu(Opcode::ADD, 0, 0, 1);
+        p.alu(Opcode::XOR, 3, 0, 2);
+        p.alu(Opcode::AND, 4, 3, 0);
+        p.alu(Opcode::OR, 5, 4, 3);
+        p.alu(Opcode::SUB, 2, 2, 1);
+        p.cmp(2, 6);
+        p.jump(Opcode::JNZ, "loop");
+        p.halt();
+        corpus.push_back({"alu", "tight ALU loop (ADD/XOR/AND/OR/SUB, CMP+JNZ)", 64 * 1024, p.finish()});
+    }
+    {
+        // f(n): n == 0 ? return : (push n; f(n - 1); pop n); 1000 frames deep per call.
+        Program p;
+        p.loadi(1, 1); p.loadi(6, 0); p.loadi(2, scaled(3000, scale));
+        p.label("outer");
+        p.loadi(0, 1000);
+        p.jump(Opcode::CALL, "f");
+        p.alu(Opcode::SUB, 2, 2, 1);
+        p.cmp(2, 6);
+        p.jump(Opcode::JNZ, "outer");
+        p.halt();
+        p.label("f");
+        p.cmp(0, 6);
+        p.jump(Opcode::JZ, "done");
+        p.push(0);
+        p.alu(Opcode::SUB, 0, 0, 1);
+        p.jump(Opcode::CALL, "f");
+        p.pop(0);
+        p.label("done");
+        p.ret();
+        corpus.push_back({"recursion", "deep CALL/RET recursion (1000 frames)", 64 * 1024, p.finish()});
+    }
+    {
+        // Read-modify-write over a 256 KiB buffer, larger than a typical L1/L2 slice.
+        constexpr u32 BUF = 0x10000, BUF_BYTES = 256 * 1024;
+        Program p;
+        p.loadi(1, 1); p.loadi(6, 0); p.loadi(5, 4); p.loadi(7, BUF + BUF_BYTES);
+        p.loadi(2, scaled(50, scale));
+        p.label("pass");
+        p.loadi(4, BUF);
+        p.label("word");
+        p.load(3, 4, 0);
+        p.alu(Opcode::ADD, 3, 3, 1);
+        p.store(4, 0, 3);
+        p.alu(Opcode::ADD, 4, 4, 5);
+        p.cmp(4, 7);
+        p.jump(Opcode::JNZ, "word");
+        p.alu(Opcode::SUB, 2, 2, 1);
+        p.cmp(2, 6);
+        p.jump(Opcode::JNZ, "pass");
+        p.halt();
+        corpus.push_back({"memstream", "LOAD/ADD/STORE streaming over 256 KiB", 1024 * 1024, p.finish()});
+    }
+    {
+        constexpr std::size_t MEM = 64 * 1024;
+        Program p;
+        p.loadi(1, 1); p.loadi(6, 0); p.loadi(0, 0); p.loadi(5, static_cast<u32>(MEM - 256));
+        p.loadi(2, scaled(1000000, scale));
+        p.label("loop");
+        p.alu(Opcode::ADD, 0, 0, 1);
+        p.store(5, 0, 0); // console device
+        p.alu(Opcode::SUB, 2, 2, 1);
+        p.cmp(2, 6);
+        p.jump(Opcode::JNZ, "loop");
+        p.halt();
+        corpus.push_back({"mmio", "stores to the console device (output discarded)", MEM, p.finish()});
+    }
+    {
+        Program p;
+        p.loadi(1, 1); p.loadi(6, 0); p.loadi(2, scaled(2000000, scale));
+        p.label("loop");
+        p.push(0); p.push(1); p.push(2); p.push(3);
+        p.pop(3); p.pop(2); p.pop(1); p.pop(0);
+        p.alu(Opcode::SUB, 2, 2, 1);
+        p.cmp(2, 6);
+        p.jump(Opcode::JNZ, "loop");
+        p.halt();
+        corpus.push_back({"stack", "PUSH/POP churn, four deep", 64 * 1024, p.finish()});
+    }
+    return corpus;
+}
+
+// Swallows guest console output.
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+// Peak RSS of this process in KiB. resetPeakRss() makes it per workload on
+// Linux; elsewhere the value is the process-wide peak so far.
+bool resetPeakRss() {
+    std::ofstream f("/proc/self/clear_refs");
+    return f && (f << "5") && f.flush();
+}
+
+long peakRssKb() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0) return std::stol(line.substr(6));
+    }
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+const char* engineName(CpuEngine e) {
+    switch (e) {
+        case CpuEngine::Threaded: return "threaded";
+        case CpuEngine::Jit: return "jit";
+        default: return "interp";
+    }
+}
+
+struct Result {
+    std::string name;
+    std::string engine;
+    u64 instructions{0};
+    double seconds{0.0};
+    long peakRssKb{0};
+
+    double ips() const { return seconds > 0 ? static_cast<double>(instructions) / seconds : 0.0; }
+    double nsPerInst() const { return instructions ? seconds * 1e9 / static_cast<double>(instructions) : 0.0; }
+};
+
+// The default SP sits just above the console device window at memSize - 256,
+// so a deep stack would run into it; start the stack below the device page.
+void loadWorkload(VMInstance& vm, const Workload& w) {
+    vm.powerOn();
+    vm.loadProgramBytes(w.program);
+    vm.cpu()->setSP(static_cast<u32>(w.memSize - 256));
+}
+
+Result runWorkload(const Workload& w, CpuEngine engine, MemoryBackend backend, int repeat, u64 instructions) {
+    NullBuffer nullBuf;
+    std::ostream nullOut(&nullBuf);
+    Result res;
+    res.name = w.name;
+    res.engine = engineName(engine);
+    res.seconds = 1e300;
+    resetPeakRss();
+    for (int r = 0; r < repeat; ++r) {
+        VMConfig cfg;
+        cfg.memSize = w.memSize;
+        cfg.memBackend = backend;
+        cfg.engine = engine;
+        cfg.consoleOut = &nullOut;
+        VMInstance vm(cfg);
+        loadWorkload(vm, w);
+        const auto start = std::chrono::steady_clock::now();
+        const RunOutcome outcome = vm.runUntilHalt();
+        const double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (outcome != RunOutcome::Halted) throw std::runtime_error("workload " + w.name + " did not halt");
+        res.seconds = std::min(res.seconds, secs);
+        if (PerfCounters::ENABLED) instructions = vm.cpu()->perfCounters().totalRetired();
+    }
+    res.instructions = instructions;
+    res.peakRssKb = peakRssKb();
+    return res;
+}
+
+// Retired instruction count of a workload, for builds without VM_PERF_COUNTERS.
+u64 countInstructions(const Workload& w) {
+    NullBuffer nullBuf;
+    std::ostream nullOut(&nullBuf);
+    VMConfig cfg;
+    cfg.memSize = w.memSize;
+    cfg.engine = CpuEngine::Jit;
+    cfg.consoleOut = &nullOut;
+    cfg.profile = true;
+    VMInstance vm(cfg);
+    loadWorkload(vm, w);
+    vm.runUntilHalt();
+    return vm.profile()->total();
+}
+
+JsonObject toJson(const Result& r) {
+    JsonObject obj;
+    obj.add("name", r.name).add("engine", r.engine).add("instructions", r.instructions).add("seconds", r.seconds);
+    obj.add("ips", std::llround(r.ips())).add("ns_per_inst", r.nsPerInst()).add("peak_rss_kb", r.peakRssKb);
+    return obj;
+}
+
+void usage() {
+    std::cerr << "Usage: vm_bench [options]\n"
+                 "  --engine E        interp|threaded|jit|all (default all)\n"
+                 "  --mem-backend B   dense|sparse (default dense)\n"
+                 "  --filter NAME     run only workloads whose name contains NAME\n"
+                 "  --repeat N        timed runs per workload, best is reported (default 3)\n"
+                 "  --scale F         multiply iteration counts by F (default 1)\n"
+              << BaselineOptions::usage("ns/instruction")
+              << "  --list            list the workloads and exit\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        std::vector<CpuEngine> engines{CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit};
+        MemoryBackend backend = MemoryBackend::Dense;
+        std::string filter;
+        int repeat = 3;
+        double scale = 1.0;
+        bool list = false;
+        BaselineOptions report;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--engine" && i + 1 < argc) {
+                const std::string e = argv[++i];
+                if (e == "interp" || e == "interpreter") engines = {CpuEngine::Interpreter};
+                else if (e == "threaded") engines = {CpuEngine::Threaded};
+                else if (e == "jit") engines = {CpuEngine::Jit};
+                else if (e != "all") throw std::runtime_error("Unknown engine: " + e);
+            } else if (arg == "--mem-backend" && i + 1 < argc) {
+                const std::string b = argv[++i];
+                if (b == "dense") backend = MemoryBackend::Dense;
+                else if (b == "sparse") backend = MemoryBackend::Sparse;
+                else throw std::runtime_error("Unknown memory backend: " + b);
+            } else if (arg == "--filter" && i + 1 < argc) {
+                filter = argv[++i];
+            } else if (arg == "--repeat" && i + 1 < argc) {
+                repeat = std::max(1, std::stoi(argv[++i]));
+            } else if (arg == "--scale" && i + 1 < argc) {
+                scale = std::stod(argv[++i]);
+            } else if (report.parse(argc, argv, i)) {
+                continue;
+            } else if (arg == "--list") {
+                list = true;
+            } else {
+                usage();
+                return 2;
+            }
+        }
+
+        const std::vector<Workload> corpus = buildCorpus(scale);
+        if (list) {
+            for (const Workload& w : corpus) std::cout << std::left << std::setw(12) << w.name << w.description << '\n';
+            return 0;
+        }
+        RegressionCheck check(report.baselinePath ? readBaseline(*report.baselinePath, {"name", "engine"}, "ns_per_inst")
+                                                  : Baseline{},
+                              report.tolerance);
+
+        std::vector<JsonObject> results;
+        std::cout << std::left << std::setw(12) << "workload" << std::setw(10) << "engine" << std::right
+                  << std::setw(14) << "instructions" << std::setw(10) << "MIPS" << std::setw(10) << "ns/inst"
+                  << std::setw(12) << "peak RSS" << (check.active() ? "  vs baseline" : "") << '\n';
+        for (const Workload& w : corpus) {
+            if (!filter.empty() && w.name.find(filter) == std::string::npos) continue;
+            const u64 instructions = PerfCounters::ENABLED ? 0 : countInstructions(w);
+            for (CpuEngine engine : engines) {
+                const Result r = runWorkload(w, engine, backend, repeat, instructions);
+                std::cout << std::left << std::setw(12) << r.name << std::setw(10) << r.engine << std::right
+                          << std::setw(14) << r.instructions << std::setw(10) << std::fixed << std::setprecision(1)
+                          << r.ips() / 1e6 << std::setw(10) << std::setprecision(2) << r.nsPerInst()
+                          << std::setw(9) << r.peakRssKb << " KiB";
+                check.compare(std::cout, {r.name, r.engine}, r.nsPerInst());
+                std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+                results.push_back(toJson(r));
+            }
+        }
+        if (report.jsonPath) {
+            std::ofstream jfs(*report.jsonPath);
+            if (!jfs) throw std::runtime_error("Failed to open JSON output: " + *report.jsonPath);
+            writeResultsJson(jfs, JsonObject().add("scale", scale), results);
+        }
+        return check.finish(std::cout, "result(s)");
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+}
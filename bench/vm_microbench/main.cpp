@@ -0,0 +1,453 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "vm/Assembler.hpp"
+#include "vm/Bus.hpp"
+#include "vm/Checksum.hpp"
+#include "vm/Config.hpp"
+#include "vm/Decoder.hpp"
+#include "vm/Device.hpp"
+#include "vm/Instance.hpp"
+#include "vm/Memory.hpp"
+#include "vm/Opcodes.hpp"
+#include "vm/ProgramLoader.hpp"
+#include "common/BenchReport.hpp"
+
+using namespace vm;
+using namespace vm::bench;
+
+namespace {
+
+// Keeps `v` alive so the compiler cannot drop the work that produced it.
+template <typename T>
+inline void keep(const T& v) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(v) : "memory");
+#else
+    static volatile T sink;
+    sink = v;
+#endif
+}
+
+// A benchmark body performs `n` operations. make() builds the fixture, so
+// filtered-out benchmarks allocate nothing.
+using Body = std::function<void(std::size_t n)>;
+
+struct Bench {
+    std::string name;
+    std::string description;
+    std::size_t bytesPerOp; // for MB/s; 0 => not a throughput benchmark
+    std::function<Body()> make;
+};
+
+// Device that accepts everything and does nothing, to measure bus dispatch alone.
+class NullDevice : public IDevice {
+public:
+    const char* name() const override { return "Null"; }
+    std::size_t size() const override { return 16; }
+    u8  read8(std::size_t) override { return 0; }
+    u16 read16(std::size_t) override { return 0; }
+    u32 read32(std::size_t offset) override { return static_cast<u32>(offset); }
+    void write8(std::size_t, u8) override {}
+    void write16(std::size_t, u16) override {}
+    void write32(std::size_t, u32) override {}
+};
+
+// Bytes of a mix of every instruction format, repeated to fill `size` bytes
+// (the tail is HALTs).
+std::vector<unsigned char> instructionMix(std::size_t size) {
+    const std::vector<unsigned char> unit{
+        static_cast<u8>(Opcode::LOADI), 1, 0x78, 0x56, 0x34, 0x12,
+        static_cast<u8>(Opcode::ADD), 2, 1, 3,
+        static_cast<u8>(Opcode::LOAD), 4, 5, 0x10, 0x00,
+        static_cast<u8>(Opcode::CMP), 2, 6,
+        static_cast<u8>(Opcode::STORE), 5, 4, 0x20, 0x00,
+        static_cast<u8>(Opcode::PUSH), 4,
+        static_cast<u8>(Opcode::XOR), 3, 3, 2,
+        static_cast<u8>(Opcode::POP), 4,
+        static_cast<u8>(Opcode::JNZ), 0x00, 0x01, 0x00, 0x00,
+        static_cast<u8>(Opcode::CALL), 0x00, 0x02, 0x00, 0x00,
+        static_cast<u8>(Opcode::RET),
+    };
+    std::vector<unsigned char> out(size, static_cast<u8>(Opcode::HALT));
+    for (std::size_t at = 0; at + unit.size() <= size; at += unit.size()) {
+        std::copy(unit.begin(), unit.end(), out.begin() + static_cast<std::ptrdiff_t>(at));
+    }
+    return out;
+}
+
+constexpr std::size_t RAM_SIZE = 1024 * 1024;
+constexpr std::size_t WORKING_SET = 64 * 1024; // RAM addresses cycled through by the accessor benchmarks
+
+// Accessor benchmarks walk a 64 KiB window word by word through the IMemory
+// interface, i.e. the virtual path the engines fall back to.
+Bench ramRead32() {
+    return {"ram.read32", "RamMemory::read32, sequential", 4, [] {
+        auto ram = std::make_shared<RamMemory>(RAM_SIZE);
+        return Body([ram](std::size_t n) {
+            const IMemory& mem = *ram;
+            u32 sum = 0;
+            for (std::size_t i = 0; i < n; ++i) sum += mem.read32((i * 4) & (WORKING_SET - 1));
+            keep(sum);
+        });
+    }};
+}
+
+Bench ramWrite32() {
+    return {"ram.write32", "RamMemory::write32, sequential", 4, [] {
+        auto ram = std::make_shared<RamMemory>(RAM_SIZE);
+        return Body([ram](std::size_t n) {
+            IMemory& mem = *ram;
+            for (std::size_t i = 0; i < n; ++i) mem.write32((i * 4) & (WORKING_SET - 1), static_cast<u32>(i));
+        });
+    }};
+}
+
+// BusMemory over RAM with `devices` NullDevices packed into the top page,
+// as the console is. `hitDevice` makes every access land on the last one.
+Bench busAccess(bool write, std::size_t devices, bool hitDevice) {
+    std::string name = std::string("bus.") + (write ? "write32" : "read32") + ".dev" + std::to_string(devices);
+    if (hitDevice) name += ".mmio";
+    std::string desc = "BusMemory::" + std::string(write ? "write32" : "read32") + " with " +
+                       std::to_string(devices) + " device(s), " + (hitDevice ? "device window" : "RAM");
+    return {name, desc, 4, [write, devices, hitDevice] {
+        struct Fixture {
+            RamMemory ram{RAM_SIZE};
+            BusMemory bus{ram};
+        };
+        auto fx = std::make_shared<Fixture>();
+        const std::size_t top = RAM_SIZE - BusMemory::PAGE_SIZE;
+        for (std::size_t d = 0; d < devices; ++d) fx->bus.mapDevice(top + d * 16, std::make_shared<NullDevice>());
+        const std::size_t devAddr = top + (devices ? devices - 1 : 0) * 16;
+        if (write) {
+            return Body([fx, hitDevice, devAddr](std::size_t n) {
+                IMemory& mem = fx->bus;
+                for (std::size_t i = 0; i < n; ++i) {
+                    mem.write32(hitDevice ? devAddr + (i & 12) : (i * 4) & (WORKING_SET - 1), static_cast<u32>(i));
+                }
+            });
+        }
+        return Body([fx, hitDevice, devAddr](std::size_t n) {
+            const IMemory& mem = fx->bus;
+            u32 sum = 0;
+            for (std::size_t i = 0; i < n; ++i) sum += mem.read32(hitDevice ? devAddr + (i & 12) : (i * 4) & (WORKING_SET - 1));
+            keep(sum);
+        });
+    }};
+}
+
+Bench decode() {
+    return {"decoder.decode", "SimpleDecoder::decode over a mixed instruction stream", 0, [] {
+        struct Fixture {
+            RamMemory ram{RAM_SIZE};
+            SimpleDecoder decoder;
+        };
+        auto fx = std::make_shared<Fixture>();
+        const std::vector<unsigned char> code = instructionMix(WORKING_SET);
+        fx->ram.writeBytes(0, code.data(), code.size());
+        return Body([fx](std::size_t n) {
+            const IDecoder& dec = fx->decoder;
+            u32 pc = 0;
+            u32 sum = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                const DecodedInst inst = dec.decode(fx->ram, pc);
+                sum += inst.imm;
+                pc += inst.size;
+                if (pc >= WORKING_SET - 8) pc = 0;
+            }
+            keep(sum);
+        });
+    }};
+}
+
+Bench adler(std::size_t len) {
+    const std::string size = len >= 1024 * 1024 ? std::to_string(len >> 20) + "M" : std::to_string(len >> 10) + "K";
+    return {"adler32." + size, "adler32 over a " + size + "iB buffer", len, [len] {
+        auto data = std::make_shared<std::vector<unsigned char>>(instructionMix(len));
+        return Body([data](std::size_t n) {
+            u32 sum = 1;
+            for (std::size_t i = 0; i < n; ++i) sum = adler32(data->data(), data->size(), sum);
+            keep(sum);
+        });
+    }};
+}
+
+Bench stripHeader() {
+    constexpr std::size_t PAYLOAD = 64 * 1024;
+    return {"loader.strip", "stripProgramHeader on a 64 KiB v2 image", PAYLOAD, [] {
+        const std::vector<unsigned char> payload = instructionMix(PAYLOAD);
+        ProgramHeaderV2 hdr{{'V', 'M', 'B', '1'}, 2, 0, static_cast<std::uint32_t>(payload.size()),
+                            adler32(payload.data(), payload.size())};
+        auto image = std::make_shared<std::vector<unsigned char>>(sizeof hdr + payload.size());
+        std::memcpy(image->data(), &hdr, sizeof hdr);
+        std::memcpy(image->data() + sizeof hdr, payload.data(), payload.size());
+        return Body([image](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) keep(stripProgramHeader(*image).size());
+        });
+    }};
+}
+
+// One source line per instruction format plus a label and a comment,
+// repeated `copies` times with unique labels.
+std::string assemblySource(std::size_t copies) {
+    std::ostringstream src;
+    for (std::size_t i = 0; i < copies; ++i) {
+        src << "block" << i << ":  ; unit " << i << "\n"
+            << "        LOADI R1, 0x12345678\n"
+            << "        ADD   R2, R1, R3\n"
+            << "        LOAD  R4, [R5 + 16]\n"
+            << "        CMP   R2, R6\n"
+            << "        STORE [R5 + 32], R4\n"
+            << "        PUSH  R4\n"
+            << "        POP   R4\n"
+            << "        JNZ   block" << i << "\n"
+            << "        CALL  block0\n"
+            << "        RET\n";
+    }
+    return src.str();
+}
+
+Bench assembleSource() {
+    constexpr std::size_t COPIES = 1000;
+    return {"asm.assemble", "assemble() of an 11000-line source", 0, [] {
+        auto source = std::make_shared<std::string>(assemblySource(COPIES));
+        return Body([source](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) keep(assemble(*source).code.size());
+        });
+    }};
+}
+
+std::string snapshotPath() { return (std::filesystem::temp_directory_path() / "vm_microbench.snp").string(); }
+
+// A 1 MiB instance with code and a quarter of RAM touched, as after a run.
+std::shared_ptr<VMInstance> snapshotFixture() {
+    VMConfig cfg;
+    cfg.memSize = RAM_SIZE;
+    auto inst = std::make_shared<VMInstance>(cfg);
+    inst->powerOn();
+    inst->loadProgramBytes(instructionMix(WORKING_SET));
+    inst->memWrite(WORKING_SET, instructionMix(RAM_SIZE / 4));
+    return inst;
+}
+
+Bench snapshotSave(SnapshotEncoding encoding, const std::string& suffix) {
+    return {"snapshot.save." + suffix, "VMInstance::saveSnapshot (" + suffix + ") of 1 MiB", RAM_SIZE, [encoding] {
+        auto inst = snapshotFixture();
+        return Body([inst, encoding](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) inst->saveSnapshot(snapshotPath(), encoding);
+        });
+    }};
+}
+
+Bench snapshotLoad(SnapshotEncoding encoding, const std::string& suffix) {
+    return {"snapshot.load." + suffix, "VMInstance::loadSnapshot (" + suffix + ") of 1 MiB", RAM_SIZE, [encoding] {
+        auto inst = snapshotFixture();
+        inst->saveSnapshot(snapshotPath(), encoding);
+        return Body([inst](std::size_t n) {
+            for (std::size_t i = 0; i < n; ++i) inst->loadSnapshot(snapshotPath());
+        });
+    }};
+}
+
+std::vector<Bench> buildSuite() {
+    std::vector<Bench> suite;
+    suite.push_back(decode());
+    suite.push_back(ramRead32());
+    suite.push_back(ramWrite32());
+    for (std::size_t devices : {0, 1, 4, 16}) {
+        suite.push_back(busAccess(false, devices, false));
+        suite.push_back(busAccess(true, devices, false));
+    }
+    for (std::size_t devices : {1, 16}) {
+        suite.push_back(busAccess(false, devices, true));
+        suite.push_back(busAccess(true, devices, true));
+    }
+    suite.push_back(adler(4 * 1024));
+    suite.push_back(adler(1024 * 1024));
+    suite.push_back(stripHeader());
+    suite.push_back(assembleSource());
+    suite.push_back(snapshotSave(SnapshotEncoding::Raw, "raw"));
+    suite.push_back(snapshotSave(SnapshotEncoding::Rle, "rle"));
+    suite.push_back(snapshotLoad(SnapshotEncoding::Raw, "raw"));
+    suite.push_back(snapshotLoad(SnapshotEncoding::Rle, "rle"));
+    return suite;
+}
+
+struct Stats {
+    std::string name;
+    std::size_t opsPerSample{0};
+    std::size_t samples{0};
+    double medianNs{0}, meanNs{0}, stddevNs{0}, minNs{0}, maxNs{0}; // per operation
+    double bytesPerOp{0};
+
+    double mbPerSec() const { return medianNs > 0 ? bytesPerOp * 1e3 / medianNs : 0.0; }
+    double cvPercent() const { return meanNs > 0 ? stddevNs * 100.0 / meanNs : 0.0; }
+};
+
+double timeOnce(const Body& body, std::size_t n) {
+    const auto start = std::chrono::steady_clock::now();
+    body(n);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Grows the operation count until one sample takes at least `minSampleNs`,
+// then takes `samples` timed samples of that many operations (after one
+// untimed warm-up sample).
+Stats measure(const Bench& bench, std::size_t samples, double minSampleNs) {
+    const Body body = bench.make();
+    std::size_t n = 1;
+    for (double ns = timeOnce(body, n); ns < minSampleNs; ns = timeOnce(body, n)) {
+        const double grow = ns > 0 ? minSampleNs * 1.2 / ns : 10.0;
+        n = static_cast<std::size_t>(static_cast<double>(n) * std::clamp(grow, 2.0, 10.0));
+    }
+    timeOnce(body, n);
+
+    std::vector<double> perOp;
+    for (std::size_t s = 0; s < samples; ++s) perOp.push_back(timeOnce(body, n) / static_cast<double>(n));
+    std::sort(perOp.begin(), perOp.end());
+
+    Stats st;
+    st.name = bench.name;
+    st.opsPerSample = n;
+    st.samples = samples;
+    st.bytesPerOp = static_cast<double>(bench.bytesPerOp);
+    const std::size_t mid = samples / 2;
+    st.medianNs = samples % 2 ? perOp[mid] : (perOp[mid - 1] + perOp[mid]) / 2;
+    st.minNs = perOp.front();
+    st.maxNs = perOp.back();
+    for (double v : perOp) st.meanNs += v;
+    st.meanNs /= static_cast<double>(samples);
+    for (double v : perOp) st.stddevNs += (v - st.meanNs) * (v - st.meanNs);
+    st.stddevNs = samples > 1 ? std::sqrt(st.stddevNs / static_cast<double>(samples - 1)) : 0.0;
+    return st;
+}
+
+// Restricts this process to one CPU so samples do not migrate between cores
+// (and their caches) mid-measurement. -1 picks the CPU we are running on.
+std::optional<int> pinToCpu(int cpu) {
+#ifdef __linux__
+    if (cpu < 0) cpu = sched_getcpu();
+    if (cpu < 0) return std::nullopt;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof set, &set) != 0) return std::nullopt;
+    return cpu;
+#else
+    (void)cpu;
+    return std::nullopt;
+#endif
+}
+
+JsonObject toJson(const Stats& r) {
+    JsonObject obj;
+    obj.add("name", r.name).add("samples", r.samples).add("ops_per_sample", r.opsPerSample);
+    obj.add("median_ns", r.medianNs).add("mean_ns", r.meanNs).add("stddev_ns", r.stddevNs);
+    obj.add("min_ns", r.minNs).add("max_ns", r.maxNs);
+    return obj;
+}
+
+void usage() {
+    std::cerr << "Usage: vm_microbench [options]\n"
+                 "  --filter NAME     run only benchmarks whose name contains NAME\n"
+                 "  --samples N       timed samples per benchmark (default 15)\n"
+                 "  --min-time MS     minimum duration of one sample (default 10)\n"
+                 "  --cpu N           pin to CPU N (default: the current CPU)\n"
+                 "  --no-pin          do not pin\n"
+              << BaselineOptions::usage("median ns/op")
+              << "  --list            list the benchmarks and exit\n";
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        std::string filter;
+        std::size_t samples = 15;
+        double minTimeMs = 10.0;
+        bool pin = true;
+        int pinCpu = -1;
+        bool list = false;
+        BaselineOptions report;
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+            if (arg == "--filter" && i + 1 < argc) {
+                filter = argv[++i];
+            } else if (arg == "--samples" && i + 1 < argc) {
+                samples = static_cast<std::size_t>(std::max(1, std::stoi(argv[++i])));
+            } else if (arg == "--min-time" && i + 1 < argc) {
+                minTimeMs = std::stod(argv[++i]);
+            } else if (arg == "--cpu" && i + 1 < argc) {
+                pinCpu = std::stoi(argv[++i]);
+            } else if (arg == "--no-pin") {
+                pin = false;
+            } else if (report.parse(argc, argv, i)) {
+                continue;
+            } else if (arg == "--list") {
+                list = true;
+            } else {
+                usage();
+                return 2;
+            }
+        }
+
+        const std::vector<Bench> suite = buildSuite();
+        if (list) {
+            for (const Bench& b : suite) std::cout << std::left << std::setw(24) << b.name << b.description << '\n';
+            return 0;
+        }
+        RegressionCheck check(report.baselinePath ? readBaseline(*report.baselinePath, {"name"}, "median_ns") : Baseline{},
+                              report.tolerance);
+
+        if (pin) {
+            const std::optional<int> cpu = pinToCpu(pinCpu);
+            if (cpu) std::cout << "pinned to CPU " << *cpu << '\n';
+            else std::cout << "warning: could not pin to a CPU; results may be noisier\n";
+        }
+
+        std::vector<JsonObject> results;
+        std::cout << std::left << std::setw(24) << "benchmark" << std::right << std::setw(14) << "median ns"
+                  << std::setw(14) << "min ns" << std::setw(8) << "cv%" << std::setw(11) << "MB/s"
+                  << (check.active() ? "  vs baseline" : "") << '\n';
+        for (const Bench& b : suite) {
+            if (!filter.empty() && b.name.find(filter) == std::string::npos) continue;
+            const Stats st = measure(b, samples, minTimeMs * 1e6);
+            std::cout << std::left << std::setw(24) << st.name << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(14) << st.medianNs << std::setw(14) << st.minNs << std::setprecision(1)
+                      << std::setw(8) << st.cvPercent() << std::setw(11);
+            if (st.bytesPerOp > 0) std::cout << st.mbPerSec();
+            else std::cout << "-";
+            check.compare(std::cout, {st.name}, st.medianNs);
+            std::cout << std::defaultfloat << std::setprecision(6) << std::endl;
+            results.push_back(toJson(st));
+        }
+        std::remove(snapshotPath().c_str());
+        if (report.jsonPath) {
+            std::ofstream jfs(*report.jsonPath);
+            if (!jfs) throw std::runtime_error("Failed to open JSON output: " + *report.jsonPath);
+            writeResultsJson(jfs, JsonObject(), results);
+        }
+        return check.finish(std::cout, "benchmark(s)");
+    } catch (const std::exception& ex) {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "vm/ObjectFile.hpp"
+#include "vm/Types.hpp"
+
+namespace vm {
+
+class ExecutionProfile;
+class SymbolMap;
+struct LayoutReport;
+
+// Assembly failure; `line()` is the 1-based source line (0 if not tied to one).
+class AssemblyError : public std::runtime_error {
+public:
+    AssemblyError(std::size_t line, const std::string& what)
+        : std::runtime_error(line ? "line " + std::to_string(line) + ": " + what : what), m_line(line) {}
+    std::size_t line() const { return m_line; }
+
+private:
+    std::size_t m_line;
+};
+
+// Output of assemble(): the encoded program, based at address 0, and its labels.
+struct AssembledProgram {
+    std::vector<unsigned char> code;
+    std::unordered_map<std::string, u32> labels;
+
+    // Address of a label, or the value of a numeric literal (e.g. an --entry).
+    u32 address(const std::string& labelOrNumber) const;
+    // `code` behind a v2 program header (entry point and Adler-32 checksum),
+    // ready for VMInstance::loadProgramBytes() or a .bin file.
+    std::vector<unsigned char> image(u32 entry = 0) const;
+    // The labels as a profiler symbol map, and in its text format
+    // ("<hex address> <label>" per line, by address).
+    SymbolMap symbolMap() const;
+    void writeSymbols(std::ostream& out) const;
+};
+
+// Assembler for the syntax in docs/ISA.md: one instruction per line,
+// optional `label:` prefix, `;`, `#` or `//` comments, and label or numeric
+// (decimal / 0x hex, optionally negative) operands. Mnemonics and registers
+// are case-insensitive. The source is encoded in one streaming pass; forward
+// label references are patched at the end. Throws AssemblyError.
+AssembledProgram assemble(std::string_view source);
+AssembledProgram assemble(std::istream& in);
+
+// Relocatable assembly of one module for link(). Labels named by a
+// `.global` directive are exported; other labels stay local to the module,
+// and labels it does not define are left to the linker to resolve.
+ObjectFile assembleObject(std::string_view source, const std::string& name = {});
+
+// assemble() with profile-guided code layout (layoutObject()): `profile`
+// holds per-PC counts from running the program as assemble() lays it out,
+// e.g. `vm_app --profile` folded stacks. Label values follow the code.
+AssembledProgram assembleWithProfile(std::string_view source, const ExecutionProfile& profile,
+                                     LayoutReport* report = nullptr);
+
+} // namespace vm
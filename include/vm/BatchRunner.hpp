@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "vm/Types.hpp"
+#include "vm/Config.hpp"
+
+namespace vm {
+
+// One guest run in a batch. Console input is fed from `input` (whitespace or
+// comma separated integers); console output is captured per job.
+struct BatchJob {
+    std::string program;
+    std::size_t memSize{64 * 1024};
+    MemoryBackend memBackend{MemoryBackend::Dense};
+    std::size_t steps{0}; // 0 => until HALT
+    std::string input;
+    CpuEngine engine{CpuEngine::Interpreter};
+};
+
+// `ok` is set only for a run that retired HALT. Otherwise `error` describes
+// the failure: an exception's message, "fault", "step limit reached", or a
+// breakpoint/watchpoint stop. `outcome` names how the run ended ("halted",
+// "fault", "step_limit", "breakpoint", "watchpoint"; "error" when it threw).
+struct BatchResult {
+    bool ok{false};
+    std::string error;
+    std::string outcome;
+    std::string output;
+    u32 pc{0};
+    std::vector<u32> regs;
+    double elapsedMs{0.0};
+};
+
+struct BatchSummary {
+    std::vector<BatchResult> results; // same order as the jobs
+    std::size_t threads{0};
+    double wallMs{0.0};
+};
+
+// Manifest: one job per line, `#` starts a comment. The first token is the
+// program path (a binary image or an .asm source), followed by optional
+// key=value tokens:
+//   mem=<n>[k|m|g]  backend=dense|sparse  steps=<n>  input=<v1,v2,...>
+//   engine=interp|threaded|jit
+// `defaults` supplies values for keys a line omits.
+std::vector<BatchJob> parseBatchManifest(std::istream& in, const BatchJob& defaults = {});
+
+// Runs every job as an isolated VMInstance on a work-stealing pool of
+// `threads` workers (0 => hardware concurrency). Program files are read (and
+// `.asm` sources assembled in process) once per distinct path. Failures are
+// reported per job; this never throws for a job error.
+BatchSummary runBatch(const std::vector<BatchJob>& jobs, std::size_t threads = 0);
+
+// Per-job results plus aggregate throughput as a JSON document.
+void writeBatchJson(std::ostream& out, const std::vector<BatchJob>& jobs, const BatchSummary& summary);
+
+} // namespace vm
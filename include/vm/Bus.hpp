@@ -1,13 +1,17 @@
 #pragma once
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <unordered_map>
 
 #include "vm/Types.hpp"
 #include "vm/Memory.hpp"
 #include "vm/Device.hpp"
+#include "vm/PerfCounters.hpp"
 
 namespace vm {
 
@@ -17,10 +21,35 @@ struct DeviceMapping {
     std::shared_ptr<IDevice> device; // shared so multiple components can hold refs
 };
 
+enum class WatchKind : u8 {
+    Read,   // any load overlapping the range
+    Write,  // any store overlapping the range
+    Change  // a store that changes the stored bytes
+};
+
+struct Watchpoint {
+    std::size_t base{0};
+    std::size_t size{0};
+    WatchKind kind{WatchKind::Write};
+};
+
+// One triggered watch. `pc` is filled in by the CPU that made the access.
+struct WatchHit {
+    WatchKind kind{WatchKind::Write};
+    u32 pc{0};
+    std::size_t addr{0}; // first byte of the access
+    std::size_t size{0};
+    u32 oldValue{0};     // contents before the access
+    u32 newValue{0};     // value stored (Write/Change)
+};
+
 // BusMemory composes a backing RAM and a set of memory-mapped devices.
 class BusMemory : public IMemory {
 public:
-    explicit BusMemory(RamMemory& ram) : m_ram(ram) {}
+    static constexpr std::size_t PAGE_BITS = RamMemory::PAGE_BITS;
+    static constexpr std::size_t PAGE_SIZE = RamMemory::PAGE_SIZE;
+
+    explicit BusMemory(RamMemory& ram);
 
     // IMemory
     std::size_t size() const override { return m_ram.size(); }
@@ -34,14 +63,85 @@ public:
     // Bus API
     void mapDevice(std::size_t base, std::shared_ptr<IDevice> dev);
     const std::vector<DeviceMapping>& mappings() const { return m_maps; }
+    // Reads and writes that reached mappings()[idx] (VM_PERF_COUNTERS builds only).
+    u64 deviceAccesses(std::size_t idx) const { return idx < m_deviceAccesses.size() ? m_deviceAccesses[idx] : 0; }
+    void clearDeviceAccesses() { std::fill(m_deviceAccesses.begin(), m_deviceAccesses.end(), u64{0}); }
+
+    // Watchpoints. Pages holding a watched byte leave the plain-RAM fast path,
+    // so accesses elsewhere cost nothing; accesses to a watched page check the
+    // watch list and report a hit to the handler, then complete as usual.
+    void addWatch(std::size_t base, std::size_t size, WatchKind kind);
+    void removeWatch(std::size_t base, std::size_t size, WatchKind kind);
+    const std::vector<Watchpoint>& watches() const { return m_watches; }
+    void setWatchHandler(std::function<void(const WatchHit&)> handler) { m_watchHandler = std::move(handler); }
+
+    // Host pointers for an access that stays within one plain-RAM page; nullptr
+    // if it touches a device, crosses a page, is out of range or (for writes)
+    // the page first needs a RAM page fault such as a copy-on-write copy.
+    const u8* readPtr(std::size_t addr, std::size_t len) const {
+        return isPlainRam(addr, len) ? m_ram.readPage(addr >> PAGE_BITS) + (addr & (PAGE_SIZE - 1)) : nullptr;
+    }
+    u8* writePtr(std::size_t addr, std::size_t len) const {
+        if (!isPlainRam(addr, len)) return nullptr;
+        u8* page = m_ram.writePage(addr >> PAGE_BITS);
+        return page ? page + (addr & (PAGE_SIZE - 1)) : nullptr;
+    }
+
+    // Non-virtual accessors for engines specialised on BusMemory. Accesses that
+    // lie entirely in plain RAM become a direct host load/store; device windows
+    // and out-of-range addresses take the regular path.
+    u32 fastRead32(std::size_t addr) const {
+        if (const u8* p = readPtr(addr, 4)) return loadLE32(p);
+        return BusMemory::read32(addr);
+    }
+    void fastWrite32(std::size_t addr, u32 v) {
+        if (u8* p = writePtr(addr, 4)) storeLE32(p, v);
+        else BusMemory::write32(addr, v);
+    }
 
 private:
+    struct PageEntry {
+        u16 devLo{PAGE_SIZE}, devHi{PAGE_SIZE}; // hull of device bytes inside the page
+        bool ram{false};                        // page lies entirely inside RAM and is not watched
+        bool inRam{false};                      // page lies entirely inside RAM
+        u16 watches{0};                         // watchpoints overlapping the page
+    };
+
+    bool isPlainRam(std::size_t addr, std::size_t len) const {
+        const std::size_t page = addr >> PAGE_BITS;
+        const std::size_t off = addr & (PAGE_SIZE - 1);
+        if (page >= m_pages.size() || off + len > PAGE_SIZE) return false;
+        const PageEntry& e = m_pages[page];
+        return e.ram && (off + len <= e.devLo || off >= e.devHi);
+    }
+
     const DeviceMapping* find(std::size_t addr) const;
     DeviceMapping* find(std::size_t addr);
+    void countAccess(const DeviceMapping* m) const {
+#if VM_PERF_COUNTERS
+        ++m_deviceAccesses[static_cast<std::size_t>(m - m_maps.data())];
+#else
+        (void)m;
+#endif
+    }
+    void updateWatchPages(const Watchpoint& w, int delta);
+    bool watched(std::size_t addr, std::size_t len) const;
+    void checkRead(std::size_t addr, std::size_t len) const;
+    void checkWrite(std::size_t addr, std::size_t len, u32 value) const;
+    u32 peek(std::size_t addr, std::size_t len) const;
 
 private:
     RamMemory& m_ram;
     std::vector<DeviceMapping> m_maps;
+    mutable std::vector<u64> m_deviceAccesses; // parallel to m_maps
+    // Page-granular dispatch, updated by mapDevice(). RAM accesses outside a
+    // page's device hull go to the RAM page directly; everything else looks up
+    // the mappings overlapping that page (usually one), kept only for pages
+    // that have any so large address spaces pay a few bytes per page.
+    std::vector<PageEntry> m_pages;
+    std::unordered_map<std::size_t, std::vector<u32>> m_pageMaps;
+    std::vector<Watchpoint> m_watches;
+    std::function<void(const WatchHit&)> m_watchHandler;
 };
 
 } // namespace vm
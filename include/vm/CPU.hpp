@@ -1,21 +1,50 @@
 #pragma once
 
 #include <array>
+#include <bitset>
 #include <cstddef>
 #include <cstdint>
+#include <iosfwd>
+#include <limits>
+#include <memory>
+#include <vector>
 
 #include "vm/Types.hpp"
+#include "vm/Bus.hpp"
+#include "vm/Decoder.hpp"
+#include "vm/DecodeCache.hpp"
+#include "vm/PerfCounters.hpp"
 
 namespace vm {
 
 struct ILogger;
 struct IMemory;
+class TraceBuffer;
+class ConsoleSink;
+class ExecutionProfile;
+
+// Why run() returned.
+enum class RunOutcome : u8 {
+    Halted,     // HALT retired (or the CPU was already halted)
+    Breakpoint, // PC reached a breakpoint; the instruction there has not run
+    StepLimit,  // maxSteps instructions retired
+    Watchpoint, // the last instruction retired made a watched access (see SimpleCPU::watchHit())
+    Fault       // an instruction failed (bad register, stack error, IN error); the CPU is halted
+};
 
 struct ICPU {
     virtual ~ICPU() = default;
     virtual void reset() = 0;
-    virtual void run(std::size_t maxSteps = 0) = 0; // 0 => until HALT
-    virtual void step() = 0;
+    // Runs until HALT, a fault, a breakpoint or `maxSteps` retired instructions
+    // (0 => no limit). A breakpoint at the starting PC is stepped over, so a
+    // run resumes from the breakpoint it last stopped at.
+    virtual RunOutcome run(std::size_t maxSteps = 0) = 0;
+    virtual void step() = 0; // one instruction; ignores breakpoints
+    virtual bool halted() const = 0;
+
+    // Breakpoints are checked by the engine's own run loop against a bitmap
+    // over guest addresses. reset() keeps them.
+    virtual void setBreakpoint(u32 addr, bool enabled) = 0;
 
     // Introspection
     virtual std::size_t regCount() const = 0;
@@ -28,6 +57,12 @@ struct ICPU {
     virtual void setPC(u32 value) = 0;
     virtual void setSP(u32 value) = 0;
     virtual void setFlags(u32 value) = 0;
+    // Must be called after guest memory is modified behind the CPU's back
+    // (debugger writes, program/snapshot loads) so cached decodes are dropped.
+    virtual void invalidateCode(std::size_t addr, std::size_t len) = 0;
+
+    // Workload counters since reset(); all zero unless built with VM_PERF_COUNTERS.
+    virtual PerfCounters perfCounters() const { return {}; }
 };
 
 class SimpleCPU : public ICPU {
@@ -35,10 +70,21 @@ public:
     static constexpr std::size_t REG_COUNT = 8;
 
     SimpleCPU(IMemory& mem, ILogger* logger = nullptr);
+    ~SimpleCPU() override;
 
     void reset() override;
-    void run(std::size_t maxSteps = 0) override;
+    RunOutcome run(std::size_t maxSteps = 0) override;
     void step() override;
+    bool halted() const override { return m_halted; }
+    void setBreakpoint(u32 addr, bool enabled) override;
+    bool isBreakpoint(u32 addr) const {
+        const std::size_t page = addr >> BREAK_PAGE_BITS;
+        return page < m_breakMap.size() && m_breakMap[page] && m_breakMap[page]->test(addr & (BREAK_PAGE_SIZE - 1));
+    }
+
+    // The access that ended the last run with RunOutcome::Watchpoint; its pc is
+    // the instruction that made it. Watchpoints are set on the BusMemory.
+    const WatchHit& watchHit() const { return m_watchHit; }
 
     std::size_t regCount() const override { return REG_COUNT; }
     u32 getReg(std::size_t idx) const override { return idx < REG_COUNT ? m_regs[idx] : 0; }
@@ -47,22 +93,144 @@ public:
     u32 getPC() const override { return m_pc; }
     u32 getSP() const override { return m_sp; }
     u32 getFlags() const override { return m_flags; }
-    void setPC(u32 value) override { m_pc = value; }
+    // Moving the PC resumes a halted CPU, e.g. a debugger re-running code after HALT.
+    void setPC(u32 value) override {
+        m_pc = value;
+        m_halted = false;
+        m_faulted = false;
+    }
     void setSP(u32 value) override { m_sp = value; }
     void setFlags(u32 value) override { m_flags = value; }
+    void invalidateCode(std::size_t addr, std::size_t len) override;
+    PerfCounters perfCounters() const override;
+
+    // Takes over registers, PC, SP, flags, the halted state, breakpoints and
+    // the decoded instructions of `other`. Only valid when this CPU's memory holds the same
+    // bytes as other's (an instance fork); fusion counters start from zero.
+    void copyStateFrom(const SimpleCPU& other);
+
+    // How often each fused pair ran as a single handler since the last reset().
+    // Fusion only happens in run() without a logger; step() is always one instruction.
+    u64 fusionCount(Fusion kind) const { return m_fusionHits[static_cast<std::size_t>(kind)]; }
+
+    // Binary execution trace: every retired instruction is recorded into the
+    // ring (null disables tracing). Tracing replaces the per-instruction info
+    // log lines; warnings and errors still go to the logger. Engines fall back
+    // to the interpreter while a trace is attached.
+    void setTrace(TraceBuffer* trace) { m_trace = trace; }
+    TraceBuffer* trace() const { return m_trace; }
+
+    // Per-PC retired-instruction counts (null disables profiling). Unlike
+    // tracing, every engine keeps its fast path while profiling; call
+    // syncProfile() before reading counts the engine may still hold.
+    virtual void setProfile(ExecutionProfile* profile) { m_profile = profile; }
+    ExecutionProfile* profile() const { return m_profile; }
+    virtual void syncProfile() {}
+
+    // Console streams for OUT and IN; without them std::cout / std::cin are used.
+    void setConsole(ConsoleSink* console, std::istream* input = nullptr) {
+        m_console = console;
+        m_input = input;
+    }
+
+protected:
+    static constexpr std::size_t BREAK_PAGE_BITS = 12;
+    static constexpr std::size_t BREAK_PAGE_SIZE = std::size_t{1} << BREAK_PAGE_BITS;
 
-private:
     void log(const char* level, const char* msg);
+    // Logs `msg` as an error and halts; run() then reports RunOutcome::Fault.
+    void fault(const char* msg) {
+        log("error", msg);
+        m_halted = true;
+        m_faulted = true;
+    }
+    bool hasBreakpoints() const { return m_breakCount != 0; }
+    bool hasWatches() const {
+        return m_memKind == MemKind::Bus && !static_cast<const BusMemory&>(m_mem).watches().empty();
+    }
+    RunOutcome outcome(bool atBreakpoint) const {
+        if (m_halted) return m_faulted ? RunOutcome::Fault : RunOutcome::Halted;
+        if (m_watchPending) return RunOutcome::Watchpoint;
+        return atBreakpoint ? RunOutcome::Breakpoint : RunOutcome::StepLimit;
+    }
+    // Counting hooks for PerfCounters; they compile to nothing without VM_PERF_COUNTERS.
+    void perfRetired(Opcode op) {
+#if VM_PERF_COUNTERS
+        m_perf.retired[static_cast<u8>(op)] += !m_faulted;
+#else
+        (void)op;
+#endif
+    }
+    void perfBranch(bool taken) {
+#if VM_PERF_COUNTERS
+        ++(taken ? m_perf.branchesTaken : m_perf.branchesNotTaken);
+#else
+        (void)taken;
+#endif
+    }
+    void perfStack() {
+#if VM_PERF_COUNTERS
+        if (m_sp < m_perf.stackLow) m_perf.stackLow = m_sp;
+#endif
+    }
+
+    // Decodes without reporting the instruction fetch to watchpoints.
+    DecodedInst decode(u32 pc);
+    void onWatch(const WatchHit& hit);
+    const CachedInst& fetch();
+    void traceRetired(u32 pc, const DecodedInst& di);
+
+    // The interpreter core is instantiated per concrete memory type so loads,
+    // stores and stack traffic to RAM inline instead of going through IMemory.
+    template <class Mem> RunOutcome runWith(Mem mem, std::size_t maxSteps);
+    template <class Mem> void execute(Mem mem, const DecodedInst& di);
+    // Runs a fused pair; returns the number of instructions retired (0 => not
+    // applicable right now, execute the first instruction normally).
+    template <class Mem> std::size_t executeFused(Mem mem, const CachedInst& ci);
+
+    // Console I/O shared by every execution engine (OUT / IN opcodes).
+    void out(u32 value);
+    bool in(u32& value);
+
+    // Engines record the bytes they have decoded so that guest stores only pay
+    // for invalidation when they land on code.
+    void markCode(u32 pc, std::size_t size) {
+        if (pc < m_codeLo) m_codeLo = pc;
+        if (pc + size > m_codeHi) m_codeHi = pc + size;
+    }
+    void noteWrite(u32 addr, std::size_t len) {
+        if (addr < m_codeHi && addr + len > m_codeLo) invalidateCode(addr, len);
+    }
+
+protected:
+    enum class MemKind : u8 { Generic, Bus, Ram };
 
-private:
     IMemory& m_mem;
+    MemKind m_memKind;
     ILogger* m_logger;
+    TraceBuffer* m_trace{nullptr};
+    ExecutionProfile* m_profile{nullptr};
+    ConsoleSink* m_console{nullptr};
+    std::istream* m_input{nullptr};
+    SimpleDecoder m_decoder;
+    DecodeCache m_dcache;
 
     std::array<u32, REG_COUNT> m_regs{};
     u32 m_pc{0};
     u32 m_sp{0};
     u32 m_flags{0};
     bool m_halted{false};
+    bool m_faulted{false};
+    // One bit per guest address, allocated per 4 KiB page on first use.
+    std::vector<std::unique_ptr<std::bitset<BREAK_PAGE_SIZE>>> m_breakMap;
+    std::size_t m_breakCount{0};
+    bool m_decoding{false};
+    bool m_watchPending{false}; // a watch hit since the current run started
+    WatchHit m_watchHit{};
+    std::size_t m_codeLo{std::numeric_limits<std::size_t>::max()};
+    std::size_t m_codeHi{0};
+    std::array<u64, static_cast<std::size_t>(Fusion::Count)> m_fusionHits{};
+    PerfCounters m_perf;
 };
 
 } // namespace vm
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace vm {
+
+// Adler-32 (RFC 1950). `adler` is the running value of the bytes before
+// `data`, so a stream can be checksummed piecewise as it arrives; start from
+// 1. The modulo is deferred to once per 5552-byte block and the inner loop
+// uses SSE2 or, when the CPU has it, AVX2.
+std::uint32_t adler32(const unsigned char* data, std::size_t len, std::uint32_t adler = 1);
+
+// Adler-32 of A followed by B, given adler32(A), adler32(B) and B's length.
+std::uint32_t adler32Combine(std::uint32_t adlerA, std::uint32_t adlerB, std::size_t lenB);
+
+// Same result as adler32(data, len), with large inputs split into chunks
+// checksummed on up to `threads` threads (0 => hardware concurrency) and
+// combined. Small inputs run on the calling thread.
+std::uint32_t adler32Parallel(const unsigned char* data, std::size_t len, std::size_t threads = 0);
+
+// Fast non-cryptographic 64-bit content hash (8 bytes per multiply-mix
+// step), for keys such as ObjectCache entries. Not stable across changes to
+// this function; do not persist it beyond caches that can be rebuilt.
+std::uint64_t contentHash64(const unsigned char* data, std::size_t len, std::uint64_t seed = 0);
+
+} // namespace vm
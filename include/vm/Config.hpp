@@ -1,19 +1,38 @@
 #pragma once
 
 #include <cstddef>
+#include <iosfwd>
 #include <optional>
 #include <string>
 
+#include "vm/Memory.hpp"
+
 namespace vm {
 
+// Execution engine used by a VMInstance. All engines implement the same ISA
+// semantics; they differ only in how instructions are dispatched.
+enum class CpuEngine {
+    Interpreter, // SimpleCPU: decode-cache + switch dispatch
+    Threaded,    // ThreadedCPU: pre-translated handler array
+    Jit          // JitCPU: native x86-64 basic blocks (interpreter elsewhere)
+};
+
 struct VMConfig {
     std::string name{"vm0"};
     std::size_t memSize{64 * 1024};
+    MemoryBackend memBackend{MemoryBackend::Dense}; // Sparse suits large, mostly untouched address spaces
     std::optional<std::string> programPath{};
     std::optional<std::string> diskPath{};
     bool interactive{false};
     bool dumpAfter{false};
     std::size_t steps{0};
+    CpuEngine engine{CpuEngine::Interpreter};
+    std::size_t traceRecords{0}; // binary trace ring capacity; 0 disables tracing
+    bool profile{false};         // count retired instructions per PC
+    // Guest console streams (OUT / ConsoleOutDevice and IN); null => std::cout / std::cin.
+    // Not owned; must outlive the instance.
+    std::ostream* consoleOut{nullptr};
+    std::istream* consoleIn{nullptr};
 };
 
 } // namespace vm
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <string>
 
+#include "vm/ConsoleSink.hpp"
 #include "vm/Device.hpp"
 #include "vm/Logger.hpp"
 
@@ -15,7 +16,8 @@ namespace vm {
 // Size: 4 bytes (writes of 8/16/32 bits accepted at offset 0)
 class ConsoleOutDevice : public IDevice {
 public:
-    explicit ConsoleOutDevice(ILogger* logger = nullptr) : m_logger(logger) {}
+    explicit ConsoleOutDevice(ILogger* logger = nullptr, ConsoleSink* console = nullptr)
+        : m_logger(logger), m_console(console) {}
 
     const char* name() const override { return "ConsoleOut"; }
     std::size_t size() const override { return 4; }
@@ -26,25 +28,31 @@ public:
 
     void write8(std::size_t offset, u8 v) override {
         if (offset == 0) {
-            std::cout << static_cast<unsigned>(v) << std::endl;
+            print(v);
             if (m_logger) m_logger->info("ConsoleOutDevice: write8");
         }
     }
     void write16(std::size_t offset, u16 v) override {
         if (offset == 0) {
-            std::cout << v << std::endl;
+            print(v);
             if (m_logger) m_logger->info("ConsoleOutDevice: write16");
         }
     }
     void write32(std::size_t offset, u32 v) override {
         if (offset == 0) {
-            std::cout << v << std::endl;
+            print(v);
             if (m_logger) m_logger->info("ConsoleOutDevice: write32");
         }
     }
 
 private:
+    void print(u32 v) {
+        if (m_console) m_console->writeValue(v);
+        else std::cout << v << std::endl;
+    }
+
     ILogger* m_logger{nullptr};
+    ConsoleSink* m_console{nullptr};
 };
 
 } // namespace vm
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <iosfwd>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "vm/Types.hpp"
+
+namespace vm {
+
+// Per-instance console output pipeline shared by the OUT opcode and
+// ConsoleOutDevice. Values are formatted with std::to_chars into a buffer.
+//
+// Async mode hands full buffers to a background writer thread over a bounded
+// single-producer/single-consumer queue. The thread is started on the first
+// hand-off, so short runs never spawn it. Output reaches the stream in program
+// order; sync() (called on HALT, on errors, before IN and on request) blocks
+// until everything written so far has been flushed.
+//
+// Sync mode writes and flushes every value immediately, which keeps console
+// output interleaved with logger lines exactly as before.
+class ConsoleSink {
+public:
+    enum class Mode { Sync, Async };
+
+    static constexpr std::size_t BUFFER_SIZE = 64 * 1024;
+    static constexpr std::size_t QUEUE_DEPTH = 8;
+
+    explicit ConsoleSink(std::ostream& out, Mode mode = Mode::Async);
+    ~ConsoleSink();
+
+    ConsoleSink(const ConsoleSink&) = delete;
+    ConsoleSink& operator=(const ConsoleSink&) = delete;
+
+    // Writes the decimal value followed by a newline.
+    void writeValue(u32 value);
+    void sync();
+
+    Mode mode() const { return m_mode; }
+
+private:
+    void submit();
+    void writerLoop();
+
+    std::ostream& m_out;
+    Mode m_mode;
+    std::vector<char> m_cur;
+
+    // Slots are only touched by the producer while (head - tail) < QUEUE_DEPTH
+    // and by the writer while tail < head; buffers are swapped, never copied.
+    std::array<std::vector<char>, QUEUE_DEPTH> m_slots;
+    std::atomic<std::size_t> m_head{0};
+    std::atomic<std::size_t> m_tail{0};
+    std::mutex m_mutex; // only for sleeping/waking, never held while writing
+    std::condition_variable m_cv;
+    bool m_stop{false};
+    std::thread m_writer;
+};
+
+} // namespace vm
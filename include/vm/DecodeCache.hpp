@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+#include "vm/Types.hpp"
+#include "vm/Decoder.hpp"
+
+namespace vm {
+
+// Adjacent instruction pairs the interpreter executes as a single handler.
+enum class Fusion : u8 {
+    None = 0,
+    CmpJz,    // CMP rA, rB ; JZ target
+    CmpJnz,   // CMP rA, rB ; JNZ target
+    LoadiAlu, // LOADI rX, imm ; ADD/SUB/AND/OR/XOR rD, rA, rB
+    PushPush, // PUSH rA ; PUSH rB
+    PopPop,   // POP rA ; POP rB
+    Count
+};
+
+// A cache entry: the instruction at a PC plus, when fused, the one after it.
+struct CachedInst {
+    DecodedInst inst;
+    Fusion fusion{Fusion::None};
+    DecodedInst next;
+
+    // Bytes covered by this entry (both instructions when fused).
+    u32 span() const { return inst.size + (fusion != Fusion::None ? next.size : 0u); }
+};
+
+// Direct-mapped cache of decoded instructions keyed by PC.
+// The cache remembers the address range it has decoded from so that writes
+// outside of code (stack, data, MMIO) can be rejected with a single compare.
+class DecodeCache {
+public:
+    static constexpr std::size_t ENTRIES = 4096; // must be a power of two
+    static constexpr u32 MAX_SPAN = 10;          // longest entry (fused LOADI + ALU)
+
+    DecodeCache() : m_entries(ENTRIES) {}
+
+    const CachedInst* lookup(u32 pc) const {
+        const Entry& e = m_entries[pc & (ENTRIES - 1)];
+        return e.tag == pc ? &e.inst : nullptr;
+    }
+
+    const CachedInst& insert(u32 pc, const CachedInst& inst) {
+        Entry& e = m_entries[pc & (ENTRIES - 1)];
+        e.tag = pc;
+        e.inst = inst;
+        if (pc < m_lo) m_lo = pc;
+        if (static_cast<std::size_t>(pc) + inst.span() > m_hi) m_hi = static_cast<std::size_t>(pc) + inst.span();
+        return e.inst;
+    }
+
+    // True if [addr, addr+len) may overlap bytes of a cached instruction.
+    bool overlaps(std::size_t addr, std::size_t len) const {
+        return addr < m_hi && addr + len > m_lo;
+    }
+
+    // Drop every cached instruction whose encoding overlaps [addr, addr+len).
+    void invalidate(std::size_t addr, std::size_t len) {
+        if (!overlaps(addr, len)) return;
+        if (len >= ENTRIES) { clear(); return; }
+        const std::size_t first = addr >= MAX_SPAN - 1 ? addr - (MAX_SPAN - 1) : 0;
+        for (std::size_t p = first; p < addr + len; ++p) {
+            Entry& e = m_entries[p & (ENTRIES - 1)];
+            if (e.tag == p && p + e.inst.span() > addr) e.tag = INVALID;
+        }
+    }
+
+    void clear() {
+        for (auto& e : m_entries) e.tag = INVALID;
+        m_lo = std::numeric_limits<std::size_t>::max();
+        m_hi = 0;
+    }
+
+private:
+    // Outside the u32 PC range, so an empty entry never matches a PC
+    // (0xFFFFFFFF included).
+    static constexpr u64 INVALID = ~u64{0};
+
+    struct Entry {
+        u64 tag{INVALID};
+        CachedInst inst;
+    };
+
+    std::vector<Entry> m_entries;
+    std::size_t m_lo{std::numeric_limits<std::size_t>::max()};
+    std::size_t m_hi{0};
+};
+
+} // namespace vm
@@ -2,6 +2,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <iosfwd>
 #include <memory>
 #include <optional>
 #include <set>
@@ -9,14 +10,25 @@
 #include <vector>
 
 #include "vm/Types.hpp"
+#include "vm/Assembler.hpp"
 #include "vm/Logger.hpp"
 #include "vm/Memory.hpp"
 #include "vm/Bus.hpp"
 #include "vm/CPU.hpp"
 #include "vm/Config.hpp"
+#include "vm/ConsoleSink.hpp"
+#include "vm/Profiler.hpp"
+#include "vm/Trace.hpp"
 
 namespace vm {
 
+// How saveSnapshot() stores the base image.
+enum class SnapshotEncoding {
+    Raw,     // non-zero pages, uncompressed
+    Rle,     // non-zero pages, RLE-compressed (also used for appended deltas)
+    Mappable // every page raw in one page-aligned section; restores map it as RAM
+};
+
 class VMInstance {
 public:
     VMInstance(const VMConfig& cfg, ILogger* logger = nullptr);
@@ -24,40 +36,100 @@ public:
     void powerOn();
     void attachRamDisk(const std::string& path); // placeholder (no-op for now)
 
-    // Program loading
+    // Program loading. The image (optionally headed by a VMB1 header) is
+    // parsed in place and its payload copied into zeroed RAM exactly once.
     void loadProgramBytes(const std::vector<unsigned char>& bytes);
+    void loadProgramImage(const unsigned char* data, std::size_t size);
+    // Maps the file instead of reading it; `verify` checks a v2 header's
+    // payload size and checksum first.
+    void loadProgramFile(const std::string& path, bool verify = false);
+    // Assembles `source` in process and loads the code the same way; execution
+    // starts at `entry` (a label or address, default 0). The returned program
+    // holds the labels, e.g. for breakpoints or AssembledProgram::symbolMap().
+    AssembledProgram loadAssembly(const std::string& source, const std::string& entry = {});
 
-    // Execution control
-    void runUntilHalt();
-    void runSteps(std::size_t steps);
+    // Execution control. Both stop early at a breakpoint; runSteps(0) is
+    // runUntilHalt().
+    RunOutcome runUntilHalt();
+    RunOutcome runSteps(std::size_t steps);
+
+    // Blocks until all guest console output so far has reached stdout. Runs
+    // already sync when they return (HALT, step budget, breakpoint or error).
+    void syncConsole();
 
     // Debug/inspection
     ICPU* cpu() { return m_cpu.get(); }
     const ICPU* cpu() const { return m_cpu.get(); }
+    // Mapped devices; PerfCounters::deviceAccesses is indexed the same way.
+    const std::vector<DeviceMapping>& devices() const { return m_bus->mappings(); }
 
     // Breakpoints
     void addBreakpoint(u32 addr);
     void removeBreakpoint(u32 addr);
     std::set<u32> breakpoints() const { return m_breakpoints; }
 
+    // Watchpoints on guest address ranges. A hit ends the run with
+    // RunOutcome::Watchpoint after the accessing instruction retires;
+    // lastWatchHit() then names the access and its PC.
+    void addWatch(u32 addr, std::size_t len, WatchKind kind);
+    void removeWatch(u32 addr, std::size_t len, WatchKind kind);
+    const std::vector<Watchpoint>& watches() const { return m_bus->watches(); }
+    const WatchHit& lastWatchHit() const { return m_cpu->watchHit(); }
+
     // Memory access helpers for CLI
     std::vector<unsigned char> memRead(u32 addr, std::size_t len) const;
     void memWrite(u32 addr, const std::vector<unsigned char>& bytes);
 
-    // Snapshots
-    void saveSnapshot(const std::string& path) const;
+    // Execution trace (null unless VMConfig::traceRecords > 0)
+    TraceBuffer* trace() { return m_trace.get(); }
+    void writeTrace(const std::string& path) const;
+
+    // Per-PC execution profile (null unless VMConfig::profile). Counts are
+    // brought up to date on each call.
+    ExecutionProfile* profile();
+
+    // Snapshots (SNP2: portable little-endian fields, optional per-page RLE).
+    // saveSnapshot() writes a base image; appendSnapshotDelta() appends only
+    // the pages written since the last save/append/load, which must have been
+    // of the same file, unchanged since (throws std::runtime_error otherwise).
+    // loadSnapshot() replays base + deltas and also reads
+    // legacy SNP1 files. A Mappable base is restored by mapping it privately
+    // as guest RAM, so restore time does not grow with memory size.
+    void saveSnapshot(const std::string& path, SnapshotEncoding encoding = SnapshotEncoding::Raw);
+    void appendSnapshotDelta(const std::string& path);
     void loadSnapshot(const std::string& path);
 
+    // Spawns a copy of this instance in its current state. Guest RAM is shared
+    // copy-on-write per page, so the cost is proportional to the page count,
+    // not the memory contents; either instance copies a page on its first
+    // write to it. The child gets the same engine, CPU state, decoded code,
+    // breakpoints and watchpoints, its own console (writing to `consoleOut`/`consoleIn`, null
+    // => std::cout / std::cin) and its own trace ring and profile if enabled.
+    // Other mapped devices are shared with this instance. Must not run
+    // concurrently with this instance; forked children are independent.
+    std::unique_ptr<VMInstance> fork(std::ostream* consoleOut = nullptr, std::istream* consoleIn = nullptr);
+
 private:
-    bool hitBreakpoint(u32 pc) const;
+    VMInstance(const VMInstance& parent, const VMConfig& cfg);
+    void createCpu();
+    void loadSnapshotV2(std::istream& in, const std::string& path);
+    void recordSnapshotFile(const std::string& path);
 
 private:
     VMConfig m_cfg;
     ILogger* m_logger{nullptr};
+    std::unique_ptr<ConsoleSink> m_console; // declared first: outlives the devices and CPU using it
     std::unique_ptr<RamMemory> m_mem;
     std::unique_ptr<BusMemory> m_bus; // memory bus with devices
+    std::shared_ptr<IDevice> m_consoleDevice; // per-instance; replaced in forks
+    std::unique_ptr<ExecutionProfile> m_profile; // outlives the CPU counting into it
     std::unique_ptr<SimpleCPU> m_cpu;
+    std::unique_ptr<TraceBuffer> m_trace;
     std::set<u32> m_breakpoints;
+    // File the dirty pages are relative to (last save/append/load) and its
+    // size then; empty until one of those succeeds.
+    std::string m_snapshotPath;
+    std::uintmax_t m_snapshotSize{0};
 };
 
 } // namespace vm
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <bitset>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "vm/CPU.hpp"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__unix__))
+#define VM_JIT_X86_64 1
+#else
+#define VM_JIT_X86_64 0
+#endif
+
+namespace vm {
+
+class BusMemory;
+
+// Basic-block JIT for x86-64 hosts. Blocks that execute often enough are
+// compiled to native code in an mmap'd arena; guest R0-R4 live in callee-saved
+// host registers while native code runs (R5-R7, SP and FLAGS stay in a context
+// block). Straight-line blocks chain to each other directly, so hot loops never
+// return to the dispatcher.
+//
+// Everything the native tier cannot do cheaply falls back to the inherited
+// SimpleCPU::step(): HALT, OUT/IN, invalid registers, stack errors, accesses
+// that are not plain RAM (MMIO, out of range) and stores into pages holding
+// compiled code. Such stores flush the code cache. When a logger is attached, or
+// on hosts without JIT support, run() is SimpleCPU::run(). Blocks never start at
+// or run across a breakpoint, so the dispatcher sees every breakpoint PC.
+class JitCPU : public SimpleCPU {
+public:
+    static constexpr u32 HOT_THRESHOLD = 16;   // block executions before compiling
+    static constexpr u32 MAX_BLOCK_INSTS = 64;
+
+    JitCPU(BusMemory& bus, ILogger* logger = nullptr);
+    ~JitCPU() override;
+
+    JitCPU(const JitCPU&) = delete;
+    JitCPU& operator=(const JitCPU&) = delete;
+
+    void reset() override;
+    RunOutcome run(std::size_t maxSteps = 0) override;
+    void invalidateCode(std::size_t addr, std::size_t len) override;
+    void setBreakpoint(u32 addr, bool enabled) override;
+    void setProfile(ExecutionProfile* profile) override;
+    // Compiled blocks count how often each of their exits is taken; this
+    // credits the instructions retired on the way to each exit.
+    void syncProfile() override;
+    PerfCounters perfCounters() const override;
+
+    // Number of blocks currently compiled (for tests and diagnostics).
+    std::size_t compiledBlocks() const { return m_compiled; }
+
+    // State shared with generated code; offsets are baked into emitted instructions.
+    struct Context {
+        u32 regs[REG_COUNT];
+        u32 pc;
+        u32 sp;
+        u32 flags;
+        u32 exitReason;
+        u64 budget; // instructions native code may still retire
+        JitCPU* self;
+        u32 stackLow; // PerfCounters::stackLow while native code runs
+    };
+
+private:
+    enum ExitReason : u32 { EXIT_NORMAL = 0, EXIT_FALLBACK = 1 };
+
+    struct Block {
+        const u8* body{nullptr};
+        u32 count{0};
+        u32 heat{0};
+        bool failed{false};
+    };
+
+    // Instructions of a compiled block, for crediting its exit counters.
+    struct BlockInsts {
+        std::vector<u32> pcs;
+        std::vector<Opcode> ops;
+    };
+    // Bumped by native code each time it leaves a block through this exit
+    // (only emitted while profiling or with VM_PERF_COUNTERS).
+    struct ExitCounter {
+        u64 hits{0};
+        u64 profiled{0};  // hits already credited to m_profile
+        const BlockInsts* block{nullptr};
+        u32 retired{0};   // leading instructions of the block retired on this exit
+        int branch{-1};   // 1 / 0: taken / not-taken side of the closing JZ/JNZ; -1 otherwise
+    };
+
+    struct ChainSite {
+        u8* rel32; // jmp displacement to patch once the target is compiled
+    };
+
+    bool nativeEnabled() const;
+    void compile(u32 pc, Block& block);
+    u64 enterNative(const Block& block, u64 budget);
+    void flushCode();
+    void addExitCounts(PerfCounters& perf, const ExitCounter& exit, u64 hits) const;
+    bool touchesCode(std::size_t addr, std::size_t len) const;
+    void setWritable(bool writable);
+
+    static u64 helperLoad(Context* ctx, u32 addr);
+    static u32 helperStore(Context* ctx, u32 addr, u32 value);
+
+    BusMemory& m_bus;
+    Context m_ctx{};
+    u8* m_arena{nullptr};
+    std::size_t m_arenaSize{0};
+    std::size_t m_arenaUsed{0};
+    const u8* m_enter{nullptr};    // void enter(Context*, const void* body)
+    const u8* m_epilogue{nullptr};
+    std::unordered_map<u32, Block> m_blocks;
+    std::unordered_map<u32, std::vector<ChainSite>> m_pendingChains;
+    // Per guest page (4 KiB), which bytes belong to compiled blocks; null if none.
+    std::vector<std::unique_ptr<std::bitset<4096>>> m_codeMap;
+    std::size_t m_compiled{0};
+    // Deques: counter addresses are baked into compiled code.
+    std::deque<BlockInsts> m_blockInsts;
+    std::deque<ExitCounter> m_exitCounters;
+};
+
+} // namespace vm
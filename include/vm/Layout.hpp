@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+#include "vm/ObjectFile.hpp"
+#include "vm/Types.hpp"
+
+namespace vm {
+
+class ExecutionProfile;
+
+// What layoutObject() changed. Branch weights are estimated from the
+// profile's per-PC counts.
+struct LayoutReport {
+    std::size_t blocks{0};
+    std::size_t hotBlocks{0};        // blocks the profile saw execute
+    std::size_t branchesInverted{0}; // JZ <-> JNZ so the common path falls through
+    std::size_t jumpsRemoved{0};     // JMPs to the block now placed next
+    std::size_t jumpsAdded{0};       // JMPs that keep a fall-through edge
+    u64 takenBefore{0};              // estimated taken jumps/branches
+    u64 takenAfter{0};
+};
+
+// Profile-guided code layout for one relocatable module. Basic blocks are
+// chained along their hottest edges (heaviest first), so hot paths become
+// straight-line code with the common direction of each branch falling
+// through. Chains are then placed hottest first and never-executed blocks
+// last, in source order. Every label operand is rewritten through the
+// module's relocations.
+//
+// `profile` holds counts per PC of the module as placed at `base` (0 for a
+// single program; the module's address in the original link otherwise).
+// The first block stays first, and a block that falls through past the end
+// of the module stays last. Branch targets must be labels: throws
+// std::runtime_error for a JMP/JZ/JNZ/CALL with a numeric target, or for
+// bytes that are not a valid instruction.
+ObjectFile layoutObject(const ObjectFile& obj, const ExecutionProfile& profile, u32 base = 0,
+                        LayoutReport* report = nullptr);
+
+} // namespace vm
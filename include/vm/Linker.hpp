@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "vm/Assembler.hpp"
+#include "vm/ObjectFile.hpp"
+#include "vm/Types.hpp"
+
+namespace vm {
+
+// Places `objects` back to back from address 0, in the order given, and
+// patches every relocation. Global symbols must be unique across modules.
+// In the result, globals keep their name and a module's local labels
+// appear as "<module>:<label>". Throws std::runtime_error for duplicate
+// module names, duplicate or undefined symbols, and LOAD/STORE offsets that
+// no longer fit in 16 bits.
+AssembledProgram link(const std::vector<ObjectFile>& objects);
+
+// Directory of assembled modules keyed by the content hash of their source,
+// so an unchanged module is read back instead of reassembled. Entries are
+// written to a uniquely named temporary file and renamed into place, so
+// concurrent builds can share a directory. An entry that fails to decode, or
+// whose recorded source hash or length differs, is a miss and is replaced.
+class ObjectCache {
+public:
+    explicit ObjectCache(std::string dir);
+
+    // The object for `source`, assembled only on a cache miss.
+    ObjectFile get(std::string_view source, const std::string& name);
+    std::string pathFor(u64 sourceHash) const;
+
+    std::size_t hits() const { return m_hits; }
+    std::size_t misses() const { return m_misses; }
+
+private:
+    std::string m_dir;
+    std::size_t m_hits{0};
+    std::size_t m_misses{0};
+};
+
+} // namespace vm
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+// Read-only view of a whole file. On POSIX hosts the file is mmapped, so
+// opening an image costs no copy and pages are read on first touch; elsewhere
+// the contents are read into an owned buffer. Empty files have size() == 0.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const unsigned char* data() const { return m_data; }
+    std::size_t size() const { return m_size; }
+
+private:
+    const unsigned char* m_data{nullptr};
+    std::size_t m_size{0};
+    bool m_mapped{false};
+    std::vector<unsigned char> m_fallback;
+};
+
+// Maps [offset, offset + length) of a file privately and writable: writes
+// stay in this process (the kernel copies the touched page) and pages are
+// read from the file on first access. Returns null if the host cannot map
+// files, `offset` is not aligned to the host page size or the file ends
+// before `offset + length`; callers then read the section instead. The mapping is released with the last reference.
+std::shared_ptr<unsigned char> mapFileCopyOnWrite(const std::string& path, std::size_t offset, std::size_t length);
+
+} // namespace vm
@@ -2,6 +2,8 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <vector>
 #include <stdexcept>
 
@@ -9,6 +11,40 @@
 
 namespace vm {
 
+// Guest memory is little-endian. These compile to a single unaligned move on
+// little-endian hosts.
+inline u16 loadLE16(const u8* p) {
+    u16 v;
+    std::memcpy(&v, p, sizeof v);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap16(v);
+#endif
+    return v;
+}
+
+inline u32 loadLE32(const u8* p) {
+    u32 v;
+    std::memcpy(&v, p, sizeof v);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    return v;
+}
+
+inline void storeLE16(u8* p, u16 v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap16(v);
+#endif
+    std::memcpy(p, &v, sizeof v);
+}
+
+inline void storeLE32(u8* p, u32 v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+    std::memcpy(p, &v, sizeof v);
+}
+
 struct IMemory {
     virtual ~IMemory() = default;
     virtual std::size_t size() const = 0;
@@ -20,62 +56,139 @@ struct IMemory {
     virtual void write32(std::size_t addr, u32 v) = 0;
 };
 
+// How RamMemory backs pages nobody has written yet.
+enum class MemoryBackend {
+    Dense,  // one zeroed allocation for all of RAM, committed lazily by the OS
+    Sparse  // untouched pages alias one shared zero page; a page is allocated on first write
+};
+
+// Guest RAM stored as 4 KiB pages behind a two-level page directory: each
+// directory slot covers CHUNK_PAGES pages, and a slot that was never written
+// (Sparse) shares static leaves, so untouched regions cost no per-page
+// metadata. Every page has a host read pointer; the write pointer is null
+// while a write must first be resolved by a page fault (the page is still
+// the zero page, shared copy-on-write with a fork, or clean since the last
+// clearDirty()). Fast paths use the page pointers directly and fall back to
+// the IMemory methods when one is null.
 class RamMemory : public IMemory {
 public:
-    explicit RamMemory(std::size_t size)
-        : m_data(size, 0) {}
+    static constexpr std::size_t PAGE_BITS = 12;
+    static constexpr std::size_t PAGE_SIZE = std::size_t{1} << PAGE_BITS;
+    static constexpr std::size_t PAGE_MASK = PAGE_SIZE - 1;
+    static constexpr std::size_t CHUNK_BITS = 9; // 512 pages = 2 MiB per directory slot
+    static constexpr std::size_t CHUNK_PAGES = std::size_t{1} << CHUNK_BITS;
+    static constexpr std::size_t CHUNK_MASK = CHUNK_PAGES - 1;
 
-    std::size_t size() const override { return m_data.size(); }
+    explicit RamMemory(std::size_t size, MemoryBackend backend = MemoryBackend::Dense);
+    ~RamMemory() override;
+
+    std::size_t size() const override { return m_size; }
 
     u8 read8(std::size_t addr) const override {
         bounds(addr, 1);
-        return m_data[addr];
+        return readPage(addr >> PAGE_BITS)[addr & PAGE_MASK];
     }
 
     u16 read16(std::size_t addr) const override {
         bounds(addr, 2);
-        return static_cast<u16>(m_data[addr]) |
-               static_cast<u16>(m_data[addr + 1] << 8);
+        if ((addr & PAGE_MASK) <= PAGE_SIZE - 2) return loadLE16(readPage(addr >> PAGE_BITS) + (addr & PAGE_MASK));
+        return static_cast<u16>(read8(addr) | (read8(addr + 1) << 8));
     }
 
     u32 read32(std::size_t addr) const override {
         bounds(addr, 4);
-        return static_cast<u32>(m_data[addr]) |
-               (static_cast<u32>(m_data[addr + 1]) << 8) |
-               (static_cast<u32>(m_data[addr + 2]) << 16) |
-               (static_cast<u32>(m_data[addr + 3]) << 24);
+        if ((addr & PAGE_MASK) <= PAGE_SIZE - 4) return loadLE32(readPage(addr >> PAGE_BITS) + (addr & PAGE_MASK));
+        u8 b[4];
+        readBytes(addr, b, 4);
+        return loadLE32(b);
     }
 
     void write8(std::size_t addr, u8 v) override {
         bounds(addr, 1);
-        m_data[addr] = v;
+        writablePage(addr >> PAGE_BITS)[addr & PAGE_MASK] = v;
     }
 
     void write16(std::size_t addr, u16 v) override {
         bounds(addr, 2);
-        m_data[addr] = static_cast<u8>(v & 0xFF);
-        m_data[addr + 1] = static_cast<u8>((v >> 8) & 0xFF);
+        u8 b[2];
+        storeLE16(b, v);
+        writeBytes(addr, b, 2);
     }
 
     void write32(std::size_t addr, u32 v) override {
         bounds(addr, 4);
-        m_data[addr] = static_cast<u8>(v & 0xFF);
-        m_data[addr + 1] = static_cast<u8>((v >> 8) & 0xFF);
-        m_data[addr + 2] = static_cast<u8>((v >> 16) & 0xFF);
-        m_data[addr + 3] = static_cast<u8>((v >> 24) & 0xFF);
+        if ((addr & PAGE_MASK) <= PAGE_SIZE - 4) {
+            storeLE32(writablePage(addr >> PAGE_BITS) + (addr & PAGE_MASK), v);
+            return;
+        }
+        u8 b[4];
+        storeLE32(b, v);
+        writeBytes(addr, b, 4);
     }
 
-    const std::vector<u8>& raw() const { return m_data; }
-    std::vector<u8>& raw() { return m_data; }
+    // Page-level access for fast paths. The last page may extend past size().
+    std::size_t pageCount() const { return m_pageCount; }
+    const u8* readPage(std::size_t page) const { return m_readDir[page >> CHUNK_BITS][page & CHUNK_MASK]; }
+    u8* writePage(std::size_t page) const { return m_writeDir[page >> CHUNK_BITS][page & CHUNK_MASK]; } // null => needs writablePage()
+    u8* writablePage(std::size_t page) {
+        u8* p = writePage(page);
+        return p ? p : faultPage(page);
+    }
+
+    void readBytes(std::size_t addr, u8* dst, std::size_t len) const;
+    void writeBytes(std::size_t addr, const u8* src, std::size_t len);
+    // Sets every byte to zero by dropping all pages: Dense takes a fresh zeroed
+    // block, Sparse points every page back at the zero page.
+    void zero();
+    // Replaces the contents with the pages of `block`, which must hold
+    // pageCount() * PAGE_SIZE writable bytes (e.g. a private file mapping).
+    void adopt(std::shared_ptr<u8> block);
+
+    // Copy-on-write clone. Both memories share every page until either side
+    // writes to it; the writer then gets a private copy of that page. Must not
+    // race with accesses to this memory.
+    std::unique_ptr<RamMemory> fork();
+    // Pages currently shared copy-on-write with a fork (diagnostics).
+    std::size_t sharedPages() const;
+    MemoryBackend backend() const { return m_backend; }
+    // True if the page still reads from the shared zero page (Sparse only).
+    bool isZeroFill(std::size_t page) const { return readPage(page) == zeroPage(); }
+    // Pages with their own storage, i.e. not aliasing the zero page (diagnostics).
+    std::size_t residentPages() const;
+
+    // Dirty tracking for incremental snapshots. A page is dirty if it may
+    // have been written since the last clearDirty() (all pages start dirty).
+    // clearDirty() write-protects every page, so tracking costs one fault per
+    // page and checkpoint; nothing is paid on later writes to a dirty page.
+    bool isDirty(std::size_t page) const;
+    std::size_t dirtyPages() const;
+    void clearDirty();
 
 private:
+    struct Chunk;
+
+    RamMemory(std::size_t size, std::size_t pages, MemoryBackend backend);
+    u8* faultPage(std::size_t page);
+    Chunk& materialize(std::size_t chunk);
+    std::size_t pagesInChunk(std::size_t chunk) const;
+    static const u8* zeroPage();
+
     void bounds(std::size_t addr, std::size_t count) const {
-        if (addr + count > m_data.size()) {
+        if (addr + count > m_size) {
             throw std::out_of_range("memory access out of range");
         }
     }
 
-    std::vector<u8> m_data;
+    std::size_t m_size{0};
+    std::size_t m_pageCount{0};
+    MemoryBackend m_backend{MemoryBackend::Dense};
+    // Per-slot leaves; null until a page in the slot gets storage. The
+    // directories point at a chunk's arrays or at shared all-zero / all-null
+    // leaves for untouched slots.
+    std::vector<std::unique_ptr<Chunk>> m_chunks;
+    std::vector<const u8* const*> m_readDir;
+    std::vector<u8* const*> m_writeDir;
+    bool m_untouchedDirty{true}; // dirty state of pages in untouched slots
 };
 
 } // namespace vm
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "vm/Types.hpp"
+
+namespace vm {
+
+// A label defined by a module, at a module-relative offset. Only global
+// symbols (`.global name`) can be referenced from other modules.
+struct ObjectSymbol {
+    std::string name;
+    u32 offset{0};
+    bool global{false};
+};
+
+// A label operand that the linker must fill in once the module's base
+// address is known: a 4-byte JMP/JZ/JNZ/CALL/LOADI operand or a 2-byte
+// LOAD/STORE offset.
+struct Relocation {
+    u32 offset{0};      // operand position in the module's code
+    u8 width{4};
+    std::string symbol; // external symbol; empty => local target
+    u32 target{0};      // module-relative address of a local target
+};
+
+// Relocatable output of assembleObject(): code based at 0 plus what the
+// linker needs to place it anywhere. `name` identifies the module in link
+// errors and qualifies its local labels; it is not stored in the file.
+struct ObjectFile {
+    std::string name;
+    u64 sourceHash{0}; // contentHash64 of the source, for ObjectCache
+    u64 sourceSize{0}; // source length in bytes, checked with the hash
+    std::vector<unsigned char> code;
+    std::vector<ObjectSymbol> symbols;
+    std::vector<Relocation> relocations;
+};
+
+// VMO1 files: portable little-endian fields. readObjectFile() names the
+// module after the file's stem.
+void writeObjectFile(const std::string& path, const ObjectFile& obj);
+ObjectFile readObjectFile(const std::string& path);
+std::vector<unsigned char> encodeObject(const ObjectFile& obj);
+ObjectFile decodeObject(const unsigned char* data, std::size_t size);
+
+} // namespace vm
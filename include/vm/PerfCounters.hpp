@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "vm/Types.hpp"
+
+// Set by the VM_PERF_COUNTERS CMake option. When 0 the engines compile the
+// counting out entirely and PerfCounters stays zero.
+#ifndef VM_PERF_COUNTERS
+#define VM_PERF_COUNTERS 0
+#endif
+
+namespace vm {
+
+// Workload counters kept by every CPU engine, read through ICPU::perfCounters().
+// All counts are since the last reset().
+struct PerfCounters {
+    static constexpr bool ENABLED = VM_PERF_COUNTERS != 0;
+
+    std::array<u64, 256> retired{}; // retired instructions per opcode byte
+    u64 branchesTaken{0};           // JZ/JNZ that jumped
+    u64 branchesNotTaken{0};        // JZ/JNZ that fell through
+    u32 stackTop{0};                // SP at reset(); depth is measured from here
+    u32 stackLow{0};                // lowest SP seen
+    u64 runNanos{0};                // wall time spent inside run()
+    bool running{false};            // a run() is timing itself (nested engine calls add nothing)
+    // Accesses that reached each device, index-aligned with BusMemory::mappings().
+    std::vector<u64> deviceAccesses;
+
+    u64 totalRetired() const;
+    // Data loads (LOAD, POP, RET) and stores (STORE, PUSH, CALL).
+    u64 loads() const;
+    u64 stores() const;
+    u32 maxStackDepth() const { return stackTop > stackLow ? stackTop - stackLow : 0; }
+    double mips() const { return runNanos ? static_cast<double>(totalRetired()) * 1e3 / static_cast<double>(runNanos) : 0.0; }
+    void clear(u32 sp);
+};
+
+// Times the outermost run() of an engine into PerfCounters::runNanos.
+class PerfRunClock {
+public:
+#if VM_PERF_COUNTERS
+    explicit PerfRunClock(PerfCounters& perf) : m_perf(perf), m_outer(!perf.running) {
+        if (!m_outer) return;
+        perf.running = true;
+        m_start = std::chrono::steady_clock::now();
+    }
+    ~PerfRunClock() {
+        if (!m_outer) return;
+        m_perf.runNanos += static_cast<u64>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+        m_perf.running = false;
+    }
+
+private:
+    PerfCounters& m_perf;
+    bool m_outer;
+    std::chrono::steady_clock::time_point m_start;
+#else
+    explicit PerfRunClock(PerfCounters&) {}
+#endif
+    PerfRunClock(const PerfRunClock&) = delete;
+    PerfRunClock& operator=(const PerfRunClock&) = delete;
+};
+
+} // namespace vm
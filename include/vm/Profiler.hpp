@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vm/Types.hpp"
+
+namespace vm {
+
+// Retired-instruction counts per guest PC. Counters are allocated per 4 KiB
+// of address space on first use, so only pages holding executed code cost
+// memory. The CPU is the only writer; read after run() returns.
+class ExecutionProfile {
+public:
+    static constexpr std::size_t PAGE_BITS = 12;
+    static constexpr std::size_t PAGE_SIZE = std::size_t{1} << PAGE_BITS;
+
+    // Reads folded stacks written by writeFoldedStacks() back into per-PC
+    // counts (the last frame of each stack is the PC).
+    static ExecutionProfile loadFolded(const std::string& path);
+    static ExecutionProfile parseFolded(std::istream& in);
+
+    void hit(u32 pc, u64 n = 1) {
+        const std::size_t page = pc >> PAGE_BITS;
+        if (page < m_pages.size() && m_pages[page]) (*m_pages[page])[pc & (PAGE_SIZE - 1)] += n;
+        else counter(pc) += n;
+    }
+    // Counter for `pc`, allocating its page on first use.
+    u64& counter(u32 pc);
+
+    u64 count(u32 pc) const;
+    u64 total() const;
+    // Non-zero counters in address order.
+    std::vector<std::pair<u32, u64>> entries() const;
+    void clear();
+
+private:
+    std::vector<std::unique_ptr<std::array<u64, PAGE_SIZE>>> m_pages;
+};
+
+// Label addresses from the assembler's symbol map (`asm --symbols`): one
+// "<hex address> <label>" pair per line, `#` starts a comment.
+class SymbolMap {
+public:
+    static SymbolMap load(const std::string& path);
+    static SymbolMap parse(std::istream& in);
+
+    void add(u32 addr, const std::string& name) { m_symbols[addr] = name; }
+    bool empty() const { return m_symbols.empty(); }
+    // Label of the closest symbol at or below `pc`, or "0x<pc>" without one.
+    std::string labelFor(u32 pc) const;
+
+private:
+    std::map<u32, std::string> m_symbols;
+};
+
+struct LabelCount {
+    std::string label;
+    u64 count{0};
+};
+
+// Counts summed per label, highest first.
+std::vector<LabelCount> aggregateByLabel(const ExecutionProfile& profile, const SymbolMap& symbols);
+
+// Folded stacks for flamegraph.pl / speedscope: "<label>;0x<pc> <count>" per
+// executed instruction, so the graph groups by label with per-PC detail.
+void writeFoldedStacks(std::ostream& out, const ExecutionProfile& profile, const SymbolMap& symbols);
+
+// Uncompressed pprof protobuf (`go tool pprof` accepts it as is): one sample
+// of retired instructions per PC, located in a function named by its label.
+void writePprof(std::ostream& out, const ExecutionProfile& profile, const SymbolMap& symbols);
+
+} // namespace vm
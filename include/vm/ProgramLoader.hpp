@@ -7,6 +7,8 @@
 #include <cstdint>
 #include <cstring>
 
+#include "vm/Checksum.hpp"
+
 namespace vm {
 
 // Versioned program headers. Magic is always 'V','M','B','1'.
@@ -25,63 +27,89 @@ struct ProgramHeaderV2 {
 };
 
 inline std::vector<unsigned char> loadBinaryFile(const std::string& path) {
-    std::ifstream ifs(path, std::ios::binary);
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
     if (!ifs) throw std::runtime_error("Failed to open file: " + path);
-    return std::vector<unsigned char>((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    const std::streamoff size = ifs.tellg();
+    if (size < 0) throw std::runtime_error("Failed to read file: " + path);
+    std::vector<unsigned char> bytes(static_cast<std::size_t>(size));
+    ifs.seekg(0);
+    ifs.read(reinterpret_cast<char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return bytes;
 }
 
-inline bool hasProgramHeader(const std::vector<unsigned char>& bytes) {
-    if (bytes.size() < sizeof(ProgramHeaderV1)) return false;
-    return bytes[0]=='V' && bytes[1]=='M' && bytes[2]=='B' && bytes[3]=='1';
+// The header helpers below work on any contiguous image (a vector, an mmapped
+// file) and never copy the payload; the vector overloads forward to them.
+
+inline bool hasProgramHeader(const unsigned char* data, std::size_t size) {
+    if (size < sizeof(ProgramHeaderV1)) return false;
+    return data[0]=='V' && data[1]=='M' && data[2]=='B' && data[3]=='1';
 }
 
-inline std::uint32_t adler32(const unsigned char* data, std::size_t len) {
-    // Simple Adler-32 implementation
-    const std::uint32_t MOD_ADLER = 65521;
-    std::uint32_t a = 1, b = 0;
-    for (std::size_t i = 0; i < len; ++i) {
-        a = (a + data[i]) % MOD_ADLER;
-        b = (b + a) % MOD_ADLER;
-    }
-    return (b << 16) | a;
+inline bool hasProgramHeader(const std::vector<unsigned char>& bytes) {
+    return hasProgramHeader(bytes.data(), bytes.size());
 }
 
-inline bool readAnyHeader(const std::vector<unsigned char>& bytes, ProgramHeaderV1& outV1, ProgramHeaderV2& outV2, bool& isV2) {
-    if (!hasProgramHeader(bytes)) return false;
+inline bool readAnyHeader(const unsigned char* data, std::size_t size, ProgramHeaderV1& outV1, ProgramHeaderV2& outV2, bool& isV2) {
+    if (!hasProgramHeader(data, size)) return false;
     // Peek version (assumes at least V1 size)
-    std::memcpy(&outV1, bytes.data(), sizeof(ProgramHeaderV1));
+    std::memcpy(&outV1, data, sizeof(ProgramHeaderV1));
     if (outV1.version == 1) { isV2 = false; return true; }
-    if (bytes.size() < sizeof(ProgramHeaderV2)) throw std::runtime_error("Truncated v2 program header");
-    std::memcpy(&outV2, bytes.data(), sizeof(ProgramHeaderV2));
+    if (size < sizeof(ProgramHeaderV2)) throw std::runtime_error("Truncated v2 program header");
+    std::memcpy(&outV2, data, sizeof(ProgramHeaderV2));
     if (outV2.version == 2) { isV2 = true; return true; }
     throw std::runtime_error("Unsupported program header version");
 }
 
+inline bool readAnyHeader(const std::vector<unsigned char>& bytes, ProgramHeaderV1& outV1, ProgramHeaderV2& outV2, bool& isV2) {
+    return readAnyHeader(bytes.data(), bytes.size(), outV1, outV2, isV2);
+}
+
+// An image split into entry point and payload. `payload` points into the
+// image passed to parseProgramImage() and is only valid as long as it is.
+struct ProgramImage {
+    std::uint32_t entry{0};
+    const unsigned char* payload{nullptr};
+    std::size_t payloadSize{0};
+};
+
+inline ProgramImage parseProgramImage(const unsigned char* data, std::size_t size) {
+    ProgramImage img{0, data, size};
+    ProgramHeaderV1 v1{}; ProgramHeaderV2 v2{}; bool isV2 = false;
+    if (readAnyHeader(data, size, v1, v2, isV2)) {
+        const std::size_t hdrSize = isV2 ? sizeof(ProgramHeaderV2) : sizeof(ProgramHeaderV1);
+        img.entry = isV2 ? v2.entry : v1.entry;
+        img.payload = data + hdrSize;
+        img.payloadSize = size - hdrSize;
+    }
+    return img;
+}
+
 inline std::vector<unsigned char> stripProgramHeader(const std::vector<unsigned char>& bytes) {
     if (!hasProgramHeader(bytes)) return bytes;
-    // Determine version to know header size
-    ProgramHeaderV1 v1{}; ProgramHeaderV2 v2{}; bool isV2 = false;
-    readAnyHeader(bytes, v1, v2, isV2);
-    const std::size_t hdrSize = isV2 ? sizeof(ProgramHeaderV2) : sizeof(ProgramHeaderV1);
-    return std::vector<unsigned char>(bytes.begin() + hdrSize, bytes.end());
+    const ProgramImage img = parseProgramImage(bytes.data(), bytes.size());
+    return std::vector<unsigned char>(img.payload, img.payload + img.payloadSize);
 }
 
-inline void verifyHeaderAndPayloadIfRequested(const std::vector<unsigned char>& bytes, bool verify) {
+inline void verifyHeaderAndPayloadIfRequested(const unsigned char* data, std::size_t size, bool verify) {
     if (!verify) return;
-    if (!hasProgramHeader(bytes)) throw std::runtime_error("Verification requested but header missing");
+    if (!hasProgramHeader(data, size)) throw std::runtime_error("Verification requested but header missing");
     ProgramHeaderV1 v1{}; ProgramHeaderV2 v2{}; bool isV2 = false;
-    readAnyHeader(bytes, v1, v2, isV2);
+    readAnyHeader(data, size, v1, v2, isV2);
     if (!isV2) {
         // v1 has no checksum; accept but warn by throwing only if strictly needed. We accept for backward compat.
         return;
     }
     // Validate payload size and checksum
     const std::size_t hdrSize = sizeof(ProgramHeaderV2);
-    if (bytes.size() < hdrSize) throw std::runtime_error("Invalid v2 header size");
-    const std::size_t payloadAvail = bytes.size() - hdrSize;
+    if (size < hdrSize) throw std::runtime_error("Invalid v2 header size");
+    const std::size_t payloadAvail = size - hdrSize;
     if (payloadAvail != v2.payloadSize) throw std::runtime_error("Payload size mismatch in header");
-    std::uint32_t csum = adler32(bytes.data() + hdrSize, payloadAvail);
+    std::uint32_t csum = adler32Parallel(data + hdrSize, payloadAvail);
     if (csum != v2.checksum) throw std::runtime_error("Checksum mismatch in program payload");
 }
 
+inline void verifyHeaderAndPayloadIfRequested(const std::vector<unsigned char>& bytes, bool verify) {
+    verifyHeaderAndPayloadIfRequested(bytes.data(), bytes.size(), verify);
+}
+
 } // namespace vm
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "vm/CPU.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_COMPUTED_GOTO 1
+#else
+#define VM_COMPUTED_GOTO 0
+#endif
+
+namespace vm {
+
+// Direct-threaded execution engine. Guest code is translated lazily, one page at
+// a time, into slots that hold the address of their handler (computed goto on
+// GCC/Clang) or a handler index (portable switch fallback). run() then jumps from
+// handler to handler without returning to a central loop. step() and all
+// architectural state are inherited from SimpleCPU, so both engines are
+// interchangeable behind ICPU.
+class ThreadedCPU : public SimpleCPU {
+public:
+    ThreadedCPU(IMemory& mem, ILogger* logger = nullptr);
+
+    void reset() override;
+    RunOutcome run(std::size_t maxSteps = 0) override;
+    void invalidateCode(std::size_t addr, std::size_t len) override;
+
+    // Handler indices; also index the computed-goto label table.
+    enum Handler : u8 {
+        H_TRANSLATE = 0, // slot not translated yet
+        H_BADREG,        // register operand out of range (reported at execution)
+        H_HALT, H_LOADI, H_LOAD, H_STORE,
+        H_ADD, H_SUB, H_AND, H_OR, H_XOR, H_CMP,
+        H_PUSH, H_POP, H_JMP, H_JZ, H_JNZ, H_CALL, H_RET,
+        H_OUT, H_IN,
+        H_COUNT
+    };
+
+private:
+#if VM_COMPUTED_GOTO
+    using HandlerRef = const void*;
+#else
+    using HandlerRef = u8;
+#endif
+
+    struct Slot {
+        HandlerRef handler;
+        DecodedInst inst;
+    };
+
+    static constexpr std::size_t PAGE_BITS = 10;
+    static constexpr std::size_t PAGE_SLOTS = std::size_t{1} << PAGE_BITS;
+
+    // With `exportTable` set, only publishes the handler table.
+    RunOutcome execute(std::size_t maxSteps, const HandlerRef** exportTable);
+    Slot* slotFor(u32 pc) {
+        const std::size_t page = pc >> PAGE_BITS;
+        if (page < m_pages.size() && m_pages[page]) return &m_pages[page][pc & (PAGE_SLOTS - 1)];
+        return &m_miss;
+    }
+    Slot& translate(u32 pc);
+    void flushTranslations();
+
+    const HandlerRef* m_handlers{nullptr};
+    std::vector<std::unique_ptr<Slot[]>> m_pages;
+    Slot m_miss{};
+};
+
+} // namespace vm
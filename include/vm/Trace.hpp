@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "vm/Types.hpp"
+
+namespace vm {
+
+// One executed instruction. Fixed-size so the CPU can record it with a few
+// stores and the file format is a plain array of records.
+struct TraceRecord {
+    static constexpr u8 NO_REG = 0xFF;
+
+    u64 seq{0};          // position in the trace stream
+    u32 pc{0};           // address of the instruction
+    u32 imm{0};
+    u8 op{0};
+    u8 a{0}, b{0}, c{0}; // raw operand bytes as decoded
+    u8 dstReg{NO_REG};   // register written by the instruction, NO_REG if none
+    u8 flags{0};         // FLAGS after execution
+    u8 halted{0};        // CPU halted after this instruction (HALT or fault)
+    u8 reserved{0};
+    u32 dstValue{0};     // value of dstReg after execution
+    u32 sp{0};           // SP after execution
+};
+
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord layout is part of the trace file format");
+
+// Preallocated flight-recorder ring. The CPU is the single producer and never
+// blocks or allocates: once full, the oldest records are overwritten. Readers
+// call records() after the producer has stopped (e.g. when run() returns).
+class TraceBuffer {
+public:
+    explicit TraceBuffer(std::size_t capacity); // rounded up to a power of two
+
+    void push(const TraceRecord& rec) noexcept {
+        const u64 seq = m_head.load(std::memory_order_relaxed);
+        TraceRecord& slot = m_slots[seq & m_mask];
+        slot = rec;
+        slot.seq = seq;
+        m_head.store(seq + 1, std::memory_order_release);
+    }
+
+    std::size_t capacity() const { return m_mask + 1; }
+    u64 written() const { return m_head.load(std::memory_order_acquire); }
+    void clear() { m_head.store(0, std::memory_order_release); }
+
+    // Records still held by the ring, oldest first.
+    std::vector<TraceRecord> records() const;
+
+private:
+    std::unique_ptr<TraceRecord[]> m_slots;
+    std::size_t m_mask{0};
+    std::atomic<u64> m_head{0};
+};
+
+// Trace files: "VMTR" magic, u32 version, u32 record size, u64 count, then
+// `count` little-endian records.
+void writeTraceFile(const std::string& path, const std::vector<TraceRecord>& records);
+std::vector<TraceRecord> readTraceFile(const std::string& path);
+
+// Human-readable rendering used by vm_tracedump.
+std::string formatTraceRecord(const TraceRecord& rec);
+
+} // namespace vm
@@ -0,0 +1,389 @@
+#include "vm/Assembler.hpp"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstring>
+#include <iomanip>
+#include <istream>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <unordered_map>
+
+#include "vm/Checksum.hpp"
+#include "vm/Layout.hpp"
+#include "vm/Opcodes.hpp"
+#include "vm/Profiler.hpp"
+#include "vm/ProgramLoader.hpp"
+
+namespace vm {
+
+namespace {
+
+// Operand layout of an instruction; the encoded bytes follow the opcode in
+// this order.
+enum class Format : u8 {
+    None,   // HALT, RET
+    RegImm, // LOADI Rd, imm32
+    RegMem, // LOAD  Rd, [Rs + imm16]
+    MemReg, // STORE [Rd + imm16], Rs
+    Reg3,   // ALU   Rd, Ra, Rb
+    Reg2,   // CMP   Ra, Rb
+    Reg1,   // PUSH/POP/OUT/IN Rn
+    Addr    // JMP/JZ/JNZ/CALL addr32
+};
+
+struct Mnemonic {
+    u64 key; // mnemonicKey() of the name
+    Opcode op;
+    Format format;
+    const char* usage;
+};
+
+// Up to eight characters packed big-endian and upper-cased, so a mnemonic
+// compares as one integer whatever its case; 0 if it cannot be a mnemonic.
+constexpr u64 mnemonicKey(std::string_view s) {
+    if (s.empty() || s.size() > 8) return 0;
+    u64 key = 0;
+    for (char c : s) key = (key << 8) | static_cast<u8>(c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c);
+    return key;
+}
+
+// Sorted by key on first use; looked up by binary search.
+const std::array<Mnemonic, 19>& mnemonics() {
+    static const std::array<Mnemonic, 19> table = [] {
+        std::array<Mnemonic, 19> t{{
+            {mnemonicKey("HALT"), Opcode::HALT, Format::None, "HALT"},
+            {mnemonicKey("LOADI"), Opcode::LOADI, Format::RegImm, "LOADI Rn, imm"},
+            {mnemonicKey("LOAD"), Opcode::LOAD, Format::RegMem, "LOAD Rd, [Rs + imm]"},
+            {mnemonicKey("STORE"), Opcode::STORE, Format::MemReg, "STORE [Rd + imm], Rs"},
+            {mnemonicKey("ADD"), Opcode::ADD, Format::Reg3, "ADD Rd, Ra, Rb"},
+            {mnemonicKey("SUB"), Opcode::SUB, Format::Reg3, "SUB Rd, Ra, Rb"},
+            {mnemonicKey("AND"), Opcode::AND, Format::Reg3, "AND Rd, Ra, Rb"},
+            {mnemonicKey("OR"), Opcode::OR, Format::Reg3, "OR Rd, Ra, Rb"},
+            {mnemonicKey("XOR"), Opcode::XOR, Format::Reg3, "XOR Rd, Ra, Rb"},
+            {mnemonicKey("CMP"), Opcode::CMP, Format::Reg2, "CMP Ra, Rb"},
+            {mnemonicKey("PUSH"), Opcode::PUSH, Format::Reg1, "PUSH Rn"},
+            {mnemonicKey("POP"), Opcode::POP, Format::Reg1, "POP Rn"},
+            {mnemonicKey("JMP"), Opcode::JMP, Format::Addr, "JMP label|addr"},
+            {mnemonicKey("JZ"), Opcode::JZ, Format::Addr, "JZ label|addr"},
+            {mnemonicKey("JNZ"), Opcode::JNZ, Format::Addr, "JNZ label|addr"},
+            {mnemonicKey("CALL"), Opcode::CALL, Format::Addr, "CALL label|addr"},
+            {mnemonicKey("RET"), Opcode::RET, Format::None, "RET"},
+            {mnemonicKey("OUT"), Opcode::OUT, Format::Reg1, "OUT Rn"},
+            {mnemonicKey("IN"), Opcode::IN, Format::Reg1, "IN Rn"},
+        }};
+        std::sort(t.begin(), t.end(), [](const Mnemonic& a, const Mnemonic& b) { return a.key < b.key; });
+        return t;
+    }();
+    return table;
+}
+
+const Mnemonic* findMnemonic(std::string_view name) {
+    const u64 key = mnemonicKey(name);
+    const auto& table = mnemonics();
+    auto it = std::lower_bound(table.begin(), table.end(), key, [](const Mnemonic& m, u64 k) { return m.key < k; });
+    return it != table.end() && it->key == key ? &*it : nullptr;
+}
+
+constexpr std::size_t operandCount(Format f) {
+    switch (f) {
+        case Format::None: return 0;
+        case Format::Reg1: case Format::Addr: return 1;
+        case Format::RegImm: case Format::Reg2: return 2;
+        default: return 3;
+    }
+}
+
+bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'; }
+bool isSeparator(char c) { return isSpace(c) || c == ',' || c == '[' || c == ']' || c == '+'; }
+
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && isSpace(s.front())) s.remove_prefix(1);
+    while (!s.empty() && isSpace(s.back())) s.remove_suffix(1);
+    return s;
+}
+
+// Decimal, 0x-prefixed hex, optionally negated (two's complement); nullopt
+// unless the whole token is a number that fits in 32 bits.
+std::optional<u32> parseNumber(std::string_view tok) {
+    const bool neg = !tok.empty() && tok.front() == '-';
+    if (neg) tok.remove_prefix(1);
+    int base = 10;
+    if (tok.size() > 2 && tok[0] == '0' && (tok[1] == 'x' || tok[1] == 'X')) {
+        tok.remove_prefix(2);
+        base = 16;
+    }
+    u32 v = 0;
+    const auto [end, ec] = std::from_chars(tok.data(), tok.data() + tok.size(), v, base);
+    if (tok.empty() || ec != std::errc() || end != tok.data() + tok.size()) return std::nullopt;
+    return neg ? 0u - v : v;
+}
+
+int parseReg(std::string_view tok) {
+    if (tok.size() != 2 || (tok[0] != 'R' && tok[0] != 'r') || tok[1] < '0' || tok[1] > '7') return -1;
+    return tok[1] - '0';
+}
+
+// Single streaming pass: each line is encoded as soon as it is read. A label
+// that is not defined yet is emitted as zero and recorded as a fixup, and
+// finish() patches those once every label is known, so nothing of the source
+// is kept beyond the label names. In relocatable mode every label operand
+// is also recorded as a Relocation, and finishObject() leaves undefined
+// labels to the linker instead of failing.
+class Assembler {
+public:
+    explicit Assembler(bool relocatable = false) : m_relocatable(relocatable) {}
+
+    void reserve(std::size_t sourceBytes) { m_prog.code.reserve(sourceBytes / 4); }
+
+    void line(std::string_view text, std::size_t lineNo) {
+        m_lineNo = lineNo;
+        // Comments: ';', '#' or "//" to the end of the line
+        std::size_t end = 0;
+        while (end < text.size() && text[end] != ';' && text[end] != '#' &&
+               !(text[end] == '/' && end + 1 < text.size() && text[end + 1] == '/')) {
+            ++end;
+        }
+        text = text.substr(0, end);
+        const std::size_t colon = text.find(':');
+        if (colon != std::string_view::npos) {
+            defineLabel(trim(text.substr(0, colon)));
+            text.remove_prefix(colon + 1);
+        }
+
+        std::array<std::string_view, 4> toks;
+        std::size_t count = 0;
+        for (std::size_t i = 0; i < text.size();) {
+            if (isSeparator(text[i])) {
+                ++i;
+                continue;
+            }
+            std::size_t j = i;
+            while (j < text.size() && !isSeparator(text[j])) ++j;
+            if (count < toks.size()) toks[count] = text.substr(i, j - i);
+            ++count;
+            i = j;
+        }
+        if (count) instruction(toks, count);
+    }
+
+    AssembledProgram finish() {
+        for (const Fixup& f : m_fixups) {
+            auto it = m_prog.labels.find(f.label);
+            if (it == m_prog.labels.end()) throw AssemblyError(f.line, "Invalid number or unknown label: " + f.label);
+            for (std::size_t i = 0; i < f.width; ++i) m_prog.code[f.at + i] = static_cast<u8>(it->second >> (8 * i));
+        }
+        return std::move(m_prog);
+    }
+
+    // With `externals` false, labels the source does not define are errors,
+    // as in finish().
+    ObjectFile finishObject(bool externals = true) {
+        for (const auto& [name, line] : m_globals) {
+            if (!m_prog.labels.count(name)) throw AssemblyError(line, "Undefined global symbol: " + name);
+        }
+        for (Fixup& f : m_fixups) {
+            auto it = m_prog.labels.find(f.label);
+            if (it != m_prog.labels.end()) m_relocs.push_back({static_cast<u32>(f.at), f.width, {}, it->second});
+            else if (externals) m_relocs.push_back({static_cast<u32>(f.at), f.width, std::move(f.label), 0});
+            else throw AssemblyError(f.line, "Invalid number or unknown label: " + f.label);
+        }
+        ObjectFile obj;
+        for (const auto& [name, offset] : m_prog.labels) obj.symbols.push_back({name, offset, m_globals.count(name) != 0});
+        std::sort(obj.symbols.begin(), obj.symbols.end(), [](const ObjectSymbol& a, const ObjectSymbol& b) {
+            return a.offset != b.offset ? a.offset < b.offset : a.name < b.name;
+        });
+        std::sort(m_relocs.begin(), m_relocs.end(), [](const Relocation& a, const Relocation& b) { return a.offset < b.offset; });
+        obj.relocations = std::move(m_relocs);
+        obj.code = std::move(m_prog.code);
+        return obj;
+    }
+
+private:
+    struct Fixup {
+        std::size_t at;  // offset of the operand in code
+        u8 width;        // 2 or 4 bytes
+        std::size_t line;
+        std::string label;
+    };
+
+    [[noreturn]] void fail(const std::string& what) const { throw AssemblyError(m_lineNo, what); }
+
+    void defineLabel(std::string_view name) {
+        if (name.empty()) return;
+        const auto [it, added] = m_prog.labels.emplace(std::string(name), static_cast<u32>(m_prog.code.size()));
+        if (!added) fail("Duplicate label: " + std::string(name));
+        m_index.emplace(it->first, it->second);
+    }
+
+    void instruction(const std::array<std::string_view, 4>& toks, std::size_t count) {
+        if (toks[0].front() == '.') return directive(toks, count);
+        const Mnemonic* m = findMnemonic(toks[0]);
+        if (!m) fail("Unknown opcode: " + std::string(toks[0]));
+        if (count != operandCount(m->format) + 1) fail(std::string(toks[0]) + " expects: " + m->usage);
+        std::vector<unsigned char>& code = m_prog.code;
+        code.push_back(static_cast<u8>(m->op));
+        switch (m->format) {
+            case Format::None: break;
+            case Format::RegImm: reg(toks[1]); value(toks[2], 4); break;
+            case Format::RegMem: reg(toks[1]); reg(toks[2]); value(toks[3], 2); break;
+            case Format::MemReg: reg(toks[1]); reg(toks[3]); value(toks[2], 2); break;
+            case Format::Reg3: reg(toks[1]); reg(toks[2]); reg(toks[3]); break;
+            case Format::Reg2: reg(toks[1]); reg(toks[2]); break;
+            case Format::Reg1: reg(toks[1]); break;
+            case Format::Addr: value(toks[1], 4); break;
+        }
+    }
+
+    // `.global name[, name...]` exports labels to other modules; a flat
+    // assemble() accepts and ignores it.
+    void directive(const std::array<std::string_view, 4>& toks, std::size_t count) {
+        if (mnemonicKey(toks[0]) != mnemonicKey(".GLOBAL") && mnemonicKey(toks[0]) != mnemonicKey(".GLOBL")) {
+            fail("Unknown directive: " + std::string(toks[0]));
+        }
+        if (count < 2 || count > toks.size()) fail(".global expects: .global name[, name, name]");
+        for (std::size_t i = 1; i < count; ++i) m_globals.emplace(std::string(toks[i]), m_lineNo);
+    }
+
+    void reg(std::string_view tok) {
+        const int r = parseReg(tok);
+        if (r < 0) fail("Invalid register: " + std::string(tok));
+        m_prog.code.push_back(static_cast<u8>(r));
+    }
+
+    // Little-endian operand of `width` bytes: a number or a label, which may
+    // be defined further down.
+    void value(std::string_view tok, u8 width) {
+        u32 v = 0;
+        const char first = tok.front();
+        if ((first >= '0' && first <= '9') || first == '-') {
+            const auto num = parseNumber(tok);
+            if (!num) fail("Invalid number: " + std::string(tok));
+            v = *num;
+        } else {
+            auto it = m_index.find(tok);
+            if (it == m_index.end()) {
+                m_fixups.push_back({m_prog.code.size(), width, m_lineNo, std::string(tok)});
+            } else {
+                v = it->second;
+                if (m_relocatable) m_relocs.push_back({static_cast<u32>(m_prog.code.size()), width, {}, v});
+            }
+        }
+        for (u8 i = 0; i < width; ++i) m_prog.code.push_back(static_cast<u8>(v >> (8 * i)));
+    }
+
+    bool m_relocatable;
+    AssembledProgram m_prog;
+    std::vector<Fixup> m_fixups;
+    std::vector<Relocation> m_relocs;
+    std::unordered_map<std::string, std::size_t> m_globals; // name => line of its .global
+    // Label lookups by view, keyed by the names stored in m_prog.labels
+    // (unordered_map nodes do not move).
+    std::unordered_map<std::string_view, u32> m_index;
+    std::size_t m_lineNo{0};
+};
+
+void feed(Assembler& as, std::string_view source) {
+    as.reserve(source.size());
+    std::size_t lineNo = 0;
+    while (!source.empty()) {
+        const std::size_t nl = source.find('\n');
+        as.line(source.substr(0, nl), ++lineNo);
+        source.remove_prefix(nl == std::string_view::npos ? source.size() : nl + 1);
+    }
+}
+
+} // namespace
+
+u32 AssembledProgram::address(const std::string& labelOrNumber) const {
+    auto it = labels.find(labelOrNumber);
+    if (it != labels.end()) return it->second;
+    if (const auto num = parseNumber(labelOrNumber)) return *num;
+    throw AssemblyError(0, "Invalid number or unknown label: " + labelOrNumber);
+}
+
+std::vector<unsigned char> AssembledProgram::image(u32 entry) const {
+    ProgramHeaderV2 hdr{};
+    hdr.magic[0]='V'; hdr.magic[1]='M'; hdr.magic[2]='B'; hdr.magic[3]='1';
+    hdr.version = 2;
+    hdr.entry = entry;
+    hdr.payloadSize = static_cast<std::uint32_t>(code.size());
+    hdr.checksum = adler32Parallel(code.data(), code.size());
+    std::vector<unsigned char> out(sizeof hdr + code.size());
+    std::memcpy(out.data(), &hdr, sizeof hdr);
+    if (!code.empty()) std::memcpy(out.data() + sizeof hdr, code.data(), code.size());
+    return out;
+}
+
+SymbolMap AssembledProgram::symbolMap() const {
+    SymbolMap map;
+    for (const auto& kv : labels) map.add(kv.second, kv.first);
+    return map;
+}
+
+void AssembledProgram::writeSymbols(std::ostream& out) const {
+    std::vector<std::pair<u32, std::string>> syms;
+    for (const auto& kv : labels) syms.emplace_back(kv.second, kv.first);
+    std::sort(syms.begin(), syms.end());
+    const auto flags = out.flags();
+    const char fill = out.fill('0');
+    for (const auto& s : syms) out << std::hex << std::setw(8) << s.first << std::dec << ' ' << s.second << '\n';
+    out.flags(flags);
+    out.fill(fill);
+}
+
+AssembledProgram assemble(std::string_view source) {
+    Assembler as;
+    feed(as, source);
+    return as.finish();
+}
+
+AssembledProgram assemble(std::istream& in) {
+    // Read in blocks; only a line split across two blocks is copied.
+    constexpr std::size_t BLOCK = 64 * 1024;
+    std::vector<char> block(BLOCK);
+    std::string partial;
+    Assembler as;
+    std::size_t lineNo = 0;
+    while (in) {
+        in.read(block.data(), static_cast<std::streamsize>(block.size()));
+        std::string_view chunk(block.data(), static_cast<std::size_t>(in.gcount()));
+        for (std::size_t nl; (nl = chunk.find('\n')) != std::string_view::npos; chunk.remove_prefix(nl + 1)) {
+            if (partial.empty()) {
+                as.line(chunk.substr(0, nl), ++lineNo);
+            } else {
+                partial.append(chunk.data(), nl);
+                as.line(partial, ++lineNo);
+                partial.clear();
+            }
+        }
+        partial.append(chunk.data(), chunk.size());
+    }
+    if (!partial.empty()) as.line(partial, ++lineNo);
+    return as.finish();
+}
+
+ObjectFile assembleObject(std::string_view source, const std::string& name) {
+    Assembler as(true);
+    feed(as, source);
+    ObjectFile obj = as.finishObject();
+    obj.name = name;
+    obj.sourceHash = contentHash64(reinterpret_cast<const unsigned char*>(source.data()), source.size());
+    obj.sourceSize = source.size();
+    return obj;
+}
+
+AssembledProgram assembleWithProfile(std::string_view source, const ExecutionProfile& profile, LayoutReport* report) {
+    Assembler as(true);
+    feed(as, source);
+    const ObjectFile obj = layoutObject(as.finishObject(false), profile, 0, report);
+    AssembledProgram prog;
+    prog.code = obj.code;
+    prog.labels.reserve(obj.symbols.size());
+    for (const ObjectSymbol& s : obj.symbols) prog.labels.emplace(s.name, s.offset);
+    return prog;
+}
+
+} // namespace vm
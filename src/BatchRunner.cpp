@@ -0,0 +1,305 @@
+#include "vm/BatchRunner.hpp"
+#include "vm/Assembler.hpp"
+#include "vm/Instance.hpp"
+#include "vm/ProgramLoader.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <istream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+namespace vm {
+
+namespace {
+
+// Digits only: std::stoull would accept a sign or leading spaces, and wraps
+// "-1" to an unlimited value.
+std::size_t parseCount(const std::string& s, const std::string& key) {
+    const bool digits = !s.empty() && std::all_of(s.begin(), s.end(), [](unsigned char c) { return std::isdigit(c) != 0; });
+    if (!digits) throw std::runtime_error("invalid " + key);
+    try {
+        return static_cast<std::size_t>(std::stoull(s));
+    } catch (const std::out_of_range&) {
+        throw std::runtime_error("invalid " + key);
+    }
+}
+
+std::size_t parseSize(const std::string& s) {
+    if (s.empty()) throw std::runtime_error("invalid mem");
+    std::size_t mult = 1;
+    std::string num = s;
+    const char last = static_cast<char>(std::tolower(static_cast<unsigned char>(s.back())));
+    if (last == 'k') { mult = 1024; num.pop_back(); }
+    else if (last == 'm') { mult = 1024 * 1024; num.pop_back(); }
+    else if (last == 'g') { mult = 1024 * 1024 * 1024; num.pop_back(); }
+    const std::size_t n = parseCount(num, "mem");
+    if (n > SIZE_MAX / mult) throw std::runtime_error("invalid mem");
+    return n * mult;
+}
+
+CpuEngine parseEngineName(const std::string& s) {
+    if (s == "interp" || s == "interpreter") return CpuEngine::Interpreter;
+    if (s == "threaded") return CpuEngine::Threaded;
+    if (s == "jit") return CpuEngine::Jit;
+    throw std::runtime_error("Unknown engine: " + s);
+}
+
+MemoryBackend parseBackendName(const std::string& s) {
+    if (s == "dense") return MemoryBackend::Dense;
+    if (s == "sparse") return MemoryBackend::Sparse;
+    throw std::runtime_error("Unknown memory backend: " + s);
+}
+
+void jsonString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (unsigned char ch : s) {
+        switch (ch) {
+            case '"': out << "\\\""; break;
+            case '\\': out << "\\\\"; break;
+            case '\n': out << "\\n"; break;
+            case '\r': out << "\\r"; break;
+            case '\t': out << "\\t"; break;
+            default:
+                if (ch < 0x20) {
+                    out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(ch)
+                        << std::dec << std::setfill(' ');
+                } else {
+                    out << static_cast<char>(ch);
+                }
+        }
+    }
+    out << '"';
+}
+
+// Work-stealing scheduler over job indices. Each worker owns a deque: it pops
+// from the back of its own and steals from the front of the others. All jobs
+// are known up front, so a worker is done once every deque is empty.
+class WorkStealingQueues {
+public:
+    WorkStealingQueues(std::size_t workers, std::size_t jobs) : m_queues(workers) {
+        for (std::size_t i = 0; i < jobs; ++i) m_queues[i % workers].items.push_back(i);
+    }
+
+    bool next(std::size_t self, std::size_t& job) {
+        if (m_queues[self].popBack(job)) return true;
+        for (std::size_t k = 1; k < m_queues.size(); ++k) {
+            if (m_queues[(self + k) % m_queues.size()].popFront(job)) return true;
+        }
+        return false;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::size_t> items;
+
+        bool popBack(std::size_t& out) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.empty()) return false;
+            out = items.back();
+            items.pop_back();
+            return true;
+        }
+        bool popFront(std::size_t& out) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (items.empty()) return false;
+            out = items.front();
+            items.pop_front();
+            return true;
+        }
+    };
+
+    std::vector<Queue> m_queues;
+};
+
+const char* outcomeName(RunOutcome outcome) {
+    switch (outcome) {
+    case RunOutcome::Halted: return "halted";
+    case RunOutcome::Breakpoint: return "breakpoint";
+    case RunOutcome::StepLimit: return "step_limit";
+    case RunOutcome::Watchpoint: return "watchpoint";
+    case RunOutcome::Fault: return "fault";
+    }
+    return "unknown";
+}
+
+const char* outcomeError(RunOutcome outcome) {
+    switch (outcome) {
+    case RunOutcome::Fault: return "fault";
+    case RunOutcome::StepLimit: return "step limit reached";
+    case RunOutcome::Breakpoint: return "stopped at breakpoint";
+    case RunOutcome::Watchpoint: return "stopped at watchpoint";
+    case RunOutcome::Halted: break;
+    }
+    return "";
+}
+
+BatchResult runJob(const BatchJob& job, const std::vector<unsigned char>& program) {
+    BatchResult res;
+    const auto start = std::chrono::steady_clock::now();
+    std::ostringstream out;
+    std::string input = job.input;
+    std::replace(input.begin(), input.end(), ',', ' ');
+    std::istringstream in(input);
+    try {
+        VMConfig cfg;
+        cfg.memSize = job.memSize;
+        cfg.memBackend = job.memBackend;
+        cfg.steps = job.steps;
+        cfg.engine = job.engine;
+        cfg.consoleOut = &out;
+        cfg.consoleIn = &in;
+        VMInstance instance(cfg);
+        instance.powerOn();
+        instance.loadProgramBytes(program);
+        const RunOutcome outcome = job.steps == 0 ? instance.runUntilHalt() : instance.runSteps(job.steps);
+        const ICPU* cpu = instance.cpu();
+        res.pc = cpu->getPC();
+        for (std::size_t i = 0; i < cpu->regCount(); ++i) res.regs.push_back(cpu->getReg(i));
+        res.outcome = outcomeName(outcome);
+        res.ok = outcome == RunOutcome::Halted;
+        res.error = outcomeError(outcome);
+    } catch (const std::exception& ex) {
+        res.outcome = "error";
+        res.error = ex.what();
+    }
+    res.output = out.str();
+    res.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return res;
+}
+
+bool isAssemblySource(const std::string& path) {
+    return path.size() > 4 && path.compare(path.size() - 4, 4, ".asm") == 0;
+}
+
+std::vector<unsigned char> assembleFile(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Failed to open file: " + path);
+    try {
+        return assemble(in).code;
+    } catch (const AssemblyError& ex) {
+        throw std::runtime_error(path + ": " + ex.what());
+    }
+}
+
+} // namespace
+
+std::vector<BatchJob> parseBatchManifest(std::istream& in, const BatchJob& defaults) {
+    std::vector<BatchJob> jobs;
+    std::string line;
+    std::size_t lineNo = 0;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        const auto hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream tokens(line);
+        std::string tok;
+        if (!(tokens >> tok)) continue;
+        BatchJob job = defaults;
+        job.program = tok;
+        while (tokens >> tok) {
+            const auto eq = tok.find('=');
+            if (eq == std::string::npos) throw std::runtime_error("manifest line " + std::to_string(lineNo) + ": expected key=value, got '" + tok + "'");
+            const std::string key = tok.substr(0, eq);
+            const std::string val = tok.substr(eq + 1);
+            try {
+                if (key == "mem") job.memSize = parseSize(val);
+                else if (key == "backend") job.memBackend = parseBackendName(val);
+                else if (key == "steps") job.steps = parseCount(val, "steps");
+                else if (key == "input") job.input = val;
+                else if (key == "engine") job.engine = parseEngineName(val);
+                else throw std::runtime_error("unknown key '" + key + "'");
+            } catch (const std::exception& ex) {
+                throw std::runtime_error("manifest line " + std::to_string(lineNo) + ": " + ex.what());
+            }
+        }
+        jobs.push_back(std::move(job));
+    }
+    return jobs;
+}
+
+BatchSummary runBatch(const std::vector<BatchJob>& jobs, std::size_t threads) {
+    BatchSummary summary;
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::max<std::size_t>(1, std::min(threads, jobs.size()));
+    summary.threads = threads;
+    summary.results.resize(jobs.size());
+
+    // Read (and for .asm sources, assemble) each distinct program once; a
+    // missing or malformed file fails only its jobs.
+    std::map<std::string, std::vector<unsigned char>> programs;
+    std::map<std::string, std::string> loadErrors;
+    for (const auto& job : jobs) {
+        if (programs.count(job.program) || loadErrors.count(job.program)) continue;
+        try {
+            programs.emplace(job.program, isAssemblySource(job.program) ? assembleFile(job.program) : loadBinaryFile(job.program));
+        } catch (const std::exception& ex) {
+            loadErrors.emplace(job.program, ex.what());
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    WorkStealingQueues queues(threads, jobs.size());
+    auto worker = [&](std::size_t self) {
+        std::size_t idx = 0;
+        while (queues.next(self, idx)) {
+            const BatchJob& job = jobs[idx];
+            auto err = loadErrors.find(job.program);
+            if (err != loadErrors.end()) {
+                summary.results[idx].error = err->second;
+                summary.results[idx].outcome = "error";
+                continue;
+            }
+            summary.results[idx] = runJob(job, programs.at(job.program));
+        }
+    };
+    std::vector<std::thread> pool;
+    for (std::size_t t = 1; t < threads; ++t) pool.emplace_back(worker, t);
+    worker(0);
+    for (auto& th : pool) th.join();
+    summary.wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return summary;
+}
+
+void writeBatchJson(std::ostream& out, const std::vector<BatchJob>& jobs, const BatchSummary& summary) {
+    std::size_t failed = 0;
+    for (const auto& r : summary.results) if (!r.ok) ++failed;
+    const double seconds = summary.wallMs / 1000.0;
+    out << "{\n  \"jobs\": " << jobs.size()
+        << ",\n  \"failed\": " << failed
+        << ",\n  \"threads\": " << summary.threads
+        << ",\n  \"wall_ms\": " << summary.wallMs
+        << ",\n  \"jobs_per_sec\": " << (seconds > 0 ? static_cast<double>(jobs.size()) / seconds : 0.0)
+        << ",\n  \"results\": [";
+    for (std::size_t i = 0; i < summary.results.size(); ++i) {
+        const BatchResult& r = summary.results[i];
+        out << (i ? ",\n    {" : "\n    {") << "\"index\": " << i << ", \"program\": ";
+        jsonString(out, jobs[i].program);
+        out << ", \"ok\": " << (r.ok ? "true" : "false") << ", \"outcome\": ";
+        jsonString(out, r.outcome);
+        if (!r.ok) {
+            out << ", \"error\": ";
+            jsonString(out, r.error);
+        }
+        out << ", \"pc\": " << r.pc << ", \"regs\": [";
+        for (std::size_t k = 0; k < r.regs.size(); ++k) out << (k ? ", " : "") << r.regs[k];
+        out << "], \"output\": ";
+        jsonString(out, r.output);
+        out << ", \"elapsed_ms\": " << r.elapsedMs << '}';
+    }
+    out << (summary.results.empty() ? "]\n}\n" : "\n  ]\n}\n");
+}
+
+} // namespace vm
@@ -1,21 +1,30 @@
 #include "vm/Bus.hpp"
 
+#include <algorithm>
 #include <stdexcept>
 
 namespace vm {
 
+BusMemory::BusMemory(RamMemory& ram) : m_ram(ram) {
+    // Only whole pages are fast-pathed; a trailing partial page goes through RamMemory.
+    const std::size_t fullPages = m_ram.size() >> PAGE_BITS;
+    const std::size_t pages = (m_ram.size() + PAGE_SIZE - 1) >> PAGE_BITS;
+    m_pages.resize(pages);
+    for (std::size_t p = 0; p < fullPages; ++p) m_pages[p].ram = m_pages[p].inRam = true;
+}
+
 const DeviceMapping* BusMemory::find(std::size_t addr) const {
-    for (const auto& m : m_maps) {
+    const std::size_t page = addr >> PAGE_BITS;
+    if (page >= m_pages.size() || m_pages[page].devLo == m_pages[page].devHi) return nullptr;
+    for (u32 idx : m_pageMaps.at(page)) {
+        const DeviceMapping& m = m_maps[idx];
         if (addr >= m.base && addr < m.base + m.size) return &m;
     }
     return nullptr;
 }
 
 DeviceMapping* BusMemory::find(std::size_t addr) {
-    for (auto& m : m_maps) {
-        if (addr >= m.base && addr < m.base + m.size) return &m;
-    }
-    return nullptr;
+    return const_cast<DeviceMapping*>(static_cast<const BusMemory*>(this)->find(addr));
 }
 
 void BusMemory::mapDevice(std::size_t base, std::shared_ptr<IDevice> dev) {
@@ -31,32 +40,134 @@ void BusMemory::mapDevice(std::size_t base, std::shared_ptr<IDevice> dev) {
             throw std::runtime_error("Device mapping overlaps existing device");
         }
     }
+    m_deviceAccesses.push_back(0);
+    if (m.size == 0) {
+        m_maps.push_back(std::move(m));
+        return;
+    }
+    const std::size_t first = m.base >> PAGE_BITS;
+    const std::size_t last = (m.base + m.size - 1) >> PAGE_BITS;
+    if (last >= m_pages.size()) m_pages.resize(last + 1);
+    const u32 idx = static_cast<u32>(m_maps.size());
+    for (std::size_t p = first; p <= last; ++p) {
+        const std::size_t pageBase = p << PAGE_BITS;
+        const u16 lo = static_cast<u16>(m.base > pageBase ? m.base - pageBase : 0);
+        const u16 hi = static_cast<u16>(std::min(m.base + m.size - pageBase, PAGE_SIZE));
+        PageEntry& e = m_pages[p];
+        if (e.devLo == e.devHi) { e.devLo = lo; e.devHi = hi; }
+        else { e.devLo = std::min(e.devLo, lo); e.devHi = std::max(e.devHi, hi); }
+        if (lo == 0 && hi == PAGE_SIZE) e.ram = e.inRam = false; // page fully owned by the device
+        m_pageMaps[p].push_back(idx);
+    }
     m_maps.push_back(std::move(m));
 }
 
+void BusMemory::addWatch(std::size_t base, std::size_t size, WatchKind kind) {
+    if (size == 0) throw std::invalid_argument("addWatch: empty range");
+    const Watchpoint w{base, size, kind};
+    m_watches.push_back(w);
+    updateWatchPages(w, 1);
+}
+
+void BusMemory::removeWatch(std::size_t base, std::size_t size, WatchKind kind) {
+    auto it = std::find_if(m_watches.begin(), m_watches.end(), [&](const Watchpoint& w) {
+        return w.base == base && w.size == size && w.kind == kind;
+    });
+    if (it == m_watches.end()) return;
+    updateWatchPages(*it, -1);
+    m_watches.erase(it);
+}
+
+void BusMemory::updateWatchPages(const Watchpoint& w, int delta) {
+    const std::size_t first = w.base >> PAGE_BITS;
+    const std::size_t last = std::min((w.base + w.size - 1) >> PAGE_BITS, m_pages.size() - 1);
+    for (std::size_t p = first; p <= last && p < m_pages.size(); ++p) {
+        PageEntry& e = m_pages[p];
+        e.watches = static_cast<u16>(e.watches + delta);
+        e.ram = e.inRam && e.watches == 0;
+    }
+}
+
+bool BusMemory::watched(std::size_t addr, std::size_t len) const {
+    const std::size_t first = addr >> PAGE_BITS;
+    const std::size_t last = (addr + len - 1) >> PAGE_BITS;
+    return (first < m_pages.size() && m_pages[first].watches) || (last < m_pages.size() && m_pages[last].watches);
+}
+
+u32 BusMemory::peek(std::size_t addr, std::size_t len) const {
+    u32 v = 0;
+    for (std::size_t i = 0; i < len && addr + i < size(); ++i) {
+        const std::size_t a = addr + i;
+        const DeviceMapping* m = find(a);
+        v |= static_cast<u32>(m ? m->device->read8(a - m->base) : m_ram.read8(a)) << (8 * i);
+    }
+    return v;
+}
+
+void BusMemory::checkRead(std::size_t addr, std::size_t len) const {
+    for (const Watchpoint& w : m_watches) {
+        if (w.kind != WatchKind::Read || addr + len <= w.base || addr >= w.base + w.size) continue;
+        if (m_watchHandler) {
+            WatchHit hit;
+            hit.kind = WatchKind::Read;
+            hit.addr = addr;
+            hit.size = len;
+            hit.oldValue = peek(addr, len);
+            m_watchHandler(hit);
+        }
+        return;
+    }
+}
+
+void BusMemory::checkWrite(std::size_t addr, std::size_t len, u32 value) const {
+    for (const Watchpoint& w : m_watches) {
+        if (w.kind == WatchKind::Read || addr + len <= w.base || addr >= w.base + w.size) continue;
+        const u32 old = peek(addr, len);
+        if (w.kind == WatchKind::Change && old == value) continue;
+        if (m_watchHandler) {
+            WatchHit hit;
+            hit.kind = w.kind;
+            hit.addr = addr;
+            hit.size = len;
+            hit.oldValue = old;
+            hit.newValue = value;
+            m_watchHandler(hit);
+        }
+        return;
+    }
+}
+
 u8 BusMemory::read8(std::size_t addr) const {
+    if (!m_watches.empty() && watched(addr, 1)) checkRead(addr, 1);
     if (auto m = find(addr)) {
+        countAccess(m);
         return m->device->read8(addr - m->base);
     }
     return m_ram.read8(addr);
 }
 
 u16 BusMemory::read16(std::size_t addr) const {
+    if (!m_watches.empty() && watched(addr, 2)) checkRead(addr, 2);
     if (auto m = find(addr)) {
+        countAccess(m);
         return m->device->read16(addr - m->base);
     }
     return m_ram.read16(addr);
 }
 
 u32 BusMemory::read32(std::size_t addr) const {
+    if (!m_watches.empty() && watched(addr, 4)) checkRead(addr, 4);
     if (auto m = find(addr)) {
+        countAccess(m);
         return m->device->read32(addr - m->base);
     }
     return m_ram.read32(addr);
 }
 
 void BusMemory::write8(std::size_t addr, u8 v) {
+    if (!m_watches.empty() && watched(addr, 1)) checkWrite(addr, 1, v);
     if (auto m = find(addr)) {
+        countAccess(m);
         m->device->write8(addr - m->base, v);
         return;
     }
@@ -64,7 +175,9 @@ void BusMemory::write8(std::size_t addr, u8 v) {
 }
 
 void BusMemory::write16(std::size_t addr, u16 v) {
+    if (!m_watches.empty() && watched(addr, 2)) checkWrite(addr, 2, v);
     if (auto m = find(addr)) {
+        countAccess(m);
         m->device->write16(addr - m->base, v);
         return;
     }
@@ -72,7 +185,9 @@ void BusMemory::write16(std::size_t addr, u16 v) {
 }
 
 void BusMemory::write32(std::size_t addr, u32 v) {
+    if (!m_watches.empty() && watched(addr, 4)) checkWrite(addr, 4, v);
     if (auto m = find(addr)) {
+        countAccess(m);
         m->device->write32(addr - m->base, v);
         return;
     }
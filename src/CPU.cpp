@@ -1,15 +1,128 @@
 #include "vm/CPU.hpp"
+#include "vm/Bus.hpp"
 #include "vm/Memory.hpp"
 #include "vm/Logger.hpp"
 #include "vm/Decoder.hpp"
 #include "vm/Opcodes.hpp"
+#include "vm/Trace.hpp"
+#include "vm/Profiler.hpp"
+#include "vm/ConsoleSink.hpp"
+#include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
+#include <typeinfo>
 
 namespace vm {
 
+namespace {
+
+// Memory access policies the interpreter core is instantiated with. Calls go
+// to the concrete type, so the compiler can inline the RAM case.
+struct GenericAccess {
+    IMemory& mem;
+    std::size_t size() const { return mem.size(); }
+    u32 read32(std::size_t addr) const { return mem.read32(addr); }
+    void write32(std::size_t addr, u32 v) const { mem.write32(addr, v); }
+};
+
+struct BusAccess {
+    BusMemory& bus;
+    std::size_t size() const { return bus.BusMemory::size(); }
+    u32 read32(std::size_t addr) const { return bus.fastRead32(addr); }
+    void write32(std::size_t addr, u32 v) const { bus.fastWrite32(addr, v); }
+};
+
+struct RamAccess {
+    RamMemory& ram;
+    std::size_t size() const { return ram.RamMemory::size(); }
+    static bool inPage(std::size_t addr) { return (addr & RamMemory::PAGE_MASK) <= RamMemory::PAGE_SIZE - 4; }
+    // Page-crossing, out-of-range and copy-on-write accesses go through RamMemory.
+    u32 read32(std::size_t addr) const {
+        if (addr + 4 <= size() && inPage(addr)) return loadLE32(ram.readPage(addr >> RamMemory::PAGE_BITS) + (addr & RamMemory::PAGE_MASK));
+        return ram.RamMemory::read32(addr);
+    }
+    void write32(std::size_t addr, u32 v) const {
+        if (addr + 4 <= size() && inPage(addr)) {
+            if (u8* page = ram.writePage(addr >> RamMemory::PAGE_BITS)) {
+                storeLE32(page + (addr & RamMemory::PAGE_MASK), v);
+                return;
+            }
+        }
+        ram.RamMemory::write32(addr, v);
+    }
+};
+
+bool isAlu(Opcode op) {
+    return op == Opcode::ADD || op == Opcode::SUB || op == Opcode::AND || op == Opcode::OR || op == Opcode::XOR;
+}
+
+u32 alu(Opcode op, u32 a, u32 b) {
+    switch (op) {
+        case Opcode::ADD: return a + b;
+        case Opcode::SUB: return a - b;
+        case Opcode::AND: return a & b;
+        case Opcode::OR:  return a | b;
+        default:          return a ^ b;
+    }
+}
+
+// Pick the fusion for an instruction followed by `next`. Only pairs whose
+// register operands are all valid are fused, so fused handlers never fault on
+// decoding; runtime conditions (stack bounds) are re-checked when executing.
+Fusion classifyPair(const DecodedInst& first, const DecodedInst& next, std::size_t regCount) {
+    auto ok = [&](u8 r) { return r < regCount; };
+    switch (first.op) {
+        case Opcode::CMP:
+            if (!ok(first.a) || !ok(first.b)) return Fusion::None;
+            if (next.op == Opcode::JZ) return Fusion::CmpJz;
+            if (next.op == Opcode::JNZ) return Fusion::CmpJnz;
+            return Fusion::None;
+        case Opcode::LOADI:
+            if (ok(first.a) && isAlu(next.op) && ok(next.a) && ok(next.b) && ok(next.c)) return Fusion::LoadiAlu;
+            return Fusion::None;
+        case Opcode::PUSH:
+            return ok(first.a) && next.op == Opcode::PUSH && ok(next.a) ? Fusion::PushPush : Fusion::None;
+        case Opcode::POP:
+            return ok(first.a) && next.op == Opcode::POP && ok(next.a) ? Fusion::PopPop : Fusion::None;
+        default:
+            return Fusion::None;
+    }
+}
+
+bool mayFuse(Opcode op) {
+    return op == Opcode::CMP || op == Opcode::LOADI || op == Opcode::PUSH || op == Opcode::POP;
+}
+
+} // namespace
+
+u64 PerfCounters::totalRetired() const {
+    u64 sum = 0;
+    for (u64 n : retired) sum += n;
+    return sum;
+}
+
+u64 PerfCounters::loads() const {
+    return retired[static_cast<u8>(Opcode::LOAD)] + retired[static_cast<u8>(Opcode::POP)] +
+           retired[static_cast<u8>(Opcode::RET)];
+}
+
+u64 PerfCounters::stores() const {
+    return retired[static_cast<u8>(Opcode::STORE)] + retired[static_cast<u8>(Opcode::PUSH)] +
+           retired[static_cast<u8>(Opcode::CALL)];
+}
+
+void PerfCounters::clear(u32 sp) {
+    retired.fill(0);
+    branchesTaken = branchesNotTaken = 0;
+    stackTop = stackLow = sp;
+    runNanos = 0;
+    deviceAccesses.clear();
+}
+
 void SimpleCPU::log(const char* level, const char* msg) {
     if (!m_logger) return;
+    if (m_trace && level[0] == 'i') return; // the trace already records every instruction
     std::ostringstream os;
     os << "PC=" << m_pc << " SP=" << m_sp << " | " << msg;
     if (std::string(level) == "info") m_logger->info(os.str());
@@ -18,30 +131,290 @@ void SimpleCPU::log(const char* level, const char* msg) {
 }
 
 SimpleCPU::SimpleCPU(IMemory& mem, ILogger* logger)
-    : m_mem(mem), m_logger(logger) {
+    : m_mem(mem), m_memKind(MemKind::Generic), m_logger(logger) {
+    // Exact type match: a subclass may override the accessors the fast paths skip.
+    if (typeid(mem) == typeid(BusMemory)) m_memKind = MemKind::Bus;
+    else if (typeid(mem) == typeid(RamMemory)) m_memKind = MemKind::Ram;
+    if (m_memKind == MemKind::Bus) {
+        static_cast<BusMemory&>(mem).setWatchHandler([this](const WatchHit& hit) { onWatch(hit); });
+    }
     reset();
 }
 
+SimpleCPU::~SimpleCPU() {
+    if (m_memKind == MemKind::Bus) static_cast<BusMemory&>(m_mem).setWatchHandler(nullptr);
+}
+
+DecodedInst SimpleCPU::decode(u32 pc) {
+    m_decoding = true;
+    try {
+        const DecodedInst di = m_decoder.decode(m_mem, pc);
+        m_decoding = false;
+        return di;
+    } catch (...) {
+        m_decoding = false;
+        throw;
+    }
+}
+
+void SimpleCPU::onWatch(const WatchHit& hit) {
+    if (m_decoding) return;
+    // Every engine updates the PC only after an instruction's memory accesses.
+    m_watchHit = hit;
+    m_watchHit.pc = m_pc;
+    m_watchPending = true;
+}
+
 void SimpleCPU::reset() {
     m_regs.fill(0);
     m_pc = 0;
     m_sp = static_cast<u32>(m_mem.size() - 4);
     m_flags = 0;
     m_halted = false;
+    m_faulted = false;
+    m_dcache.clear();
+    m_codeLo = std::numeric_limits<std::size_t>::max();
+    m_codeHi = 0;
+    m_fusionHits.fill(0);
+    m_perf.clear(m_sp);
+    if (m_memKind == MemKind::Bus) static_cast<BusMemory&>(m_mem).clearDeviceAccesses();
+}
+
+void SimpleCPU::copyStateFrom(const SimpleCPU& other) {
+    m_regs = other.m_regs;
+    m_pc = other.m_pc;
+    m_sp = other.m_sp;
+    m_flags = other.m_flags;
+    m_halted = other.m_halted;
+    m_faulted = other.m_faulted;
+    m_breakMap.clear();
+    m_breakMap.resize(other.m_breakMap.size());
+    for (std::size_t p = 0; p < other.m_breakMap.size(); ++p) {
+        if (other.m_breakMap[p]) m_breakMap[p] = std::make_unique<std::bitset<BREAK_PAGE_SIZE>>(*other.m_breakMap[p]);
+    }
+    m_breakCount = other.m_breakCount;
+    m_dcache = other.m_dcache;
+    m_codeLo = other.m_codeLo;
+    m_codeHi = other.m_codeHi;
 }
 
-void SimpleCPU::run(std::size_t maxSteps) {
+PerfCounters SimpleCPU::perfCounters() const {
+    PerfCounters perf = m_perf;
+    if (m_memKind == MemKind::Bus) {
+        const BusMemory& bus = static_cast<const BusMemory&>(m_mem);
+        for (std::size_t i = 0; i < bus.mappings().size(); ++i) perf.deviceAccesses.push_back(bus.deviceAccesses(i));
+    }
+    return perf;
+}
+
+void SimpleCPU::invalidateCode(std::size_t addr, std::size_t len) {
+    m_dcache.invalidate(addr, len);
+}
+
+void SimpleCPU::setBreakpoint(u32 addr, bool enabled) {
+    const std::size_t page = addr >> BREAK_PAGE_BITS;
+    if (page >= m_breakMap.size()) {
+        if (!enabled) return;
+        m_breakMap.resize(std::max(page + 1, (m_mem.size() + BREAK_PAGE_SIZE - 1) >> BREAK_PAGE_BITS));
+    }
+    auto& bits = m_breakMap[page];
+    if (!bits) {
+        if (!enabled) return;
+        bits = std::make_unique<std::bitset<BREAK_PAGE_SIZE>>();
+    }
+    const std::size_t bit = addr & (BREAK_PAGE_SIZE - 1);
+    if (bits->test(bit) == enabled) return;
+    bits->set(bit, enabled);
+    if (enabled) ++m_breakCount;
+    else --m_breakCount;
+}
+
+void SimpleCPU::out(u32 value) {
+    if (m_console) m_console->writeValue(value);
+    else std::cout << value << std::endl;
+}
+
+bool SimpleCPU::in(u32& value) {
+    if (m_console) m_console->sync(); // pending output (prompts) must appear before blocking on input
+    std::int64_t input = 0;
+    if (!(*(m_input ? m_input : &std::cin) >> input)) return false;
+    value = static_cast<u32>(input);
+    return true;
+}
+
+RunOutcome SimpleCPU::run(std::size_t maxSteps) {
+    PerfRunClock clock(m_perf);
+    switch (m_memKind) {
+        case MemKind::Bus: return runWith(BusAccess{static_cast<BusMemory&>(m_mem)}, maxSteps);
+        case MemKind::Ram: return runWith(RamAccess{static_cast<RamMemory&>(m_mem)}, maxSteps);
+        default: return runWith(GenericAccess{m_mem}, maxSteps);
+    }
+}
+
+template <class Mem>
+RunOutcome SimpleCPU::runWith(Mem mem, std::size_t maxSteps) {
+    // Logged and traced runs keep one entry per instruction, so they never fuse;
+    // watched runs don't either, so a hit names the exact instruction.
+    const bool watches = hasWatches();
+    const bool fuse = m_logger == nullptr && m_trace == nullptr && !watches;
+    const bool breaks = hasBreakpoints();
+    const bool debug = breaks || watches;
+    ExecutionProfile* const profile = m_profile;
+    m_watchPending = false;
     std::size_t steps = 0;
     while (!m_halted) {
-        step();
-        if (maxSteps && ++steps >= maxSteps) break;
+        const u32 pc = m_pc;
+        if (debug) {
+            if (m_watchPending) return RunOutcome::Watchpoint;
+            if (steps && isBreakpoint(pc)) return RunOutcome::Breakpoint;
+        }
+        // Copy: executing a store may invalidate the cache entry we came from.
+        const CachedInst ci = fetch();
+        std::size_t retired = 0;
+        // A pair is not fused across a breakpoint on its second instruction.
+        if (fuse && ci.fusion != Fusion::None && (!maxSteps || maxSteps - steps >= 2) &&
+            !(breaks && isBreakpoint(pc + ci.inst.size))) {
+            retired = executeFused(mem, ci);
+        }
+        if (!retired) {
+            execute(mem, ci.inst);
+            if (m_trace) traceRetired(pc, ci.inst);
+            retired = 1;
+        } else if (retired == 2) {
+            perfRetired(ci.next.op);
+        }
+        perfRetired(ci.inst.op);
+        if (profile) {
+            profile->hit(pc);
+            if (retired == 2) profile->hit(pc + ci.inst.size);
+        }
+        steps += retired;
+        if (maxSteps && steps >= maxSteps) break;
     }
+    return outcome(false);
+}
+
+const CachedInst& SimpleCPU::fetch() {
+    if (const CachedInst* hit = m_dcache.lookup(m_pc)) return *hit;
+    CachedInst ci;
+    ci.inst = decode(m_pc);
+    // Peek at the fall-through instruction; these opcodes always continue there
+    // unless they fault, so no bytes are read that execution would not read.
+    const u32 nextPc = m_pc + ci.inst.size;
+    if (mayFuse(ci.inst.op) && nextPc < m_mem.size()) {
+        try {
+            ci.next = decode(nextPc);
+            ci.fusion = classifyPair(ci.inst, ci.next, REG_COUNT);
+        } catch (const std::exception&) {
+            ci.fusion = Fusion::None; // undecodable successor: it faults when reached
+        }
+    }
+    const CachedInst& entry = m_dcache.insert(m_pc, ci);
+    markCode(m_pc, entry.span());
+    return entry;
+}
+
+template <class Mem>
+std::size_t SimpleCPU::executeFused(Mem mem, const CachedInst& ci) {
+    const DecodedInst& a = ci.inst;
+    const DecodedInst& b = ci.next;
+    auto setZ = [&](u32 val){
+        if (val == 0) m_flags |= 0x1; else m_flags &= ~0x1u;
+    };
+    switch (ci.fusion) {
+        case Fusion::CmpJz:
+        case Fusion::CmpJnz: {
+            const bool equal = m_regs[a.a] == m_regs[a.b];
+            setZ(equal ? 0 : 1); // Z=1 if equal
+            const bool taken = ci.fusion == Fusion::CmpJz ? equal : !equal;
+            m_pc = taken ? b.imm : m_pc + a.size + b.size;
+            perfBranch(taken);
+            break;
+        }
+        case Fusion::LoadiAlu: {
+            m_regs[a.a] = a.imm;
+            const u32 res = alu(b.op, m_regs[b.b], m_regs[b.c]);
+            m_regs[b.a] = res;
+            setZ(res);
+            m_pc += a.size + b.size;
+            break;
+        }
+        case Fusion::PushPush: {
+            if (m_sp < 8) return 0;
+            const u32 pc = m_pc;
+            m_sp -= 4;
+            mem.write32(m_sp, m_regs[a.a]);
+            noteWrite(m_sp, 4);
+            m_pc += a.size;
+            // The first push overwrote the second instruction: let it be re-decoded.
+            if (m_sp < pc + ci.span() && m_sp + 4 > m_pc) {
+                perfStack();
+                return 1;
+            }
+            m_sp -= 4;
+            mem.write32(m_sp, m_regs[b.a]);
+            noteWrite(m_sp, 4);
+            m_pc += b.size;
+            perfStack();
+            break;
+        }
+        case Fusion::PopPop: {
+            if (static_cast<std::size_t>(m_sp) + 8 > mem.size()) return 0;
+            m_regs[a.a] = mem.read32(m_sp);
+            m_regs[b.a] = mem.read32(m_sp + 4);
+            m_sp += 8;
+            setZ(m_regs[b.a]);
+            m_pc += a.size + b.size;
+            break;
+        }
+        default:
+            return 0;
+    }
+    ++m_fusionHits[static_cast<std::size_t>(ci.fusion)];
+    return 2;
 }
 
 void SimpleCPU::step() {
-    SimpleDecoder decoder;
-    auto di = decoder.decode(m_mem, m_pc);
+    const u32 pc = m_pc;
+    // Copy: executing a store may invalidate the cache entry we came from.
+    const DecodedInst di = fetch().inst;
+    switch (m_memKind) {
+        case MemKind::Bus: execute(BusAccess{static_cast<BusMemory&>(m_mem)}, di); break;
+        case MemKind::Ram: execute(RamAccess{static_cast<RamMemory&>(m_mem)}, di); break;
+        default: execute(GenericAccess{m_mem}, di); break;
+    }
+    if (m_trace) traceRetired(pc, di);
+    if (m_profile) m_profile->hit(pc);
+    perfRetired(di.op);
+}
+
+void SimpleCPU::traceRetired(u32 pc, const DecodedInst& di) {
+    TraceRecord rec;
+    rec.pc = pc;
+    rec.imm = di.imm;
+    rec.op = static_cast<u8>(di.op);
+    rec.a = di.a;
+    rec.b = di.b;
+    rec.c = di.c;
+    switch (di.op) {
+        case Opcode::LOADI: case Opcode::LOAD: case Opcode::POP: case Opcode::IN:
+        case Opcode::ADD: case Opcode::SUB: case Opcode::AND: case Opcode::OR: case Opcode::XOR:
+            if (!m_halted && di.a < REG_COUNT) {
+                rec.dstReg = di.a;
+                rec.dstValue = m_regs[di.a];
+            }
+            break;
+        default:
+            break;
+    }
+    rec.flags = static_cast<u8>(m_flags);
+    rec.halted = m_halted ? 1 : 0;
+    rec.sp = m_sp;
+    m_trace->push(rec);
+}
 
+template <class Mem>
+void SimpleCPU::execute(Mem mem, const DecodedInst& di) {
     auto setZ = [&](u32 val){
         if (val == 0) m_flags |= 0x1; else m_flags &= ~0x1u;
     };
@@ -54,14 +427,13 @@ void SimpleCPU::step() {
             if (rD < REG_COUNT && rS < REG_COUNT) {
                 u32 addr = m_regs[rS] + static_cast<u32>(di.imm & 0xFFFF);
                 // Little-endian 32-bit load
-                u32 val = m_mem.read32(addr);
+                u32 val = mem.read32(addr);
                 m_regs[rD] = val;
                 setZ(val);
                 m_pc += di.size;
                 log("info", "LOAD");
             } else {
-                log("error", "Invalid register in LOAD");
-                m_halted = true;
+                fault("Invalid register in LOAD");
             }
             break;
         }
@@ -72,12 +444,12 @@ void SimpleCPU::step() {
             if (rD < REG_COUNT && rS < REG_COUNT) {
                 u32 addr = m_regs[rD] + static_cast<u32>(di.imm & 0xFFFF);
                 u32 val = m_regs[rS];
-                m_mem.write32(addr, val);
+                mem.write32(addr, val);
+                noteWrite(addr, 4);
                 m_pc += di.size;
                 log("info", "STORE");
             } else {
-                log("error", "Invalid register in STORE");
-                m_halted = true;
+                fault("Invalid register in STORE");
             }
             break;
         }
@@ -94,8 +466,7 @@ void SimpleCPU::step() {
                 m_pc += di.size;
                 log("info", "LOADI");
             } else {
-                log("error", "Invalid register in LOADI");
-                m_halted = true;
+                fault("Invalid register in LOADI");
             }
             break;
         }
@@ -121,8 +492,7 @@ void SimpleCPU::step() {
                 m_pc += di.size;
                 log("info", "ALU");
             } else {
-                log("error", "Invalid register in ALU op");
-                m_halted = true;
+                fault("Invalid register in ALU op");
             }
             break;
         }
@@ -134,8 +504,7 @@ void SimpleCPU::step() {
                 m_pc += di.size;
                 log("info", "CMP");
             } else {
-                log("error", "Invalid register in CMP");
-                m_halted = true;
+                fault("Invalid register in CMP");
             }
             break;
         }
@@ -145,6 +514,7 @@ void SimpleCPU::step() {
             break;
         }
         case Opcode::JZ: {
+            perfBranch(m_flags & 0x1);
             if (m_flags & 0x1) {
                 m_pc = di.imm;
             } else {
@@ -154,6 +524,7 @@ void SimpleCPU::step() {
             break;
         }
         case Opcode::JNZ: {
+            perfBranch(!(m_flags & 0x1));
             if (!(m_flags & 0x1)) {
                 m_pc = di.imm;
             } else {
@@ -166,26 +537,26 @@ void SimpleCPU::step() {
             const u8 rS = di.a;
             if (rS < REG_COUNT && m_sp >= 4) {
                 m_sp -= 4;
-                m_mem.write32(m_sp, m_regs[rS]);
+                mem.write32(m_sp, m_regs[rS]);
+                noteWrite(m_sp, 4);
+                perfStack();
                 m_pc += di.size;
                 log("info", "PUSH");
             } else {
-                log("error", "Stack overflow in PUSH");
-                m_halted = true;
+                fault("Stack overflow in PUSH");
             }
             break;
         }
         case Opcode::POP: {
             const u8 rD = di.a;
-            if (rD < REG_COUNT && m_sp + 4 <= m_mem.size()) {
-                m_regs[rD] = m_mem.read32(m_sp);
+            if (rD < REG_COUNT && m_sp + 4 <= mem.size()) {
+                m_regs[rD] = mem.read32(m_sp);
                 m_sp += 4;
                 setZ(m_regs[rD]);
                 m_pc += di.size;
                 log("info", "POP");
             } else {
-                log("error", "Stack underflow in POP");
-                m_halted = true;
+                fault("Stack underflow in POP");
             }
             break;
         }
@@ -194,60 +565,56 @@ void SimpleCPU::step() {
             if (m_sp >= 4) {
                 u32 ret = m_pc + di.size;
                 m_sp -= 4;
-                m_mem.write32(m_sp, ret);
+                mem.write32(m_sp, ret);
+                noteWrite(m_sp, 4);
+                perfStack();
                 m_pc = di.imm;
                 log("info", "CALL");
             } else {
-                log("error", "Stack overflow in CALL");
-                m_halted = true;
+                fault("Stack overflow in CALL");
             }
             break;
         }
         case Opcode::RET: {
-            if (m_sp + 4 <= m_mem.size()) {
-                u32 ret = m_mem.read32(m_sp);
+            if (m_sp + 4 <= mem.size()) {
+                u32 ret = mem.read32(m_sp);
                 m_sp += 4;
                 m_pc = ret;
                 log("info", "RET");
             } else {
-                log("error", "Stack underflow in RET");
-                m_halted = true;
+                fault("Stack underflow in RET");
             }
             break;
         }
         case Opcode::OUT: {
             if (di.a < REG_COUNT) {
                 // OUT to host stdout
-                std::cout << m_regs[di.a] << std::endl;
+                out(m_regs[di.a]);
                 m_pc += di.size;
                 log("info", "OUT");
             } else {
-                log("error", "Invalid register in OUT");
-                m_halted = true;
+                fault("Invalid register in OUT");
             }
             break;
         }
         case Opcode::IN: {
             if (di.a < REG_COUNT) {
-                std::int64_t input = 0;
-                if (!(std::cin >> input)) {
-                    log("error", "IN failed to read from stdin");
-                    m_halted = true;
+                u32 input = 0;
+                if (!in(input)) {
+                    fault("IN failed to read from stdin");
                     break;
                 }
-                m_regs[di.a] = static_cast<u32>(input);
+                m_regs[di.a] = input;
                 setZ(m_regs[di.a]);
                 m_pc += di.size;
                 log("info", "IN");
             } else {
-                log("error", "Invalid register in IN");
-                m_halted = true;
+                fault("Invalid register in IN");
             }
             break;
         }
         default: {
-            log("error", "Unimplemented opcode encountered");
-            m_halted = true;
+            fault("Unimplemented opcode encountered");
             break;
         }
     }
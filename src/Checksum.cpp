@@ -0,0 +1,205 @@
+#include "vm/Checksum.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define VM_ADLER_SSE2 1
+#include <emmintrin.h>
+#else
+#define VM_ADLER_SSE2 0
+#endif
+
+#if VM_ADLER_SSE2 && (defined(__GNUC__) || defined(__clang__))
+#define VM_ADLER_AVX2 1
+#include <immintrin.h>
+#else
+#define VM_ADLER_AVX2 0
+#endif
+
+namespace vm {
+
+namespace {
+
+constexpr std::uint32_t MOD_ADLER = 65521;
+// Largest n such that 255 n (n + 1) / 2 + (n + 1) (MOD_ADLER - 1) fits in
+// 32 bits: the sums may go this long without a modulo.
+constexpr std::size_t NMAX = 5552;
+// Chunks below this are not worth a thread.
+constexpr std::size_t PARALLEL_CHUNK = std::size_t{1} << 20;
+
+void scalarBlock(const unsigned char* p, std::size_t n, std::uint32_t& a, std::uint32_t& b) {
+    for (std::size_t i = 0; i < n; ++i) {
+        a += p[i];
+        b += a;
+    }
+}
+
+#if VM_ADLER_SSE2
+// n is a multiple of 16 and at most NMAX; a, b are already reduced.
+// Over k chunks, b grows by n*a + 16 * sum(prefix sums of the chunk totals)
+// + sum(weighted bytes of each chunk with weights 16..1).
+void sse2Block(const unsigned char* p, std::size_t n, std::uint32_t& a, std::uint32_t& b) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i wLo = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+    const __m128i wHi = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+    __m128i vSum = zero;      // byte totals, two u64 lanes
+    __m128i vPrefix = zero;   // sum of vSum before each chunk, two u64 lanes
+    __m128i vWeighted = zero; // four u32 lanes
+    for (std::size_t i = 0; i < n; i += 16) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+        vPrefix = _mm_add_epi64(vPrefix, vSum);
+        vSum = _mm_add_epi64(vSum, _mm_sad_epu8(x, zero));
+        vWeighted = _mm_add_epi32(vWeighted, _mm_madd_epi16(_mm_unpacklo_epi8(x, zero), wLo));
+        vWeighted = _mm_add_epi32(vWeighted, _mm_madd_epi16(_mm_unpackhi_epi8(x, zero), wHi));
+    }
+    alignas(16) std::uint64_t s[2], ps[2];
+    alignas(16) std::uint32_t w[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(s), vSum);
+    _mm_store_si128(reinterpret_cast<__m128i*>(ps), vPrefix);
+    _mm_store_si128(reinterpret_cast<__m128i*>(w), vWeighted);
+    const std::uint64_t sum = s[0] + s[1];
+    const std::uint64_t weighted = std::uint64_t{w[0]} + w[1] + w[2] + w[3];
+    b = static_cast<std::uint32_t>((b + std::uint64_t{n} * a + 16 * (ps[0] + ps[1]) + weighted) % MOD_ADLER);
+    a = static_cast<std::uint32_t>((a + sum) % MOD_ADLER);
+}
+#endif
+
+#if VM_ADLER_AVX2
+// As sse2Block with 32-byte chunks; n is a multiple of 32.
+__attribute__((target("avx2")))
+void avx2Block(const unsigned char* p, std::size_t n, std::uint32_t& a, std::uint32_t& b) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i weights = _mm256_setr_epi8(32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+                                             16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+    __m256i vSum = zero, vPrefix = zero, vWeighted = zero;
+    for (std::size_t i = 0; i < n; i += 32) {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        vPrefix = _mm256_add_epi64(vPrefix, vSum);
+        vSum = _mm256_add_epi64(vSum, _mm256_sad_epu8(x, zero));
+        vWeighted = _mm256_add_epi32(vWeighted, _mm256_madd_epi16(_mm256_maddubs_epi16(x, weights), ones));
+    }
+    alignas(32) std::uint64_t s[4], ps[4];
+    alignas(32) std::uint32_t w[8];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(s), vSum);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(ps), vPrefix);
+    _mm256_store_si256(reinterpret_cast<__m256i*>(w), vWeighted);
+    std::uint64_t sum = 0, prefix = 0, weighted = 0;
+    for (int i = 0; i < 4; ++i) { sum += s[i]; prefix += ps[i]; }
+    for (int i = 0; i < 8; ++i) weighted += w[i];
+    b = static_cast<std::uint32_t>((b + std::uint64_t{n} * a + 32 * prefix + weighted) % MOD_ADLER);
+    a = static_cast<std::uint32_t>((a + sum) % MOD_ADLER);
+}
+
+bool haveAvx2() {
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+}
+#endif
+
+} // namespace
+
+std::uint32_t adler32(const unsigned char* data, std::size_t len, std::uint32_t adler) {
+    std::uint32_t a = adler & 0xFFFF;
+    std::uint32_t b = adler >> 16;
+    while (len > 0) {
+        std::size_t n = std::min(len, NMAX);
+#if VM_ADLER_AVX2
+        if (haveAvx2() && n >= 32) {
+            n &= ~std::size_t{31};
+            avx2Block(data, n, a, b);
+            data += n;
+            len -= n;
+            continue;
+        }
+#endif
+#if VM_ADLER_SSE2
+        if (n >= 16) {
+            n &= ~std::size_t{15};
+            sse2Block(data, n, a, b);
+            data += n;
+            len -= n;
+            continue;
+        }
+#endif
+        scalarBlock(data, n, a, b);
+        a %= MOD_ADLER;
+        b %= MOD_ADLER;
+        data += n;
+        len -= n;
+    }
+    return (b << 16) | a;
+}
+
+std::uint32_t adler32Combine(std::uint32_t adlerA, std::uint32_t adlerB, std::size_t lenB) {
+    const std::uint32_t rem = static_cast<std::uint32_t>(lenB % MOD_ADLER);
+    std::uint32_t a = adlerA & 0xFFFF;
+    std::uint32_t b = static_cast<std::uint32_t>((std::uint64_t{rem} * a) % MOD_ADLER);
+    a += (adlerB & 0xFFFF) + MOD_ADLER - 1;
+    b += (adlerA >> 16) + (adlerB >> 16) + MOD_ADLER - rem;
+    if (a >= MOD_ADLER) a -= MOD_ADLER;
+    if (a >= MOD_ADLER) a -= MOD_ADLER;
+    if (b >= 2 * MOD_ADLER) b -= 2 * MOD_ADLER;
+    if (b >= MOD_ADLER) b -= MOD_ADLER;
+    return (b << 16) | a;
+}
+
+std::uint32_t adler32Parallel(const unsigned char* data, std::size_t len, std::size_t threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, len / PARALLEL_CHUNK);
+    if (threads <= 1) return adler32(data, len);
+
+    const std::size_t chunk = (len + threads - 1) / threads;
+    std::vector<std::uint32_t> parts(threads, 1);
+    std::vector<std::thread> pool;
+    for (std::size_t t = 1; t < threads; ++t) {
+        const std::size_t begin = t * chunk;
+        const std::size_t size = std::min(chunk, len - begin);
+        pool.emplace_back([&parts, data, begin, size, t] { parts[t] = adler32(data + begin, size); });
+    }
+    parts[0] = adler32(data, chunk);
+    for (auto& th : pool) th.join();
+
+    std::uint32_t adler = parts[0];
+    for (std::size_t t = 1; t < threads; ++t) adler = adler32Combine(adler, parts[t], std::min(chunk, len - t * chunk));
+    return adler;
+}
+
+std::uint64_t contentHash64(const unsigned char* data, std::size_t len, std::uint64_t seed) {
+    constexpr std::uint64_t K0 = 0x9e3779b97f4a7c15ull;
+    constexpr std::uint64_t K1 = 0xbf58476d1ce4e5b9ull;
+    constexpr std::uint64_t K2 = 0x94d049bb133111ebull;
+    auto mix = [](std::uint64_t v) {
+        v = (v ^ (v >> 30)) * K1;
+        v = (v ^ (v >> 27)) * K2;
+        return v ^ (v >> 31);
+    };
+    auto word = [](const unsigned char* p) {
+        std::uint64_t v;
+        std::memcpy(&v, p, sizeof v);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        return v;
+    };
+    // Two independent lanes so the multiply chains overlap.
+    std::uint64_t a = seed ^ K0, b = seed + (len * K1);
+    std::size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        a = (a ^ mix(word(data + i))) * K0;
+        b = (b ^ mix(word(data + i + 8))) * K0;
+        a = (a << 31) | (a >> 33);
+    }
+    if (i + 8 <= len) {
+        a = (a ^ mix(word(data + i))) * K0;
+        i += 8;
+    }
+    std::uint64_t tail = 0;
+    for (unsigned shift = 0; i < len; ++i, shift += 8) tail |= static_cast<std::uint64_t>(data[i]) << shift;
+    return mix(a ^ mix(b ^ tail ^ len));
+}
+
+} // namespace vm
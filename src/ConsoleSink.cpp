@@ -0,0 +1,95 @@
+#include "vm/ConsoleSink.hpp"
+
+#include <charconv>
+#include <ostream>
+
+namespace vm {
+
+ConsoleSink::ConsoleSink(std::ostream& out, Mode mode)
+    : m_out(out), m_mode(mode) {
+    m_cur.reserve(BUFFER_SIZE);
+}
+
+ConsoleSink::~ConsoleSink() {
+    sync();
+    if (m_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cv.notify_all();
+        m_writer.join();
+    }
+}
+
+void ConsoleSink::writeValue(u32 value) {
+    char text[16];
+    auto res = std::to_chars(text, text + sizeof(text) - 1, value);
+    *res.ptr++ = '\n';
+    const std::size_t len = static_cast<std::size_t>(res.ptr - text);
+    if (m_mode == Mode::Sync) {
+        m_out.write(text, static_cast<std::streamsize>(len));
+        m_out.flush();
+        return;
+    }
+    if (m_cur.size() + len > BUFFER_SIZE) submit();
+    m_cur.insert(m_cur.end(), text, text + len);
+}
+
+void ConsoleSink::submit() {
+    if (m_cur.empty()) return;
+    if (!m_writer.joinable()) m_writer = std::thread([this] { writerLoop(); });
+    const std::size_t head = m_head.load(std::memory_order_relaxed);
+    if (head - m_tail.load(std::memory_order_acquire) == QUEUE_DEPTH) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cv.wait(lock, [&] { return head - m_tail.load(std::memory_order_acquire) < QUEUE_DEPTH; });
+    }
+    m_slots[head % QUEUE_DEPTH].swap(m_cur);
+    m_cur.clear();
+    m_head.store(head + 1, std::memory_order_release);
+    { std::lock_guard<std::mutex> lock(m_mutex); } // pairs with the writer's predicate check
+    m_cv.notify_all();
+}
+
+void ConsoleSink::sync() {
+    if (m_mode == Mode::Sync) return;
+    if (!m_writer.joinable()) {
+        // No buffer was handed off yet, so this thread still owns the stream.
+        if (!m_cur.empty()) {
+            m_out.write(m_cur.data(), static_cast<std::streamsize>(m_cur.size()));
+            m_cur.clear();
+        }
+        m_out.flush();
+        return;
+    }
+    submit();
+    const std::size_t head = m_head.load(std::memory_order_relaxed);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&] { return m_tail.load(std::memory_order_acquire) == head; });
+}
+
+void ConsoleSink::writerLoop() {
+    for (;;) {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [&] { return m_stop || m_head.load(std::memory_order_acquire) != tail; });
+            if (m_head.load(std::memory_order_acquire) == tail) return; // stopping and drained
+        }
+        const std::size_t head = m_head.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            const std::vector<char>& buf = m_slots[tail % QUEUE_DEPTH];
+            m_out.write(buf.data(), static_cast<std::streamsize>(buf.size()));
+        }
+        // Publish only after flushing: once sync() sees tail == head the
+        // output is on the stream and the writer no longer touches it.
+        m_out.flush();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_tail.store(tail, std::memory_order_release);
+        }
+        m_cv.notify_all();
+    }
+}
+
+} // namespace vm
@@ -1,8 +1,16 @@
 #include "vm/Instance.hpp"
 #include "vm/ProgramLoader.hpp"
+#include "vm/MappedFile.hpp"
 #include "vm/ConsoleDevice.hpp"
+#include "vm/ThreadedCPU.hpp"
+#include "vm/JitCPU.hpp"
 
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <iostream>
 #include <stdexcept>
 #include <sstream>
 
@@ -10,16 +18,77 @@ namespace vm {
 
 VMInstance::VMInstance(const VMConfig& cfg, ILogger* logger)
     : m_cfg(cfg), m_logger(logger) {
+    // With a logger attached, console values must interleave with log lines, so
+    // write through. Caller-provided (typically in-memory) streams gain nothing
+    // from a writer thread either.
+    const bool writeThrough = m_logger != nullptr || m_cfg.consoleOut != nullptr;
+    m_console = std::make_unique<ConsoleSink>(m_cfg.consoleOut ? *m_cfg.consoleOut : std::cout,
+                                              writeThrough ? ConsoleSink::Mode::Sync : ConsoleSink::Mode::Async);
     // Initialize memory and CPU on construction
-    m_mem = std::make_unique<RamMemory>(m_cfg.memSize);
+    m_mem = std::make_unique<RamMemory>(m_cfg.memSize, m_cfg.memBackend);
     // Create bus and map default devices
     m_bus = std::make_unique<BusMemory>(*m_mem);
     // Map a ConsoleOut device near the top of RAM (reserve last 256 bytes for devices)
     std::size_t consoleBase = (m_cfg.memSize >= 256) ? (m_cfg.memSize - 256) : 0;
-    auto console = std::make_shared<ConsoleOutDevice>(m_logger);
-    m_bus->mapDevice(consoleBase, console);
+    m_consoleDevice = std::make_shared<ConsoleOutDevice>(m_logger, m_console.get());
+    m_bus->mapDevice(consoleBase, m_consoleDevice);
+    createCpu();
+}
+
+VMInstance::VMInstance(const VMInstance& parent, const VMConfig& cfg)
+    : m_cfg(cfg), m_logger(parent.m_logger) {
+    const bool writeThrough = m_logger != nullptr || m_cfg.consoleOut != nullptr;
+    m_console = std::make_unique<ConsoleSink>(m_cfg.consoleOut ? *m_cfg.consoleOut : std::cout,
+                                              writeThrough ? ConsoleSink::Mode::Sync : ConsoleSink::Mode::Async);
+    m_mem = parent.m_mem->fork();
+    m_bus = std::make_unique<BusMemory>(*m_mem);
+    // Same device layout; only the console is rebound to the child's sink.
+    for (const DeviceMapping& map : parent.m_bus->mappings()) {
+        if (map.device == parent.m_consoleDevice) {
+            m_consoleDevice = std::make_shared<ConsoleOutDevice>(m_logger, m_console.get());
+            m_bus->mapDevice(map.base, m_consoleDevice);
+        } else {
+            m_bus->mapDevice(map.base, map.device);
+        }
+    }
+    for (const Watchpoint& w : parent.m_bus->watches()) m_bus->addWatch(w.base, w.size, w.kind);
+    createCpu();
+    m_cpu->copyStateFrom(*parent.m_cpu);
+    m_breakpoints = parent.m_breakpoints;
+}
+
+std::unique_ptr<VMInstance> VMInstance::fork(std::ostream* consoleOut, std::istream* consoleIn) {
+    // Pending parent output must not end up after the child's.
+    m_console->sync();
+    VMConfig cfg = m_cfg;
+    cfg.consoleOut = consoleOut;
+    cfg.consoleIn = consoleIn;
+    return std::unique_ptr<VMInstance>(new VMInstance(*this, cfg));
+}
+
+void VMInstance::createCpu() {
     // CPU runs against the bus (so device mappings are visible)
-    m_cpu = std::make_unique<SimpleCPU>(*m_bus, m_logger);
+    switch (m_cfg.engine) {
+        case CpuEngine::Threaded:
+            m_cpu = std::make_unique<ThreadedCPU>(*m_bus, m_logger);
+            break;
+        case CpuEngine::Jit:
+            m_cpu = std::make_unique<JitCPU>(*m_bus, m_logger);
+            break;
+        case CpuEngine::Interpreter:
+        default:
+            m_cpu = std::make_unique<SimpleCPU>(*m_bus, m_logger);
+            break;
+    }
+    m_cpu->setConsole(m_console.get(), m_cfg.consoleIn);
+    if (m_cfg.traceRecords > 0) {
+        m_trace = std::make_unique<TraceBuffer>(m_cfg.traceRecords);
+        m_cpu->setTrace(m_trace.get());
+    }
+    if (m_cfg.profile) {
+        m_profile = std::make_unique<ExecutionProfile>();
+        m_cpu->setProfile(m_profile.get());
+    }
 }
 
 void VMInstance::powerOn() {
@@ -31,91 +100,113 @@ void VMInstance::powerOn() {
 
 void VMInstance::attachRamDisk(const std::string& path) {
     if (!m_mem) throw std::runtime_error("Memory not initialized");
-    // Load file bytes
-    auto bytes = loadBinaryFile(path);
-    if (bytes.empty()) {
+    // Map the file; its bytes are copied straight into guest RAM
+    MappedFile image(path);
+    if (image.size() == 0) {
         if (m_logger) m_logger->warn("attachRamDisk: empty image, skipping");
         return;
     }
     // Reserve last 256 bytes for devices (e.g., console)
     const std::size_t reserved = (m_mem->size() >= 256) ? 256 : 0;
-    if (bytes.size() + reserved > m_mem->size()) {
+    if (image.size() + reserved > m_mem->size()) {
         throw std::runtime_error("attachRamDisk: image too large for memory");
     }
     // Place at the end of RAM below the reserved device region
-    std::size_t base = m_mem->size() - reserved - bytes.size();
-    for (std::size_t i = 0; i < bytes.size(); ++i) {
-        m_mem->write8(base + i, bytes[i]);
-    }
+    std::size_t base = m_mem->size() - reserved - image.size();
+    m_mem->writeBytes(base, image.data(), image.size());
+    m_cpu->invalidateCode(base, image.size());
     if (m_logger) {
         std::ostringstream os;
-        os << "attachRamDisk: loaded '" << path << "' at 0x" << std::hex << base << "-0x" << (base + bytes.size() - 1);
+        os << "attachRamDisk: loaded '" << path << "' at 0x" << std::hex << base << "-0x" << (base + image.size() - 1);
         m_logger->info(os.str());
     }
 }
 
 void VMInstance::loadProgramBytes(const std::vector<unsigned char>& bytes) {
-    if (!m_mem) throw std::runtime_error("Memory not initialized");
+    loadProgramImage(bytes.data(), bytes.size());
+}
 
-    // Check for optional header (v1 or v2)
-    std::vector<unsigned char> payload = bytes;
-    u32 entry = 0;
-    if (hasProgramHeader(bytes)) {
-        ProgramHeaderV1 v1{}; ProgramHeaderV2 v2{}; bool isV2 = false;
-        readAnyHeader(bytes, v1, v2, isV2);
-        payload = stripProgramHeader(bytes);
-        entry = isV2 ? v2.entry : v1.entry;
-        // Optional strict verification can be enabled later via CLI flag
-        verifyHeaderAndPayloadIfRequested(bytes, /*verify=*/false);
-    }
+void VMInstance::loadProgramImage(const unsigned char* data, std::size_t size) {
+    if (!m_mem) throw std::runtime_error("Memory not initialized");
 
-    if (payload.size() > m_mem->size()) throw std::runtime_error("Program too large for memory");
+    // Optional header (v1 or v2) is validated in place; the payload is not copied
+    const ProgramImage img = parseProgramImage(data, size);
+    if (img.payloadSize > m_mem->size()) throw std::runtime_error("Program too large for memory");
 
     // load at address 0
-    auto& raw = m_mem->raw();
-    std::fill(raw.begin(), raw.end(), 0);
-    std::copy(payload.begin(), payload.end(), raw.begin());
+    m_mem->zero();
+    m_mem->writeBytes(0, img.payload, img.payloadSize);
 
     // reset CPU, then set entry if provided
     m_cpu->reset();
-    if (entry != 0) {
-        m_cpu->setPC(entry);
-    }
-}
-
-void VMInstance::runUntilHalt() {
-    if (m_breakpoints.empty()) {
-        m_cpu->run(0);
-    } else {
-        // Run step-by-step to honor breakpoints
-        // Note: no direct halted state; this will run until hitting a breakpoint.
-        // For now, we execute a generous number of steps.
-        const std::size_t maxSteps = 10'000'000; // safety cap
-        for (std::size_t i = 0; i < maxSteps; ++i) {
-            if (hitBreakpoint(m_cpu->getPC())) break;
-            m_cpu->step();
-        }
+    if (img.entry != 0) {
+        m_cpu->setPC(img.entry);
     }
 }
 
-void VMInstance::runSteps(std::size_t steps) {
-    if (steps == 0) { runUntilHalt(); return; }
-    for (std::size_t i = 0; i < steps; ++i) {
-        if (hitBreakpoint(m_cpu->getPC())) break;
-        m_cpu->step();
-    }
+void VMInstance::loadProgramFile(const std::string& path, bool verify) {
+    MappedFile image(path);
+    verifyHeaderAndPayloadIfRequested(image.data(), image.size(), verify);
+    loadProgramImage(image.data(), image.size());
+}
+
+AssembledProgram VMInstance::loadAssembly(const std::string& source, const std::string& entry) {
+    AssembledProgram prog = assemble(source);
+    loadProgramBytes(prog.image(entry.empty() ? 0 : prog.address(entry)));
+    return prog;
+}
+
+namespace {
+
+// Flushes guest console output when a run returns, including by exception.
+struct ConsoleSyncGuard {
+    ConsoleSink& console;
+    ~ConsoleSyncGuard() { console.sync(); }
+};
+
+} // namespace
+
+void VMInstance::syncConsole() {
+    m_console->sync();
+}
+
+RunOutcome VMInstance::runUntilHalt() {
+    ConsoleSyncGuard guard{*m_console};
+    return m_cpu->run(0);
+}
+
+RunOutcome VMInstance::runSteps(std::size_t steps) {
+    ConsoleSyncGuard guard{*m_console};
+    return m_cpu->run(steps);
+}
+
+ExecutionProfile* VMInstance::profile() {
+    if (m_profile) m_cpu->syncProfile();
+    return m_profile.get();
+}
+
+void VMInstance::writeTrace(const std::string& path) const {
+    if (!m_trace) throw std::runtime_error("Tracing is not enabled for this instance");
+    writeTraceFile(path, m_trace->records());
 }
 
 void VMInstance::addBreakpoint(u32 addr) {
     m_breakpoints.insert(addr);
+    m_cpu->setBreakpoint(addr, true);
 }
 
 void VMInstance::removeBreakpoint(u32 addr) {
     m_breakpoints.erase(addr);
+    m_cpu->setBreakpoint(addr, false);
 }
 
-bool VMInstance::hitBreakpoint(u32 pc) const {
-    return m_breakpoints.find(pc) != m_breakpoints.end();
+void VMInstance::addWatch(u32 addr, std::size_t len, WatchKind kind) {
+    if (len == 0 || addr + len > m_mem->size()) throw std::out_of_range("addWatch: range outside guest memory");
+    m_bus->addWatch(addr, len, kind);
+}
+
+void VMInstance::removeWatch(u32 addr, std::size_t len, WatchKind kind) {
+    m_bus->removeWatch(addr, len, kind);
 }
 
 std::vector<unsigned char> VMInstance::memRead(u32 addr, std::size_t len) const {
@@ -135,48 +226,232 @@ void VMInstance::memWrite(u32 addr, const std::vector<unsigned char>& bytes) {
     for (std::size_t i = 0; i < bytes.size(); ++i) {
         m_mem->write8(addr + i, bytes[i]);
     }
+    m_cpu->invalidateCode(addr, bytes.size());
 }
 
-void VMInstance::saveSnapshot(const std::string& path) const {
-    std::ofstream ofs(path, std::ios::binary);
-    if (!ofs) throw std::runtime_error("Failed to open snapshot for write: " + path);
+namespace {
 
-    // Magic
-    const char magic[4] = {'S','N','P','1'};
-    ofs.write(magic, 4);
-
-    // CPU state
-    u32 pc = m_cpu->getPC();
-    u32 sp = m_cpu->getSP();
-    u32 flags = m_cpu->getFlags();
-    ofs.write(reinterpret_cast<const char*>(&pc), sizeof(pc));
-    ofs.write(reinterpret_cast<const char*>(&sp), sizeof(sp));
-    ofs.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
-
-    // Registers
-    std::size_t rcount = m_cpu->regCount();
-    ofs.write(reinterpret_cast<const char*>(&rcount), sizeof(rcount));
-    for (std::size_t i = 0; i < rcount; ++i) {
-        u32 r = m_cpu->getReg(i);
-        ofs.write(reinterpret_cast<const char*>(&r), sizeof(r));
+// SNP2 layout, all fields little-endian:
+//   header: "SNP2", u32 flags, u64 memSize, u32 pageSize, u32 regCount
+//   frames: "FRME", u8 kind, 3 reserved bytes, u32 pc, u32 sp, u32 flags,
+//           u32 regs[regCount], u32 pageCount,
+//           pageCount x { u32 pageIndex, u32 length, length bytes }
+// A page stored with length == pageSize is raw, anything shorter is RLE.
+// The first frame is a base (RAM zeroed, then its pages applied); each
+// following delta frame holds the pages dirtied since the previous frame.
+// An image frame replaces the base with every page stored raw, in order,
+// starting at the next pageSize-aligned file offset after pageCount, so the
+// whole section can be mapped as guest RAM.
+constexpr char SNAPSHOT_MAGIC[4] = {'S', 'N', 'P', '2'};
+constexpr char FRAME_MAGIC[4] = {'F', 'R', 'M', 'E'};
+constexpr u32 SNAPSHOT_FLAG_RLE = 1u << 0;
+constexpr u8 FRAME_BASE = 0;
+constexpr u8 FRAME_DELTA = 1;
+constexpr u8 FRAME_IMAGE = 2;
+
+std::size_t alignToPage(std::size_t offset) {
+    return (offset + RamMemory::PAGE_SIZE - 1) & ~RamMemory::PAGE_MASK;
+}
+
+void putLE32(std::vector<u8>& out, u32 v) {
+    u8 b[4];
+    storeLE32(b, v);
+    out.insert(out.end(), b, b + 4);
+}
+
+u32 getLE32(std::istream& in) {
+    u8 b[4];
+    in.read(reinterpret_cast<char*>(b), 4);
+    if (in.gcount() != 4) throw std::runtime_error("Truncated snapshot");
+    return loadLE32(b);
+}
+
+// PackBits-style RLE: a control byte c < 128 is followed by c + 1 literal
+// bytes; c >= 128 repeats the following byte c - 125 times (3..130).
+void rleEncode(const u8* src, std::size_t len, std::vector<u8>& out) {
+    std::size_t i = 0;
+    while (i < len) {
+        std::size_t run = 1;
+        while (i + run < len && run < 130 && src[i + run] == src[i]) ++run;
+        if (run >= 3) {
+            out.push_back(static_cast<u8>(run + 125));
+            out.push_back(src[i]);
+            i += run;
+            continue;
+        }
+        const std::size_t start = i;
+        while (i < len && i - start < 128) {
+            if (i + 2 < len && src[i] == src[i + 1] && src[i] == src[i + 2]) break;
+            ++i;
+        }
+        out.push_back(static_cast<u8>(i - start - 1));
+        out.insert(out.end(), src + start, src + i);
+    }
+}
+
+void rleDecode(const u8* src, std::size_t len, u8* dst, std::size_t dstLen) {
+    std::size_t i = 0, o = 0;
+    while (i < len) {
+        const u8 c = src[i++];
+        const std::size_t n = c < 128 ? c + 1u : c - 125u;
+        if (o + n > dstLen || i + (c < 128 ? n : 1) > len) throw std::runtime_error("Corrupt snapshot page");
+        if (c < 128) {
+            std::memcpy(dst + o, src + i, n);
+            i += n;
+        } else {
+            std::memset(dst + o, src[i++], n);
+        }
+        o += n;
     }
+    if (o != dstLen) throw std::runtime_error("Corrupt snapshot page");
+}
+
+bool isZeroPage(const u8* p) {
+    return p[0] == 0 && std::memcmp(p, p + 1, RamMemory::PAGE_SIZE - 1) == 0;
+}
 
-    // Memory
-    std::size_t memSz = m_mem->size();
-    ofs.write(reinterpret_cast<const char*>(&memSz), sizeof(memSz));
-    ofs.write(reinterpret_cast<const char*>(m_mem->raw().data()), static_cast<std::streamsize>(memSz));
+// Base frames store every non-zero page, delta frames every dirty page and
+// image frames every page. `offset` is the file position of the frame.
+void writeFrame(std::ostream& out, std::size_t offset, u8 kind, bool rle, const ICPU& cpu, const RamMemory& mem) {
+    std::vector<u8> buf;
+    buf.insert(buf.end(), FRAME_MAGIC, FRAME_MAGIC + 4);
+    buf.push_back(kind);
+    buf.insert(buf.end(), 3, 0);
+    putLE32(buf, cpu.getPC());
+    putLE32(buf, cpu.getSP());
+    putLE32(buf, cpu.getFlags());
+    for (std::size_t i = 0; i < cpu.regCount(); ++i) putLE32(buf, cpu.getReg(i));
+    if (kind == FRAME_IMAGE) {
+        putLE32(buf, static_cast<u32>(mem.pageCount()));
+        buf.resize(alignToPage(offset + buf.size()) - offset, 0);
+        out.write(reinterpret_cast<const char*>(buf.data()), static_cast<std::streamsize>(buf.size()));
+        for (std::size_t p = 0; p < mem.pageCount(); ++p) {
+            out.write(reinterpret_cast<const char*>(mem.readPage(p)), static_cast<std::streamsize>(RamMemory::PAGE_SIZE));
+        }
+        return;
+    }
+    const std::size_t countAt = buf.size();
+    putLE32(buf, 0);
+    u32 count = 0;
+    std::vector<u8> packed;
+    for (std::size_t p = 0; p < mem.pageCount(); ++p) {
+        const u8* page = mem.readPage(p);
+        if (kind == FRAME_BASE ? mem.isZeroFill(p) || isZeroPage(page) : !mem.isDirty(p)) continue;
+        putLE32(buf, static_cast<u32>(p));
+        packed.clear();
+        if (rle) rleEncode(page, RamMemory::PAGE_SIZE, packed);
+        if (rle && packed.size() < RamMemory::PAGE_SIZE) {
+            putLE32(buf, static_cast<u32>(packed.size()));
+            buf.insert(buf.end(), packed.begin(), packed.end());
+        } else {
+            putLE32(buf, static_cast<u32>(RamMemory::PAGE_SIZE));
+            buf.insert(buf.end(), page, page + RamMemory::PAGE_SIZE);
+        }
+        ++count;
+    }
+    storeLE32(buf.data() + countAt, count);
+    out.write(reinterpret_cast<const char*>(buf.data()), static_cast<std::streamsize>(buf.size()));
+}
+
+struct SnapshotHeader {
+    u32 flags{0};
+    u64 memSize{0};
+    u32 pageSize{0};
+    u32 regCount{0};
+};
+
+// Reads the SNP2 header after the magic and checks it against this machine.
+SnapshotHeader readSnapshotHeader(std::istream& in, const RamMemory& mem, const ICPU& cpu) {
+    SnapshotHeader h;
+    h.flags = getLE32(in);
+    h.memSize = getLE32(in);
+    h.memSize |= static_cast<u64>(getLE32(in)) << 32;
+    h.pageSize = getLE32(in);
+    h.regCount = getLE32(in);
+    if (h.memSize != mem.size()) throw std::runtime_error("Snapshot memory size mismatch");
+    if (h.pageSize != RamMemory::PAGE_SIZE) throw std::runtime_error("Snapshot page size mismatch");
+    if (h.regCount != cpu.regCount()) throw std::runtime_error("Snapshot register count mismatch");
+    return h;
+}
+
+} // namespace
+
+void VMInstance::saveSnapshot(const std::string& path, SnapshotEncoding encoding) {
+    // Written aside and renamed into place: an instance restored from `path`
+    // may still have the old file mapped as its RAM.
+    const std::string tmpPath = path + ".tmp";
+    std::ofstream ofs(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!ofs) throw std::runtime_error("Failed to open snapshot for write: " + tmpPath);
+
+    const bool compress = encoding == SnapshotEncoding::Rle;
+    std::vector<u8> header(SNAPSHOT_MAGIC, SNAPSHOT_MAGIC + 4);
+    putLE32(header, compress ? SNAPSHOT_FLAG_RLE : 0);
+    const u64 memSz = m_mem->size();
+    putLE32(header, static_cast<u32>(memSz));
+    putLE32(header, static_cast<u32>(memSz >> 32));
+    putLE32(header, static_cast<u32>(RamMemory::PAGE_SIZE));
+    putLE32(header, static_cast<u32>(m_cpu->regCount()));
+    ofs.write(reinterpret_cast<const char*>(header.data()), static_cast<std::streamsize>(header.size()));
+
+    const u8 kind = encoding == SnapshotEncoding::Mappable ? FRAME_IMAGE : FRAME_BASE;
+    writeFrame(ofs, header.size(), kind, compress, *m_cpu, *m_mem);
+    ofs.close();
+    if (!ofs) throw std::runtime_error("Failed to write snapshot: " + tmpPath);
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        throw std::runtime_error("Failed to replace snapshot: " + path);
+    }
+    m_mem->clearDirty();
+    recordSnapshotFile(path);
+}
+
+void VMInstance::appendSnapshotDelta(const std::string& path) {
+    // The dirty pages are only a delta against the file last saved, appended
+    // to or loaded, and only if nothing else has written to it since.
+    std::error_code ec;
+    const std::uintmax_t size = std::filesystem::file_size(path, ec);
+    if (m_snapshotPath.empty() || std::filesystem::weakly_canonical(path, ec).string() != m_snapshotPath ||
+        size != m_snapshotSize) {
+        throw std::runtime_error("Snapshot delta target is not the last saved or loaded snapshot: " + path);
+    }
+    u32 flags = 0;
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs) throw std::runtime_error("Failed to open snapshot for read: " + path);
+        char magic[4];
+        ifs.read(magic, 4);
+        if (ifs.gcount() != 4 || !std::equal(magic, magic + 4, SNAPSHOT_MAGIC)) {
+            throw std::runtime_error("Deltas can only be appended to an SNP2 snapshot");
+        }
+        flags = readSnapshotHeader(ifs, *m_mem, *m_cpu).flags;
+    }
+    std::ofstream ofs(path, std::ios::binary | std::ios::app);
+    if (!ofs) throw std::runtime_error("Failed to open snapshot for write: " + path);
+    ofs.seekp(0, std::ios::end);
+    writeFrame(ofs, static_cast<std::size_t>(ofs.tellp()), FRAME_DELTA, (flags & SNAPSHOT_FLAG_RLE) != 0, *m_cpu, *m_mem);
+    ofs.close();
+    if (!ofs) throw std::runtime_error("Failed to write snapshot: " + path);
+    m_mem->clearDirty();
+    recordSnapshotFile(path);
 }
 
 void VMInstance::loadSnapshot(const std::string& path) {
+    m_snapshotPath.clear(); // a failed load leaves RAM matching no file
     std::ifstream ifs(path, std::ios::binary);
     if (!ifs) throw std::runtime_error("Failed to open snapshot for read: " + path);
 
     char magic[4];
     ifs.read(magic, 4);
+    if (ifs.gcount() == 4 && std::equal(magic, magic + 4, SNAPSHOT_MAGIC)) {
+        loadSnapshotV2(ifs, path);
+        recordSnapshotFile(path);
+        return;
+    }
     if (ifs.gcount() != 4 || magic[0] != 'S' || magic[1] != 'N' || magic[2] != 'P' || magic[3] != '1') {
         throw std::runtime_error("Invalid snapshot magic");
     }
 
+    // Legacy SNP1: native-endian fields and a raw std::size_t for counts
     u32 pc = 0, sp = 0, flags = 0;
     ifs.read(reinterpret_cast<char*>(&pc), sizeof(pc));
     ifs.read(reinterpret_cast<char*>(&sp), sizeof(sp));
@@ -200,12 +475,94 @@ void VMInstance::loadSnapshot(const std::string& path) {
     if (memSz != m_mem->size()) {
         throw std::runtime_error("Snapshot memory size mismatch");
     }
-    ifs.read(reinterpret_cast<char*>(m_mem->raw().data()), static_cast<std::streamsize>(memSz));
+    for (std::size_t p = 0; p < m_mem->pageCount(); ++p) {
+        const std::size_t n = std::min(RamMemory::PAGE_SIZE, memSz - (p << RamMemory::PAGE_BITS));
+        ifs.read(reinterpret_cast<char*>(m_mem->writablePage(p)), static_cast<std::streamsize>(n));
+    }
+    m_cpu->invalidateCode(0, memSz);
 
     // Restore CPU pointers
     m_cpu->setPC(pc);
     m_cpu->setSP(sp);
     m_cpu->setFlags(flags);
+    recordSnapshotFile(path);
+}
+
+void VMInstance::recordSnapshotFile(const std::string& path) {
+    std::error_code ec;
+    m_snapshotPath = std::filesystem::weakly_canonical(path, ec).string();
+    m_snapshotSize = std::filesystem::file_size(path, ec);
+    if (ec) m_snapshotPath.clear();
+}
+
+void VMInstance::loadSnapshotV2(std::istream& in, const std::string& path) {
+    readSnapshotHeader(in, *m_mem, *m_cpu);
+    std::vector<u8> packed;
+    bool sawBase = false;
+    u32 pc = 0, sp = 0, flags = 0;
+    std::vector<u32> regs(m_cpu->regCount());
+    for (;;) {
+        char magic[4];
+        in.read(magic, 4);
+        if (in.gcount() == 0 && in.eof()) break;
+        if (in.gcount() != 4 || !std::equal(magic, magic + 4, FRAME_MAGIC)) throw std::runtime_error("Corrupt snapshot frame");
+        u8 kind[4];
+        in.read(reinterpret_cast<char*>(kind), 4);
+        if (in.gcount() != 4 || kind[0] > FRAME_IMAGE) throw std::runtime_error("Corrupt snapshot frame");
+        if (kind[0] == FRAME_BASE) {
+            m_mem->zero();
+            sawBase = true;
+        } else if (kind[0] == FRAME_IMAGE) {
+            sawBase = true;
+        } else if (!sawBase) {
+            throw std::runtime_error("Snapshot delta without a base frame");
+        }
+        pc = getLE32(in);
+        sp = getLE32(in);
+        flags = getLE32(in);
+        for (auto& r : regs) r = getLE32(in);
+        const u32 count = getLE32(in);
+        if (kind[0] == FRAME_IMAGE) {
+            if (count != m_mem->pageCount()) throw std::runtime_error("Corrupt snapshot image");
+            const std::size_t start = alignToPage(static_cast<std::size_t>(in.tellg()));
+            const std::size_t length = count * RamMemory::PAGE_SIZE;
+            // Map the image as private guest RAM: restore cost no longer
+            // depends on memory size and pages are read in as they are touched.
+            if (auto block = mapFileCopyOnWrite(path, start, length)) {
+                m_mem->adopt(std::move(block));
+            } else {
+                in.seekg(static_cast<std::streamoff>(start));
+                for (std::size_t p = 0; p < count; ++p) {
+                    in.read(reinterpret_cast<char*>(m_mem->writablePage(p)), static_cast<std::streamsize>(RamMemory::PAGE_SIZE));
+                    if (in.gcount() != static_cast<std::streamsize>(RamMemory::PAGE_SIZE)) {
+                        throw std::runtime_error("Truncated snapshot");
+                    }
+                }
+            }
+            in.seekg(static_cast<std::streamoff>(start + length));
+            continue;
+        }
+        for (u32 i = 0; i < count; ++i) {
+            const u32 page = getLE32(in);
+            const u32 len = getLE32(in);
+            if (page >= m_mem->pageCount() || len > RamMemory::PAGE_SIZE) throw std::runtime_error("Corrupt snapshot page");
+            packed.resize(len);
+            in.read(reinterpret_cast<char*>(packed.data()), len);
+            if (in.gcount() != static_cast<std::streamsize>(len)) throw std::runtime_error("Truncated snapshot");
+            u8* dst = m_mem->writablePage(page);
+            if (len == RamMemory::PAGE_SIZE) std::memcpy(dst, packed.data(), len);
+            else rleDecode(packed.data(), len, dst, RamMemory::PAGE_SIZE);
+        }
+    }
+    if (!sawBase) throw std::runtime_error("Snapshot has no frames");
+
+    m_cpu->invalidateCode(0, m_mem->size());
+    for (std::size_t i = 0; i < regs.size(); ++i) m_cpu->setReg(i, regs[i]);
+    m_cpu->setPC(pc);
+    m_cpu->setSP(sp);
+    m_cpu->setFlags(flags);
+    // RAM now matches the last frame, so further deltas can be appended to it.
+    m_mem->clearDirty();
 }
 
 } // namespace vm
@@ -0,0 +1,626 @@
+#include "vm/JitCPU.hpp"
+#include "vm/Bus.hpp"
+#include "vm/Opcodes.hpp"
+#include "vm/Profiler.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if VM_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+namespace vm {
+
+namespace {
+
+constexpr std::size_t ARENA_SIZE = 4 * 1024 * 1024;
+constexpr std::size_t MAX_BLOCK_CODE = 16 * 1024; // generous worst case for one block
+constexpr std::size_t CODE_PAGE_BITS = 12;
+constexpr std::size_t CODE_PAGE_SIZE = std::size_t{1} << CODE_PAGE_BITS;
+
+bool endsBlock(Opcode op) {
+    switch (op) {
+        case Opcode::JMP:
+        case Opcode::JZ:
+        case Opcode::JNZ:
+        case Opcode::CALL:
+        case Opcode::RET:
+        case Opcode::HALT:
+            return true;
+        default:
+            return false;
+    }
+}
+
+#if VM_JIT_X86_64
+
+enum HostReg : u8 {
+    RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+    R12 = 12, R13 = 13, R14 = 14, R15 = 15
+};
+
+// Guest R0-R4 are pinned to callee-saved registers so helper calls preserve them.
+// R15 holds the Context pointer for the lifetime of native code.
+constexpr u8 PINNED[] = {RBX, RBP, R12, R13, R14};
+constexpr std::size_t PINNED_COUNT = sizeof(PINNED) / sizeof(PINNED[0]);
+
+enum Cond : u8 { CC_B = 0x2, CC_Z = 0x4, CC_NZ = 0x5 };
+
+using Ctx = JitCPU::Context;
+
+// Operand location: a host register or a field of the Context addressed via R15.
+struct Loc {
+    bool isReg;
+    u8 reg;
+    std::int32_t disp;
+};
+
+Loc hostReg(u8 r) { return {true, r, 0}; }
+Loc ctxField(std::size_t off) { return {false, R15, static_cast<std::int32_t>(off)}; }
+Loc ctxReg(std::size_t r) { return ctxField(offsetof(Ctx, regs) + 4 * r); }
+Loc guestReg(u8 r) { return r < PINNED_COUNT ? hostReg(PINNED[r]) : ctxReg(r); }
+
+const Loc CTX_PC = ctxField(offsetof(Ctx, pc));
+const Loc CTX_SP = ctxField(offsetof(Ctx, sp));
+const Loc CTX_FLAGS = ctxField(offsetof(Ctx, flags));
+const Loc CTX_EXIT = ctxField(offsetof(Ctx, exitReason));
+const Loc CTX_BUDGET = ctxField(offsetof(Ctx, budget));
+const Loc CTX_STACK_LOW = ctxField(offsetof(Ctx, stackLow));
+
+// Minimal x86-64 encoder for the handful of instruction forms the JIT needs.
+class Emitter {
+public:
+    Emitter(u8* buf, std::size_t cap) : m_buf(buf), m_cap(cap) {}
+
+    u8* cur() const { return m_buf + m_len; }
+    std::size_t size() const { return m_len; }
+    bool overflowed() const { return m_overflow; }
+
+    void b(u8 v) {
+        if (m_len < m_cap) m_buf[m_len++] = v; else m_overflow = true;
+    }
+    void d32(u32 v) { for (int i = 0; i < 4; ++i) b(static_cast<u8>(v >> (8 * i))); }
+    void q64(u64 v) { for (int i = 0; i < 8; ++i) b(static_cast<u8>(v >> (8 * i))); }
+
+    void align(std::size_t n) { while ((reinterpret_cast<std::uintptr_t>(cur()) & (n - 1)) != 0) b(0x90); }
+
+    // <REX> opcode ModRM [disp] with `reg` in the ModRM.reg field and `rm` as operand.
+    void rm(std::initializer_list<u8> opcode, u8 reg, Loc loc, bool w = false) {
+        const u8 rex = static_cast<u8>(0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((loc.reg & 8) ? 1 : 0));
+        if (rex != 0x40) b(rex);
+        for (u8 op : opcode) b(op);
+        if (loc.isReg) {
+            b(static_cast<u8>(0xC0 | ((reg & 7) << 3) | (loc.reg & 7)));
+        } else if (loc.disp >= -128 && loc.disp <= 127) {
+            b(static_cast<u8>(0x40 | ((reg & 7) << 3) | (loc.reg & 7)));
+            b(static_cast<u8>(loc.disp));
+        } else {
+            b(static_cast<u8>(0x80 | ((reg & 7) << 3) | (loc.reg & 7)));
+            d32(static_cast<u32>(loc.disp));
+        }
+    }
+
+    u8* jcc(Cond cc) { b(0x0F); b(static_cast<u8>(0x80 | cc)); u8* at = cur(); d32(0); return at; }
+    u8* jmp() { b(0xE9); u8* at = cur(); d32(0); return at; }
+
+    static void patch(u8* rel32, const u8* target) {
+        const std::int32_t d = static_cast<std::int32_t>(target - (rel32 + 4));
+        std::memcpy(rel32, &d, 4);
+    }
+
+    // Common sequences
+    void movRegLoc(u8 reg, Loc src) { rm({0x8B}, reg, src); }       // mov r32, r/m32
+    void movLocReg(Loc dst, u8 reg) { rm({0x89}, reg, dst); }       // mov r/m32, r32
+    void movLocImm(Loc dst, u32 imm) { rm({0xC7}, 0, dst); d32(imm); }
+    void addRegImm(u8 reg, u32 imm) { if (imm) { rm({0x81}, 0, hostReg(reg)); d32(imm); } }
+
+    void callHelper(u64 fn) {
+        rm({0x89}, R15, hostReg(RDI), true); // mov rdi, r15
+        b(0x48); b(0xB8); q64(fn);           // mov rax, imm64
+        b(0xFF); b(0xD0);                    // call rax
+    }
+
+    // FLAGS.Z = host ZF (as left by cmp/test)
+    void storeZFromHostFlags() {
+        b(0x0F); b(0x94); b(0xC1);           // sete cl
+        b(0x0F); b(0xB6); b(0xC9);           // movzx ecx, cl
+        rm({0x83}, 4, CTX_FLAGS); b(0xFE);   // and dword [flags], ~1
+        rm({0x09}, RCX, CTX_FLAGS);          // or dword [flags], ecx
+    }
+    void setZFromEax() {
+        b(0x85); b(0xC0);                    // test eax, eax
+        storeZFromHostFlags();
+    }
+    void setZConst(bool z) {
+        if (z) { rm({0x83}, 1, CTX_FLAGS); b(0x01); }   // or dword [flags], 1
+        else   { rm({0x83}, 4, CTX_FLAGS); b(0xFE); }   // and dword [flags], ~1
+    }
+
+private:
+    u8* m_buf;
+    std::size_t m_cap;
+    std::size_t m_len{0};
+    bool m_overflow{false};
+};
+
+bool nativeSupported(const DecodedInst& di) {
+    const auto ok = [](u8 r) { return r < SimpleCPU::REG_COUNT; };
+    switch (di.op) {
+        case Opcode::LOADI: return ok(di.a);
+        case Opcode::LOAD:
+        case Opcode::STORE:
+        case Opcode::CMP: return ok(di.a) && ok(di.b);
+        case Opcode::ADD:
+        case Opcode::SUB:
+        case Opcode::AND:
+        case Opcode::OR:
+        case Opcode::XOR: return ok(di.a) && ok(di.b) && ok(di.c);
+        case Opcode::PUSH:
+        case Opcode::POP: return ok(di.a);
+        case Opcode::JMP:
+        case Opcode::JZ:
+        case Opcode::JNZ:
+        case Opcode::CALL:
+        case Opcode::RET: return true;
+        default: return false; // HALT, OUT, IN are left to the interpreter
+    }
+}
+
+#endif // VM_JIT_X86_64
+
+} // namespace
+
+JitCPU::JitCPU(BusMemory& bus, ILogger* logger)
+    : SimpleCPU(bus, logger), m_bus(bus) {
+    m_codeMap.resize((bus.size() + CODE_PAGE_SIZE - 1) >> CODE_PAGE_BITS);
+#if VM_JIT_X86_64
+    void* arena = mmap(nullptr, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (arena != MAP_FAILED) {
+        m_arena = static_cast<u8*>(arena);
+        m_arenaSize = ARENA_SIZE;
+        flushCode();
+    }
+#endif
+}
+
+JitCPU::~JitCPU() {
+#if VM_JIT_X86_64
+    if (m_arena) munmap(m_arena, m_arenaSize);
+#endif
+}
+
+void JitCPU::reset() {
+    flushCode(); // first, so native counts are not folded into the cleared counters
+    SimpleCPU::reset();
+}
+
+bool JitCPU::nativeEnabled() const {
+    // Per-instruction logging and tracing are only produced by the interpreter.
+    return m_arena != nullptr && m_logger == nullptr && m_trace == nullptr;
+}
+
+void JitCPU::invalidateCode(std::size_t addr, std::size_t len) {
+    SimpleCPU::invalidateCode(addr, len);
+    if (touchesCode(addr, len)) flushCode();
+}
+
+void JitCPU::setBreakpoint(u32 addr, bool enabled) {
+    SimpleCPU::setBreakpoint(addr, enabled);
+    // Compiled code covering the address would run past it. Blocks cut short
+    // by a removed breakpoint stay valid and are simply recompiled on a flush.
+    if (enabled && touchesCode(addr, 1)) flushCode();
+}
+
+bool JitCPU::touchesCode(std::size_t addr, std::size_t len) const {
+    for (std::size_t a = addr; a < addr + len; ++a) {
+        const std::size_t page = a >> CODE_PAGE_BITS;
+        if (page >= m_codeMap.size()) return false;
+        const auto& bits = m_codeMap[page];
+        if (!bits) {
+            a |= CODE_PAGE_SIZE - 1; // skip the rest of an untouched page
+            continue;
+        }
+        if ((*bits)[a & (CODE_PAGE_SIZE - 1)]) return true;
+    }
+    return false;
+}
+
+void JitCPU::setWritable(bool writable) {
+#if VM_JIT_X86_64
+    mprotect(m_arena, m_arenaSize, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC));
+#else
+    (void)writable;
+#endif
+}
+
+void JitCPU::setProfile(ExecutionProfile* profile) {
+    syncProfile();
+    SimpleCPU::setProfile(profile);
+    flushCode(); // blocks are compiled with or without exit counters
+}
+
+void JitCPU::syncProfile() {
+    if (!m_profile) return;
+    for (ExitCounter& exit : m_exitCounters) {
+        const u64 hits = exit.hits - exit.profiled;
+        if (!hits) continue;
+        for (u32 i = 0; i < exit.retired; ++i) m_profile->hit(exit.block->pcs[i], hits);
+        exit.profiled = exit.hits;
+    }
+}
+
+void JitCPU::addExitCounts(PerfCounters& perf, const ExitCounter& exit, u64 hits) const {
+    for (u32 i = 0; i < exit.retired; ++i) perf.retired[static_cast<u8>(exit.block->ops[i])] += hits;
+    if (exit.branch == 1) perf.branchesTaken += hits;
+    else if (exit.branch == 0) perf.branchesNotTaken += hits;
+}
+
+PerfCounters JitCPU::perfCounters() const {
+    PerfCounters perf = SimpleCPU::perfCounters();
+    for (const ExitCounter& exit : m_exitCounters) addExitCounts(perf, exit, exit.hits);
+    return perf;
+}
+
+void JitCPU::flushCode() {
+    syncProfile();
+    if (PerfCounters::ENABLED) {
+        for (const ExitCounter& exit : m_exitCounters) addExitCounts(m_perf, exit, exit.hits);
+    }
+    m_exitCounters.clear();
+    m_blockInsts.clear();
+    m_blocks.clear();
+    m_pendingChains.clear();
+    for (auto& page : m_codeMap) page.reset();
+    m_compiled = 0;
+    m_arenaUsed = 0;
+    m_enter = nullptr;
+    m_epilogue = nullptr;
+#if VM_JIT_X86_64
+    if (!m_arena) return;
+    setWritable(true);
+    Emitter e(m_arena, m_arenaSize);
+
+    // void enter(Context* ctx /*rdi*/, const void* body /*rsi*/)
+    m_enter = e.cur();
+    e.b(0x53);                          // push rbx
+    e.b(0x55);                          // push rbp
+    e.b(0x41); e.b(0x54);               // push r12
+    e.b(0x41); e.b(0x55);               // push r13
+    e.b(0x41); e.b(0x56);               // push r14
+    e.b(0x41); e.b(0x57);               // push r15
+    e.b(0x48); e.b(0x83); e.b(0xEC); e.b(0x08); // sub rsp, 8 (keep calls 16-byte aligned)
+    e.rm({0x89}, RDI, hostReg(R15), true);      // mov r15, rdi
+    for (std::size_t r = 0; r < PINNED_COUNT; ++r) e.movRegLoc(PINNED[r], ctxReg(r));
+    e.b(0xFF); e.b(0xE6);               // jmp rsi
+
+    e.align(16);
+    m_epilogue = e.cur();
+    for (std::size_t r = 0; r < PINNED_COUNT; ++r) e.movLocReg(ctxReg(r), PINNED[r]);
+    e.b(0x48); e.b(0x83); e.b(0xC4); e.b(0x08); // add rsp, 8
+    e.b(0x41); e.b(0x5F);               // pop r15
+    e.b(0x41); e.b(0x5E);               // pop r14
+    e.b(0x41); e.b(0x5D);               // pop r13
+    e.b(0x41); e.b(0x5C);               // pop r12
+    e.b(0x5D);                          // pop rbp
+    e.b(0x5B);                          // pop rbx
+    e.b(0xC3);                          // ret
+
+    m_arenaUsed = e.size();
+    setWritable(false);
+#endif
+}
+
+u64 JitCPU::helperLoad(Context* ctx, u32 addr) {
+    const u8* p = ctx->self->m_bus.readPtr(addr, 4);
+    if (!p) return u64{1} << 32; // not plain RAM: let the interpreter do it
+    u32 v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+u32 JitCPU::helperStore(Context* ctx, u32 addr, u32 value) {
+    JitCPU* self = ctx->self;
+    u8* p = self->m_bus.writePtr(addr, 4);
+    if (!p || self->touchesCode(addr, 4)) return 1;
+    std::memcpy(p, &value, 4);
+    self->noteWrite(addr, 4);
+    return 0;
+}
+
+void JitCPU::compile(u32 pc, Block& block) {
+#if VM_JIT_X86_64
+    // Collect the block: straight-line code up to and including a control transfer.
+    std::vector<DecodedInst> insts;
+    u32 p = pc;
+    while (insts.size() < MAX_BLOCK_INSTS) {
+        if (!m_bus.readPtr(p, 1) || (p != pc && isBreakpoint(p))) break;
+        DecodedInst di;
+        try {
+            di = decode(p);
+        } catch (const std::exception&) {
+            break; // leave the error to the interpreter
+        }
+        if (!m_bus.readPtr(p, di.size) || !nativeSupported(di)) break;
+        insts.push_back(di);
+        p += di.size;
+        if (endsBlock(di.op)) break;
+    }
+    if (insts.empty()) {
+        block.failed = true;
+        return;
+    }
+
+    setWritable(true);
+    Emitter e(m_arena + m_arenaUsed, m_arenaSize - m_arenaUsed);
+    e.align(16);
+    const u8* body = e.cur();
+
+    struct Stub {
+        u8* site;
+        u32 pc;
+        u32 retired;
+        bool fallback;
+        bool chain;
+        int branch;
+    };
+    std::vector<Stub> stubs;
+    const u32 count = static_cast<u32>(insts.size());
+
+    // Entry guard: refuse to start the block unless the whole of it fits the step budget.
+    e.rm({0x83}, 7, CTX_BUDGET, true); e.b(static_cast<u8>(count)); // cmp qword [budget], count
+    stubs.push_back({e.jcc(CC_B), pc, 0, false, false, -1});
+
+    // Exit counters: every exit that retired instructions bumps its own counter.
+    const bool counting = m_profile || PerfCounters::ENABLED;
+    const BlockInsts* blockInsts = nullptr;
+    if (counting) {
+        m_blockInsts.emplace_back();
+        BlockInsts& bi = m_blockInsts.back();
+        for (u32 a = pc, i = 0; i < count; a += insts[i].size, ++i) {
+            bi.pcs.push_back(a);
+            bi.ops.push_back(insts[i].op);
+        }
+        blockInsts = &bi;
+    }
+    auto countExit = [&](u32 retired, int branch) {
+        if (!counting || !retired) return;
+        m_exitCounters.push_back({0, 0, blockInsts, retired, branch});
+        e.b(0x48); e.b(0xB8); e.q64(reinterpret_cast<u64>(&m_exitCounters.back().hits)); // mov rax, &hits
+        e.b(0x48); e.b(0x83); e.b(0x00); e.b(0x01);                                       // add qword [rax], 1
+    };
+
+    auto exitTo = [&](u32 target, u32 retired, int branch = -1) {
+        stubs.push_back({e.jmp(), target, retired, false, true, branch});
+    };
+    auto loadHelper = reinterpret_cast<u64>(&JitCPU::helperLoad);
+    auto storeHelper = reinterpret_cast<u64>(&JitCPU::helperStore);
+
+    u32 ip = pc;
+    bool terminated = false;
+    for (u32 i = 0; i < count; ++i) {
+        const DecodedInst& di = insts[i];
+        auto fallbackIf = [&](Cond cc) { stubs.push_back({e.jcc(cc), ip, i, true, false, -1}); };
+        switch (di.op) {
+            case Opcode::LOADI:
+                e.movLocImm(guestReg(di.a), di.imm);
+                e.setZConst(di.imm == 0);
+                break;
+            case Opcode::LOAD:
+                e.movRegLoc(RSI, guestReg(di.b));
+                e.addRegImm(RSI, di.imm & 0xFFFF);
+                e.callHelper(loadHelper);
+                e.rm({0x0F, 0xBA}, 4, hostReg(RAX), true); e.b(32); // bt rax, 32
+                fallbackIf(CC_B);
+                e.movLocReg(guestReg(di.a), RAX);
+                e.setZFromEax();
+                break;
+            case Opcode::STORE:
+                e.movRegLoc(RSI, guestReg(di.a));
+                e.addRegImm(RSI, di.imm & 0xFFFF);
+                e.movRegLoc(RDX, guestReg(di.b));
+                e.callHelper(storeHelper);
+                e.b(0x85); e.b(0xC0); // test eax, eax
+                fallbackIf(CC_NZ);
+                break;
+            case Opcode::ADD:
+            case Opcode::SUB:
+            case Opcode::AND:
+            case Opcode::OR:
+            case Opcode::XOR: {
+                const u8 opc = di.op == Opcode::ADD ? 0x03 : di.op == Opcode::SUB ? 0x2B
+                             : di.op == Opcode::AND ? 0x23 : di.op == Opcode::OR ? 0x0B : 0x33;
+                e.movRegLoc(RAX, guestReg(di.b));
+                e.rm({opc}, RAX, guestReg(di.c));
+                e.movLocReg(guestReg(di.a), RAX);
+                e.setZFromEax();
+                break;
+            }
+            case Opcode::CMP:
+                e.movRegLoc(RAX, guestReg(di.a));
+                e.rm({0x3B}, RAX, guestReg(di.b)); // cmp eax, r/m32
+                e.storeZFromHostFlags();           // Z=1 if equal
+                break;
+            case Opcode::PUSH:
+            case Opcode::CALL:
+                e.movRegLoc(RSI, CTX_SP);
+                e.rm({0x83}, 7, hostReg(RSI)); e.b(4); // cmp esi, 4
+                fallbackIf(CC_B);                      // stack overflow: interpreter reports it
+                e.rm({0x83}, 5, hostReg(RSI)); e.b(4); // sub esi, 4
+                if (di.op == Opcode::PUSH) {
+                    e.movRegLoc(RDX, guestReg(di.a));
+                } else {
+                    e.b(0xBA); e.d32(ip + di.size);    // mov edx, return address
+                }
+                e.callHelper(storeHelper);
+                e.b(0x85); e.b(0xC0);
+                fallbackIf(CC_NZ);
+                e.rm({0x83}, 5, CTX_SP); e.b(4);       // sub dword [sp], 4
+                if (PerfCounters::ENABLED) {
+                    e.movRegLoc(RAX, CTX_SP);
+                    e.rm({0x3B}, RAX, CTX_STACK_LOW);  // cmp eax, [stackLow]
+                    e.b(0x73); u8* skip = e.cur(); e.b(0); // jae
+                    e.movLocReg(CTX_STACK_LOW, RAX);
+                    *skip = static_cast<u8>(e.cur() - (skip + 1));
+                }
+                if (di.op == Opcode::CALL) { exitTo(di.imm, i + 1); terminated = true; }
+                break;
+            case Opcode::POP:
+            case Opcode::RET:
+                e.movRegLoc(RSI, CTX_SP);
+                e.callHelper(loadHelper);
+                e.rm({0x0F, 0xBA}, 4, hostReg(RAX), true); e.b(32);
+                fallbackIf(CC_B);
+                e.rm({0x83}, 0, CTX_SP); e.b(4);       // add dword [sp], 4
+                if (di.op == Opcode::POP) {
+                    e.movLocReg(guestReg(di.a), RAX);
+                    e.setZFromEax();
+                } else {
+                    e.movLocReg(CTX_PC, RAX);
+                    e.rm({0x83}, 5, CTX_BUDGET, true); e.b(static_cast<u8>(i + 1));
+                    countExit(i + 1, -1);
+                    Emitter::patch(e.jmp(), m_epilogue);
+                    terminated = true;
+                }
+                break;
+            case Opcode::JMP:
+                exitTo(di.imm, i + 1);
+                terminated = true;
+                break;
+            case Opcode::JZ:
+            case Opcode::JNZ:
+                e.rm({0xF6}, 0, CTX_FLAGS); e.b(0x01); // test byte [flags], 1
+                stubs.push_back({e.jcc(di.op == Opcode::JZ ? CC_NZ : CC_Z), di.imm, i + 1, false, true, 1});
+                exitTo(ip + di.size, i + 1, 0);
+                terminated = true;
+                break;
+            default:
+                break; // filtered out by nativeSupported()
+        }
+        ip += di.size;
+    }
+    if (!terminated) exitTo(ip, count);
+
+    // Out-of-line exits. Chainable exits jump straight into the target block when
+    // it is compiled (now or later); everything else returns to the dispatcher.
+    std::vector<std::pair<u32, u8*>> chainSites;
+    for (const Stub& s : stubs) {
+        Emitter::patch(s.site, e.cur());
+        if (s.retired) { e.rm({0x83}, 5, CTX_BUDGET, true); e.b(static_cast<u8>(s.retired)); }
+        countExit(s.retired, s.branch);
+        e.movLocImm(CTX_PC, s.pc);
+        if (s.fallback) e.movLocImm(CTX_EXIT, EXIT_FALLBACK);
+        u8* rel = e.jmp();
+        if (s.chain) chainSites.emplace_back(s.pc, rel);
+        else Emitter::patch(rel, m_epilogue);
+    }
+
+    if (e.overflowed()) { // cannot happen with MAX_BLOCK_CODE headroom, but never run a torn block
+        setWritable(false);
+        block.failed = true;
+        return;
+    }
+
+    for (auto& [target, rel] : chainSites) {
+        auto it = target == pc ? m_blocks.end() : m_blocks.find(target);
+        if (target == pc) {
+            Emitter::patch(rel, body);
+        } else if (it != m_blocks.end() && it->second.body) {
+            Emitter::patch(rel, it->second.body);
+        } else {
+            Emitter::patch(rel, m_epilogue);
+            m_pendingChains[target].push_back({rel});
+        }
+    }
+    auto pending = m_pendingChains.find(pc);
+    if (pending != m_pendingChains.end()) {
+        for (const ChainSite& site : pending->second) Emitter::patch(site.rel32, body);
+        m_pendingChains.erase(pending);
+    }
+    setWritable(false);
+
+    m_arenaUsed += e.size();
+    block.body = body;
+    block.count = count;
+    ++m_compiled;
+
+    for (u32 a = pc; a < ip; ++a) {
+        auto& bits = m_codeMap[a >> CODE_PAGE_BITS];
+        if (!bits) bits = std::make_unique<std::bitset<CODE_PAGE_SIZE>>();
+        bits->set(a & (CODE_PAGE_SIZE - 1));
+    }
+    markCode(pc, ip - pc);
+#else
+    (void)pc;
+    block.failed = true;
+#endif
+}
+
+u64 JitCPU::enterNative(const Block& block, u64 budget) {
+    for (std::size_t r = 0; r < REG_COUNT; ++r) m_ctx.regs[r] = m_regs[r];
+    m_ctx.pc = m_pc;
+    m_ctx.sp = m_sp;
+    m_ctx.flags = m_flags;
+    m_ctx.exitReason = EXIT_NORMAL;
+    m_ctx.budget = budget;
+    m_ctx.self = this;
+    m_ctx.stackLow = m_perf.stackLow;
+
+    using EnterFn = void (*)(Context*, const void*);
+    EnterFn enter;
+    std::memcpy(&enter, &m_enter, sizeof(enter));
+    enter(&m_ctx, block.body);
+
+    for (std::size_t r = 0; r < REG_COUNT; ++r) m_regs[r] = m_ctx.regs[r];
+    m_pc = m_ctx.pc;
+    m_sp = m_ctx.sp;
+    m_flags = m_ctx.flags;
+    m_perf.stackLow = m_ctx.stackLow;
+    return budget - m_ctx.budget;
+}
+
+RunOutcome JitCPU::run(std::size_t maxSteps) {
+    if (!nativeEnabled()) return SimpleCPU::run(maxSteps);
+    PerfRunClock clock(m_perf);
+    u64 budget = maxSteps ? maxSteps : std::numeric_limits<u64>::max();
+    const bool breaks = hasBreakpoints();
+    bool first = true; // a run starting on a breakpoint executes it
+    m_watchPending = false;
+    while (!m_halted && budget) {
+        // Watched accesses always leave native code through step().
+        if (m_watchPending) return RunOutcome::Watchpoint;
+        const u32 pc = m_pc;
+        const bool atBreak = breaks && isBreakpoint(pc);
+        if (atBreak && !first) return RunOutcome::Breakpoint;
+        first = false;
+        Block* block = &m_blocks[pc];
+        if (!block->body && !block->failed && !atBreak && ++block->heat >= HOT_THRESHOLD) {
+            if (m_arenaUsed + MAX_BLOCK_CODE > m_arenaSize) {
+                flushCode();
+                block = &m_blocks[pc];
+            }
+            compile(pc, *block);
+        }
+        if (block->body && block->count <= budget) {
+            budget -= enterNative(*block, budget);
+            if (m_ctx.exitReason == EXIT_FALLBACK && budget) {
+                step(); // the instruction native code declined (MMIO, stack error, code write)
+                --budget;
+            }
+            continue;
+        }
+        // Interpret up to the end of the basic block, then look for a compiled block again.
+        for (;;) {
+            const Opcode op = fetch().inst.op;
+            step();
+            --budget;
+            if (m_halted || !budget || m_watchPending || endsBlock(op)) break;
+            if (breaks && isBreakpoint(m_pc)) return RunOutcome::Breakpoint;
+        }
+    }
+    return outcome(false);
+}
+
+} // namespace vm
@@ -0,0 +1,302 @@
+#include "vm/Layout.hpp"
+#include "vm/Memory.hpp"
+#include "vm/Opcodes.hpp"
+#include "vm/Profiler.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+namespace {
+
+constexpr std::size_t NONE = std::numeric_limits<std::size_t>::max();
+constexpr u8 JUMP_SIZE = 5;
+
+// Encoded length of an opcode byte, 0 if it is not one.
+u8 instructionSize(u8 op) {
+    switch (static_cast<Opcode>(op)) {
+    case Opcode::HALT:
+    case Opcode::RET:
+        return 1;
+    case Opcode::LOADI:
+        return 6;
+    case Opcode::LOAD:
+    case Opcode::STORE:
+    case Opcode::JMP:
+    case Opcode::JZ:
+    case Opcode::JNZ:
+    case Opcode::CALL:
+        return 5;
+    case Opcode::ADD:
+    case Opcode::SUB:
+    case Opcode::AND:
+    case Opcode::OR:
+    case Opcode::XOR:
+        return 4;
+    case Opcode::CMP:
+        return 3;
+    case Opcode::PUSH:
+    case Opcode::POP:
+    case Opcode::OUT:
+    case Opcode::IN:
+        return 2;
+    }
+    return 0;
+}
+
+bool isBranch(Opcode op) {
+    return op == Opcode::JMP || op == Opcode::JZ || op == Opcode::JNZ || op == Opcode::CALL;
+}
+
+bool isConditional(Opcode op) { return op == Opcode::JZ || op == Opcode::JNZ; }
+
+// CALL does not end a block: its return lands on the next instruction.
+bool endsBlock(Opcode op) {
+    return op == Opcode::JMP || isConditional(op) || op == Opcode::RET || op == Opcode::HALT;
+}
+
+struct Inst {
+    u32 offset;
+    u8 size;
+    Opcode op;
+    std::size_t reloc{NONE}; // relocation inside this instruction
+};
+
+struct Block {
+    u32 start{0};
+    std::size_t first{0}, last{0}; // instruction range [first, last)
+    u64 count{0};
+    std::size_t taken{NONE};       // local branch target
+    std::size_t fall{NONE};        // block reached by falling through
+    u64 takenWeight{0};
+    u64 fallWeight{0};
+};
+
+struct Edge {
+    u64 weight;
+    std::size_t from, to;
+};
+
+} // namespace
+
+ObjectFile layoutObject(const ObjectFile& obj, const ExecutionProfile& profile, u32 base, LayoutReport* report) {
+    const std::vector<u8>& code = obj.code;
+    const u32 codeSize = static_cast<u32>(code.size());
+
+    // Decode, and attach each relocation to the instruction holding it.
+    std::vector<std::size_t> relocOrder(obj.relocations.size());
+    for (std::size_t i = 0; i < relocOrder.size(); ++i) relocOrder[i] = i;
+    std::sort(relocOrder.begin(), relocOrder.end(), [&](std::size_t a, std::size_t b) {
+        return obj.relocations[a].offset < obj.relocations[b].offset;
+    });
+    std::vector<Inst> insts;
+    std::size_t nextReloc = 0;
+    for (u32 pc = 0; pc < codeSize;) {
+        const u8 size = instructionSize(code[pc]);
+        if (size == 0 || codeSize - pc < size) {
+            throw std::runtime_error(obj.name + ": no valid instruction at offset " + std::to_string(pc));
+        }
+        Inst inst{pc, size, static_cast<Opcode>(code[pc])};
+        if (nextReloc < relocOrder.size() && obj.relocations[relocOrder[nextReloc]].offset < pc + size) {
+            inst.reloc = relocOrder[nextReloc++];
+            if (obj.relocations[inst.reloc].offset <= pc) {
+                throw std::runtime_error(obj.name + ": relocation at offset " + std::to_string(pc) +
+                                         " is not an instruction operand");
+            }
+        }
+        if (isBranch(inst.op) && (inst.reloc == NONE || obj.relocations[inst.reloc].offset != pc + 1)) {
+            throw std::runtime_error(obj.name + ": branch at offset " + std::to_string(pc) +
+                                     " has a numeric target; layout needs label targets");
+        }
+        insts.push_back(inst);
+        pc += size;
+    }
+
+    // Block leaders: the module start, every label, and whatever follows a
+    // block-ending instruction.
+    std::vector<char> leader(codeSize + std::size_t{1}, 0);
+    std::vector<char> boundary(codeSize + std::size_t{1}, 0);
+    leader[0] = 1;
+    boundary[codeSize] = 1;
+    for (const Inst& inst : insts) {
+        boundary[inst.offset] = 1;
+        if (endsBlock(inst.op)) leader[inst.offset + inst.size] = 1;
+    }
+    for (const ObjectSymbol& s : obj.symbols) {
+        if (s.offset > codeSize || !boundary[s.offset]) {
+            throw std::runtime_error(obj.name + ": label '" + s.name + "' is not at an instruction boundary");
+        }
+        leader[s.offset] = 1;
+    }
+    for (const Relocation& r : obj.relocations) {
+        if (!r.symbol.empty()) continue;
+        if (r.target > codeSize || !boundary[r.target]) {
+            throw std::runtime_error(obj.name + ": relocation target " + std::to_string(r.target) +
+                                     " is not at an instruction boundary");
+        }
+        leader[r.target] = 1;
+    }
+
+    std::vector<Block> blocks;
+    std::vector<std::size_t> blockAt(codeSize + std::size_t{1}, NONE);
+    for (std::size_t i = 0; i < insts.size(); ++i) {
+        if (leader[insts[i].offset]) {
+            if (!blocks.empty()) blocks.back().last = i;
+            blockAt[insts[i].offset] = blocks.size();
+            blocks.push_back({insts[i].offset, i});
+            blocks.back().count = profile.count(base + insts[i].offset);
+        }
+    }
+    if (!blocks.empty()) blocks.back().last = insts.size();
+
+    // Successors and edge weights. The count of a block's last instruction is
+    // exact for fall-through and JMP edges; for a conditional branch each
+    // direction is bounded by the count of the block it leads to.
+    std::size_t fallsOffEnd = NONE;
+    u64 takenBefore = 0;
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        Block& blk = blocks[b];
+        const Inst& last = insts[blk.last - 1];
+        const u64 n = profile.count(base + last.offset);
+        const bool hasNext = b + 1 < blocks.size();
+        if (last.op == Opcode::JMP || isConditional(last.op)) {
+            const Relocation& r = obj.relocations[last.reloc];
+            if (r.symbol.empty() && r.target < codeSize) blk.taken = blockAt[r.target];
+        }
+        if (last.op == Opcode::JMP) {
+            blk.takenWeight = n;
+        } else if (isConditional(last.op)) {
+            if (hasNext) blk.fall = b + 1;
+            blk.fallWeight = hasNext ? std::min(n, blocks[b + 1].count) : 0;
+            blk.takenWeight = blk.taken != NONE ? std::min(n, blocks[blk.taken].count) : n - blk.fallWeight;
+        } else if (last.op != Opcode::RET && last.op != Opcode::HALT) {
+            if (hasNext) blk.fall = b + 1;
+            blk.fallWeight = n;
+        }
+        if (!hasNext && (!endsBlock(last.op) || isConditional(last.op))) fallsOffEnd = b;
+        takenBefore += blk.takenWeight;
+    }
+
+    // Chain blocks along the heaviest edges first (Pettis-Hansen). The first
+    // block must stay at the head of its chain and a block that runs off the
+    // end of the module stays on its own.
+    std::vector<Edge> edges;
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        if (blocks[b].fall != NONE && blocks[b].fallWeight) edges.push_back({blocks[b].fallWeight, b, blocks[b].fall});
+        if (blocks[b].taken != NONE && blocks[b].takenWeight) edges.push_back({blocks[b].takenWeight, b, blocks[b].taken});
+    }
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b) { return a.weight > b.weight; });
+    std::vector<std::vector<std::size_t>> chains(blocks.size());
+    std::vector<std::size_t> chainOf(blocks.size());
+    for (std::size_t b = 0; b < blocks.size(); ++b) {
+        chains[b] = {b};
+        chainOf[b] = b;
+    }
+    for (const Edge& e : edges) {
+        const std::size_t from = chainOf[e.from];
+        const std::size_t to = chainOf[e.to];
+        if (from == to || e.to == 0 || e.from == fallsOffEnd || e.to == fallsOffEnd) continue;
+        if (chains[from].back() != e.from || chains[to].front() != e.to) continue;
+        for (std::size_t b : chains[to]) chainOf[b] = from;
+        chains[from].insert(chains[from].end(), chains[to].begin(), chains[to].end());
+        chains[to].clear();
+    }
+
+    // The entry chain first, then hot chains by their hottest block, then
+    // never-executed code in source order.
+    std::vector<std::size_t> order;
+    std::vector<u64> heat(chains.size(), 0);
+    for (std::size_t c = 0; c < chains.size(); ++c) {
+        for (std::size_t b : chains[c]) heat[c] = std::max(heat[c], blocks[b].count);
+        if (!chains[c].empty() && c != chainOf[0] && (fallsOffEnd == NONE || c != chainOf[fallsOffEnd])) {
+            order.push_back(c);
+        }
+    }
+    std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) { return heat[a] > heat[b]; });
+    if (!blocks.empty()) order.insert(order.begin(), chainOf[0]);
+    if (fallsOffEnd != NONE && chainOf[fallsOffEnd] != chainOf[0]) order.push_back(chainOf[fallsOffEnd]);
+    std::vector<std::size_t> sequence;
+    sequence.reserve(blocks.size());
+    for (std::size_t c : order) sequence.insert(sequence.end(), chains[c].begin(), chains[c].end());
+
+    // Emit. Relocation targets stay old offsets until every block is placed.
+    LayoutReport stats;
+    stats.blocks = blocks.size();
+    stats.takenBefore = takenBefore;
+    ObjectFile out;
+    out.name = obj.name;
+    out.sourceHash = obj.sourceHash;
+    out.sourceSize = obj.sourceSize;
+    out.code.reserve(code.size() + code.size() / 8);
+    std::vector<u32> newStart(blocks.size(), 0);
+    auto emit = [&](const Inst& inst, Opcode op, std::size_t retarget) {
+        const u32 at = static_cast<u32>(out.code.size());
+        out.code.insert(out.code.end(), code.begin() + inst.offset, code.begin() + inst.offset + inst.size);
+        out.code[at] = static_cast<u8>(op);
+        if (inst.reloc == NONE) return;
+        Relocation r = obj.relocations[inst.reloc];
+        r.offset = at + (r.offset - inst.offset);
+        if (retarget != NONE) r.target = blocks[retarget].start;
+        out.relocations.push_back(std::move(r));
+    };
+    auto emitJump = [&](std::size_t to) {
+        const u32 at = static_cast<u32>(out.code.size());
+        out.code.resize(at + JUMP_SIZE, 0);
+        out.code[at] = static_cast<u8>(Opcode::JMP);
+        out.relocations.push_back({at + 1, 4, {}, blocks[to].start});
+        ++stats.jumpsAdded;
+    };
+    for (std::size_t i = 0; i < sequence.size(); ++i) {
+        const std::size_t b = sequence[i];
+        const std::size_t next = i + 1 < sequence.size() ? sequence[i + 1] : NONE;
+        const Block& blk = blocks[b];
+        newStart[b] = static_cast<u32>(out.code.size());
+        if (blk.count) ++stats.hotBlocks;
+        for (std::size_t k = blk.first; k + 1 < blk.last; ++k) emit(insts[k], insts[k].op, NONE);
+        const Inst& last = insts[blk.last - 1];
+        if (last.op == Opcode::JMP && blk.taken != NONE && blk.taken == next) {
+            ++stats.jumpsRemoved;
+        } else if (isConditional(last.op) && blk.fall != NONE && blk.fall != next && blk.taken == next) {
+            const Opcode inverted = last.op == Opcode::JZ ? Opcode::JNZ : Opcode::JZ;
+            emit(last, inverted, blk.fall);
+            ++stats.branchesInverted;
+            stats.takenAfter += blk.fallWeight;
+        } else {
+            emit(last, last.op, NONE);
+            stats.takenAfter += blk.takenWeight;
+            if (blk.fall != NONE && blk.fall != next) {
+                emitJump(blk.fall);
+                stats.takenAfter += blk.fallWeight;
+            }
+        }
+    }
+
+    // Rewrite labels and local relocations to the new offsets.
+    const u32 newSize = static_cast<u32>(out.code.size());
+    auto moved = [&](u32 offset) { return offset == codeSize ? newSize : newStart[blockAt[offset]]; };
+    for (const ObjectSymbol& s : obj.symbols) out.symbols.push_back({s.name, moved(s.offset), s.global});
+    std::stable_sort(out.symbols.begin(), out.symbols.end(), [](const ObjectSymbol& a, const ObjectSymbol& b) {
+        return a.offset != b.offset ? a.offset < b.offset : a.name < b.name;
+    });
+    for (Relocation& r : out.relocations) {
+        if (!r.symbol.empty()) continue;
+        r.target = moved(r.target);
+        if (r.width == 2) {
+            if (r.target > 0xFFFF) {
+                throw std::runtime_error(obj.name + ": 16-bit operand overflow after layout at offset " +
+                                         std::to_string(r.offset));
+            }
+            storeLE16(&out.code[r.offset], static_cast<u16>(r.target));
+        } else {
+            storeLE32(&out.code[r.offset], r.target);
+        }
+    }
+    if (report) *report = stats;
+    return out;
+}
+
+} // namespace vm
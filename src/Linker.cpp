@@ -0,0 +1,141 @@
+#include "vm/Linker.hpp"
+#include "vm/Checksum.hpp"
+#include "vm/ProgramLoader.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace vm {
+
+namespace {
+
+// Part of every cache entry's name; bump it whenever assembleObject() would
+// encode the same source differently, so stale entries are never reused.
+constexpr u32 CACHE_REVISION = 2;
+
+// Unique per call and per process: random bits plus a counter.
+u64 tempSuffix() {
+    static const u64 seed = (u64{std::random_device{}()} << 32) ^ std::random_device{}();
+    static std::atomic<u64> counter{0};
+    return seed + counter.fetch_add(1) * 0x9E3779B97F4A7C15ull;
+}
+
+std::string moduleName(const ObjectFile& obj, std::size_t index) {
+    return obj.name.empty() ? "module" + std::to_string(index) : obj.name;
+}
+
+} // namespace
+
+AssembledProgram link(const std::vector<ObjectFile>& objects) {
+    AssembledProgram prog;
+    std::vector<u32> bases;
+    std::size_t total = 0;
+    std::size_t symbols = 0;
+    for (const ObjectFile& obj : objects) {
+        bases.push_back(static_cast<u32>(total));
+        total += obj.code.size();
+        symbols += obj.symbols.size();
+    }
+    prog.labels.reserve(symbols);
+
+    // Locals are qualified by module name, so two modules sharing a name
+    // (e.g. a/util.asm and b/util.asm) would overwrite each other's labels.
+    std::unordered_map<std::string, std::size_t> moduleIndex;
+    for (std::size_t m = 0; m < objects.size(); ++m) {
+        const auto [it, added] = moduleIndex.emplace(moduleName(objects[m], m), m);
+        if (!added) {
+            throw std::runtime_error("Duplicate module name '" + it->first + "' (inputs " + std::to_string(it->second + 1) +
+                                     " and " + std::to_string(m + 1) + "); rename one of them");
+        }
+    }
+    if (total > 0xFFFFFFFFull) throw std::runtime_error("Linked program exceeds 4 GiB");
+    prog.code.reserve(total);
+
+    // Globals first, so references resolve regardless of module order.
+    std::unordered_map<std::string, std::size_t> definedIn;
+    for (std::size_t m = 0; m < objects.size(); ++m) {
+        for (const ObjectSymbol& s : objects[m].symbols) {
+            if (!s.global) continue;
+            const auto [it, added] = definedIn.emplace(s.name, m);
+            if (!added) {
+                throw std::runtime_error("Duplicate global symbol '" + s.name + "' in " + moduleName(objects[m], m) +
+                                         " (first defined in " + moduleName(objects[it->second], it->second) + ")");
+            }
+            prog.labels[s.name] = bases[m] + s.offset;
+        }
+    }
+
+    for (std::size_t m = 0; m < objects.size(); ++m) {
+        const ObjectFile& obj = objects[m];
+        const u32 base = bases[m];
+        prog.code.insert(prog.code.end(), obj.code.begin(), obj.code.end());
+        for (const ObjectSymbol& s : obj.symbols) {
+            if (!s.global) prog.labels[moduleName(obj, m) + ":" + s.name] = base + s.offset;
+        }
+        for (const Relocation& r : obj.relocations) {
+            u32 value = base + r.target;
+            if (!r.symbol.empty()) {
+                if (!definedIn.count(r.symbol)) {
+                    throw std::runtime_error("Undefined symbol '" + r.symbol + "' referenced from " + moduleName(obj, m));
+                }
+                value = prog.labels.at(r.symbol);
+            }
+            if (r.width == 2 && value > 0xFFFF) {
+                throw std::runtime_error("16-bit operand overflow in " + moduleName(obj, m) + " at offset " +
+                                         std::to_string(r.offset) + " (value " + std::to_string(value) + ")");
+            }
+            for (u8 i = 0; i < r.width; ++i) prog.code[base + r.offset + i] = static_cast<u8>(value >> (8 * i));
+        }
+    }
+    return prog;
+}
+
+ObjectCache::ObjectCache(std::string dir) : m_dir(std::move(dir)) {}
+
+std::string ObjectCache::pathFor(u64 sourceHash) const {
+    char file[48];
+    std::snprintf(file, sizeof file, "%016llx-r%u.vmo", static_cast<unsigned long long>(sourceHash), CACHE_REVISION);
+    return (std::filesystem::path(m_dir) / file).string();
+}
+
+ObjectFile ObjectCache::get(std::string_view source, const std::string& name) {
+    const u64 hash = contentHash64(reinterpret_cast<const unsigned char*>(source.data()), source.size());
+    const std::string path = pathFor(hash);
+    if (std::filesystem::exists(path)) {
+        try {
+            const std::vector<u8> bytes = loadBinaryFile(path);
+            ObjectFile obj = decodeObject(bytes.data(), bytes.size());
+            if (obj.sourceHash == hash && obj.sourceSize == source.size()) {
+                ++m_hits;
+                obj.name = name;
+                return obj;
+            }
+        } catch (const std::exception&) {
+            // damaged entry: reassemble and replace it below
+        }
+    }
+
+    ++m_misses;
+    ObjectFile obj = assembleObject(source, name);
+    std::filesystem::create_directories(m_dir);
+    // A name of our own, so concurrent builds sharing the cache never write
+    // the same temporary file; rename() then replaces the entry atomically.
+    char suffix[32];
+    std::snprintf(suffix, sizeof suffix, ".%016llx.tmp", static_cast<unsigned long long>(tempSuffix()));
+    const std::string tmpPath = path + suffix;
+    try {
+        writeObjectFile(tmpPath, obj);
+        std::filesystem::rename(tmpPath, path);
+    } catch (...) {
+        std::error_code ec;
+        std::filesystem::remove(tmpPath, ec);
+        throw;
+    }
+    return obj;
+}
+
+} // namespace vm
@@ -0,0 +1,81 @@
+#include "vm/MappedFile.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_HAVE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define VM_HAVE_MMAP 0
+#endif
+
+namespace vm {
+
+MappedFile::MappedFile(const std::string& path) {
+#if VM_HAVE_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open file: " + path);
+    struct stat st{};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Failed to stat file: " + path);
+    }
+    m_size = static_cast<std::size_t>(st.st_size);
+    if (m_size > 0) {
+        void* p = ::mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            ::close(fd);
+            throw std::runtime_error("Failed to map file: " + path);
+        }
+        // Images are consumed front to back exactly once.
+        ::madvise(p, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const unsigned char*>(p);
+        m_mapped = true;
+    }
+    ::close(fd); // the mapping keeps the file referenced
+#else
+    std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+    if (!ifs) throw std::runtime_error("Failed to open file: " + path);
+    m_fallback.resize(static_cast<std::size_t>(ifs.tellg()));
+    ifs.seekg(0);
+    ifs.read(reinterpret_cast<char*>(m_fallback.data()), static_cast<std::streamsize>(m_fallback.size()));
+    m_data = m_fallback.data();
+    m_size = m_fallback.size();
+#endif
+}
+
+MappedFile::~MappedFile() {
+#if VM_HAVE_MMAP
+    if (m_mapped) ::munmap(const_cast<unsigned char*>(m_data), m_size);
+#endif
+}
+
+std::shared_ptr<unsigned char> mapFileCopyOnWrite(const std::string& path, std::size_t offset, std::size_t length) {
+#if VM_HAVE_MMAP
+    const long hostPage = ::sysconf(_SC_PAGESIZE);
+    if (length == 0 || hostPage <= 0 || offset % static_cast<std::size_t>(hostPage) != 0) return nullptr;
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open file: " + path);
+    // Touching a mapped page past EOF raises SIGBUS, so a short file is left
+    // to the caller's read path, which can report it.
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < offset ||
+        static_cast<std::size_t>(st.st_size) - offset < length) {
+        ::close(fd);
+        return nullptr;
+    }
+    void* p = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, static_cast<off_t>(offset));
+    ::close(fd);
+    if (p == MAP_FAILED) return nullptr;
+    return std::shared_ptr<unsigned char>(static_cast<unsigned char*>(p), [length](unsigned char* q) { ::munmap(q, length); });
+#else
+    (void)path; (void)offset; (void)length;
+    return nullptr;
+#endif
+}
+
+} // namespace vm
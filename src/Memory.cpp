@@ -0,0 +1,215 @@
+#include "vm/Memory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdlib>
+#include <new>
+
+namespace vm {
+
+namespace {
+
+std::shared_ptr<u8> allocatePages(std::size_t count, bool zeroed) {
+    if (count == 0) return nullptr;
+    void* mem = zeroed ? std::calloc(count, RamMemory::PAGE_SIZE) : std::malloc(count * RamMemory::PAGE_SIZE);
+    if (!mem) throw std::bad_alloc();
+    return std::shared_ptr<u8>(static_cast<u8*>(mem), [](u8* p) { std::free(p); });
+}
+
+} // namespace
+
+// Page table leaf for one directory slot. Pages past the end of memory in the
+// last slot stay on the zero page and are never handed out.
+struct RamMemory::Chunk {
+    std::array<const u8*, CHUNK_PAGES> read;
+    std::array<u8*, CHUNK_PAGES> write{};
+    std::array<std::shared_ptr<u8>, CHUNK_PAGES> owner;
+    std::bitset<CHUNK_PAGES> shared;
+    std::bitset<CHUNK_PAGES> dirty;
+
+    Chunk() { read.fill(zeroPage()); }
+};
+
+RamMemory::RamMemory(std::size_t size, MemoryBackend backend)
+    : RamMemory(size, (size + PAGE_SIZE - 1) >> PAGE_BITS, backend) {
+    zero();
+}
+
+RamMemory::RamMemory(std::size_t size, std::size_t pages, MemoryBackend backend)
+    : m_size(size), m_pageCount(pages), m_backend(backend) {
+    // Leaves for untouched slots: every page reads as zero, every write faults.
+    static const std::array<const u8*, CHUNK_PAGES> zeroLeaf = [] {
+        std::array<const u8*, CHUNK_PAGES> leaf;
+        leaf.fill(zeroPage());
+        return leaf;
+    }();
+    static const std::array<u8*, CHUNK_PAGES> nullLeaf{};
+    const std::size_t chunks = (pages + CHUNK_MASK) >> CHUNK_BITS;
+    m_chunks.resize(chunks);
+    m_readDir.assign(chunks, zeroLeaf.data());
+    m_writeDir.assign(chunks, nullLeaf.data());
+}
+
+RamMemory::~RamMemory() = default;
+
+const u8* RamMemory::zeroPage() {
+    alignas(64) static const u8 page[PAGE_SIZE] = {};
+    return page;
+}
+
+std::size_t RamMemory::pagesInChunk(std::size_t chunk) const {
+    return std::min(CHUNK_PAGES, m_pageCount - (chunk << CHUNK_BITS));
+}
+
+RamMemory::Chunk& RamMemory::materialize(std::size_t chunk) {
+    std::unique_ptr<Chunk>& slot = m_chunks[chunk];
+    if (!slot) {
+        slot.reset(new Chunk());
+        if (m_untouchedDirty) {
+            for (std::size_t i = 0; i < pagesInChunk(chunk); ++i) slot->dirty.set(i);
+        }
+        m_readDir[chunk] = slot->read.data();
+        m_writeDir[chunk] = slot->write.data();
+    }
+    return *slot;
+}
+
+void RamMemory::adopt(std::shared_ptr<u8> block) {
+    for (std::size_t c = 0; c < m_chunks.size(); ++c) {
+        Chunk& ch = materialize(c);
+        for (std::size_t i = 0; i < pagesInChunk(c); ++i) {
+            u8* base = block.get() + (((c << CHUNK_BITS) + i) << PAGE_BITS);
+            ch.owner[i] = std::shared_ptr<u8>(block, base);
+            ch.read[i] = base;
+            ch.write[i] = base;
+        }
+        ch.shared.reset();
+        ch.dirty.reset();
+        for (std::size_t i = 0; i < pagesInChunk(c); ++i) ch.dirty.set(i);
+    }
+}
+
+u8* RamMemory::faultPage(std::size_t page) {
+    Chunk& ch = materialize(page >> CHUNK_BITS);
+    const std::size_t i = page & CHUNK_MASK;
+    if (ch.read[i] == zeroPage()) {
+        ch.owner[i] = allocatePages(1, true);
+        ch.read[i] = ch.owner[i].get();
+        ch.shared.reset(i);
+    } else if (ch.shared[i]) {
+        std::shared_ptr<u8> copy = allocatePages(1, false);
+        std::memcpy(copy.get(), ch.read[i], PAGE_SIZE);
+        ch.owner[i] = std::move(copy);
+        ch.read[i] = ch.owner[i].get();
+        ch.shared.reset(i);
+    }
+    ch.write[i] = ch.owner[i].get();
+    ch.dirty.set(i);
+    return ch.write[i];
+}
+
+void RamMemory::readBytes(std::size_t addr, u8* dst, std::size_t len) const {
+    bounds(addr, len);
+    while (len) {
+        const std::size_t off = addr & PAGE_MASK;
+        const std::size_t n = std::min(len, PAGE_SIZE - off);
+        std::memcpy(dst, readPage(addr >> PAGE_BITS) + off, n);
+        addr += n; dst += n; len -= n;
+    }
+}
+
+void RamMemory::writeBytes(std::size_t addr, const u8* src, std::size_t len) {
+    bounds(addr, len);
+    while (len) {
+        const std::size_t off = addr & PAGE_MASK;
+        const std::size_t n = std::min(len, PAGE_SIZE - off);
+        std::memcpy(writablePage(addr >> PAGE_BITS) + off, src, n);
+        addr += n; src += n; len -= n;
+    }
+}
+
+void RamMemory::zero() {
+    if (m_backend == MemoryBackend::Dense) {
+        // One calloc'd block for all pages: untouched pages stay unbacked by the OS.
+        adopt(allocatePages(m_pageCount, true));
+        return;
+    }
+    if (m_untouchedDirty) {
+        // Every page counts as dirty anyway, so whole slots can be dropped.
+        RamMemory fresh(m_size, m_pageCount, m_backend);
+        m_chunks.swap(fresh.m_chunks);
+        m_readDir.swap(fresh.m_readDir);
+        m_writeDir.swap(fresh.m_writeDir);
+        return;
+    }
+    // Keep slot leaves so pages that lose their contents are reported dirty.
+    for (auto& slot : m_chunks) {
+        if (!slot) continue;
+        for (std::size_t i = 0; i < CHUNK_PAGES; ++i) {
+            if (slot->read[i] == zeroPage()) continue;
+            slot->owner[i].reset();
+            slot->read[i] = zeroPage();
+            slot->write[i] = nullptr;
+            slot->dirty.set(i);
+        }
+        slot->shared.reset();
+    }
+}
+
+std::unique_ptr<RamMemory> RamMemory::fork() {
+    std::unique_ptr<RamMemory> child(new RamMemory(m_size, m_pageCount, m_backend));
+    for (std::size_t c = 0; c < m_chunks.size(); ++c) {
+        if (!m_chunks[c]) continue;
+        Chunk& mine = *m_chunks[c];
+        Chunk& theirs = child->materialize(c);
+        theirs.read = mine.read;
+        theirs.owner = mine.owner;
+        mine.write.fill(nullptr);
+        mine.shared.set();
+        theirs.shared.set();
+    }
+    return child;
+}
+
+std::size_t RamMemory::sharedPages() const {
+    std::size_t n = 0;
+    for (std::size_t c = 0; c < m_chunks.size(); ++c) {
+        if (!m_chunks[c]) continue;
+        for (std::size_t i = 0; i < pagesInChunk(c); ++i) n += m_chunks[c]->shared[i];
+    }
+    return n;
+}
+
+std::size_t RamMemory::residentPages() const {
+    std::size_t n = 0;
+    for (const auto& slot : m_chunks) {
+        if (!slot) continue;
+        n += static_cast<std::size_t>(std::count_if(slot->read.begin(), slot->read.end(), [](const u8* p) { return p != zeroPage(); }));
+    }
+    return n;
+}
+
+bool RamMemory::isDirty(std::size_t page) const {
+    const auto& slot = m_chunks[page >> CHUNK_BITS];
+    return slot ? slot->dirty[page & CHUNK_MASK] : m_untouchedDirty;
+}
+
+std::size_t RamMemory::dirtyPages() const {
+    std::size_t n = 0;
+    for (std::size_t c = 0; c < m_chunks.size(); ++c) {
+        n += m_chunks[c] ? m_chunks[c]->dirty.count() : (m_untouchedDirty ? pagesInChunk(c) : 0);
+    }
+    return n;
+}
+
+void RamMemory::clearDirty() {
+    for (auto& slot : m_chunks) {
+        if (!slot) continue;
+        slot->write.fill(nullptr);
+        slot->dirty.reset();
+    }
+    m_untouchedDirty = false;
+}
+
+} // namespace vm
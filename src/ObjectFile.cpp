@@ -0,0 +1,142 @@
+#include "vm/ObjectFile.hpp"
+#include "vm/Memory.hpp"
+#include "vm/ProgramLoader.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+
+namespace vm {
+
+namespace {
+
+constexpr char OBJECT_MAGIC[4] = {'V', 'M', 'O', '1'};
+constexpr u32 OBJECT_VERSION = 2;
+constexpr std::size_t HEADER_SIZE = 36;
+
+void put32(std::vector<u8>& out, u32 v) {
+    u8 b[4];
+    storeLE32(b, v);
+    out.insert(out.end(), b, b + 4);
+}
+
+void putName(std::vector<u8>& out, const std::string& name) {
+    if (name.size() > 0xFFFF) throw std::runtime_error("Symbol name too long: " + name.substr(0, 32) + "...");
+    u8 b[2];
+    storeLE16(b, static_cast<u16>(name.size()));
+    out.insert(out.end(), b, b + 2);
+    out.insert(out.end(), name.begin(), name.end());
+}
+
+// Bounds-checked reader over an encoded object.
+class Reader {
+public:
+    Reader(const u8* data, std::size_t size) : m_data(data), m_size(size) {}
+
+    const u8* take(std::size_t n) {
+        if (n > m_size - m_pos) throw std::runtime_error("Truncated object file");
+        const u8* p = m_data + m_pos;
+        m_pos += n;
+        return p;
+    }
+    u8 byte() { return *take(1); }
+    u32 word() { return loadLE32(take(4)); }
+    std::string name() {
+        const std::size_t len = loadLE16(take(2));
+        const u8* p = take(len);
+        return std::string(reinterpret_cast<const char*>(p), len);
+    }
+
+private:
+    const u8* m_data;
+    std::size_t m_size;
+    std::size_t m_pos{0};
+};
+
+} // namespace
+
+std::vector<unsigned char> encodeObject(const ObjectFile& obj) {
+    std::vector<u8> out(OBJECT_MAGIC, OBJECT_MAGIC + 4);
+    put32(out, OBJECT_VERSION);
+    put32(out, static_cast<u32>(obj.sourceHash));
+    put32(out, static_cast<u32>(obj.sourceHash >> 32));
+    put32(out, static_cast<u32>(obj.sourceSize));
+    put32(out, static_cast<u32>(obj.sourceSize >> 32));
+    put32(out, static_cast<u32>(obj.code.size()));
+    put32(out, static_cast<u32>(obj.symbols.size()));
+    put32(out, static_cast<u32>(obj.relocations.size()));
+    out.insert(out.end(), obj.code.begin(), obj.code.end());
+    for (const ObjectSymbol& s : obj.symbols) {
+        put32(out, s.offset);
+        out.push_back(s.global ? 1 : 0);
+        putName(out, s.name);
+    }
+    for (const Relocation& r : obj.relocations) {
+        put32(out, r.offset);
+        put32(out, r.target);
+        out.push_back(r.width);
+        putName(out, r.symbol);
+    }
+    return out;
+}
+
+ObjectFile decodeObject(const unsigned char* data, std::size_t size) {
+    if (size < HEADER_SIZE || !std::equal(OBJECT_MAGIC, OBJECT_MAGIC + 4, data)) {
+        throw std::runtime_error("Invalid object file magic");
+    }
+    Reader in(data, size);
+    in.take(4);
+    if (in.word() != OBJECT_VERSION) throw std::runtime_error("Unsupported object file version");
+    ObjectFile obj;
+    obj.sourceHash = in.word();
+    obj.sourceHash |= static_cast<u64>(in.word()) << 32;
+    obj.sourceSize = in.word();
+    obj.sourceSize |= static_cast<u64>(in.word()) << 32;
+    const u32 codeSize = in.word();
+    const u32 symbolCount = in.word();
+    const u32 relocCount = in.word();
+    const u8* code = in.take(codeSize);
+    obj.code.assign(code, code + codeSize);
+    for (u32 i = 0; i < symbolCount; ++i) {
+        ObjectSymbol s;
+        s.offset = in.word();
+        s.global = in.byte() != 0;
+        s.name = in.name();
+        obj.symbols.push_back(std::move(s));
+    }
+    for (u32 i = 0; i < relocCount; ++i) {
+        Relocation r;
+        r.offset = in.word();
+        r.target = in.word();
+        r.width = in.byte();
+        r.symbol = in.name();
+        if ((r.width != 2 && r.width != 4) || r.offset > codeSize || codeSize - r.offset < r.width) {
+            throw std::runtime_error("Invalid relocation in object file");
+        }
+        obj.relocations.push_back(std::move(r));
+    }
+    return obj;
+}
+
+void writeObjectFile(const std::string& path, const ObjectFile& obj) {
+    const std::vector<u8> bytes = encodeObject(obj);
+    std::ofstream ofs(path, std::ios::binary | std::ios::trunc);
+    if (!ofs) throw std::runtime_error("Failed to open object file for write: " + path);
+    ofs.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    if (!ofs) throw std::runtime_error("Failed to write object file: " + path);
+}
+
+ObjectFile readObjectFile(const std::string& path) {
+    const std::vector<u8> bytes = loadBinaryFile(path);
+    ObjectFile obj;
+    try {
+        obj = decodeObject(bytes.data(), bytes.size());
+    } catch (const std::exception& ex) {
+        throw std::runtime_error(path + ": " + ex.what());
+    }
+    obj.name = std::filesystem::path(path).stem().string();
+    return obj;
+}
+
+} // namespace vm
@@ -0,0 +1,211 @@
+#include "vm/Profiler.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace vm {
+
+u64& ExecutionProfile::counter(u32 pc) {
+    const std::size_t page = pc >> PAGE_BITS;
+    if (page >= m_pages.size()) m_pages.resize(page + 1);
+    if (!m_pages[page]) m_pages[page] = std::make_unique<std::array<u64, PAGE_SIZE>>();
+    return (*m_pages[page])[pc & (PAGE_SIZE - 1)];
+}
+
+u64 ExecutionProfile::count(u32 pc) const {
+    const std::size_t page = pc >> PAGE_BITS;
+    return page < m_pages.size() && m_pages[page] ? (*m_pages[page])[pc & (PAGE_SIZE - 1)] : 0;
+}
+
+u64 ExecutionProfile::total() const {
+    u64 sum = 0;
+    for (const auto& page : m_pages) {
+        if (!page) continue;
+        for (u64 c : *page) sum += c;
+    }
+    return sum;
+}
+
+std::vector<std::pair<u32, u64>> ExecutionProfile::entries() const {
+    std::vector<std::pair<u32, u64>> out;
+    for (std::size_t p = 0; p < m_pages.size(); ++p) {
+        if (!m_pages[p]) continue;
+        for (std::size_t i = 0; i < PAGE_SIZE; ++i) {
+            if (const u64 c = (*m_pages[p])[i]) out.emplace_back(static_cast<u32>((p << PAGE_BITS) | i), c);
+        }
+    }
+    return out;
+}
+
+void ExecutionProfile::clear() {
+    for (auto& page : m_pages) {
+        if (page) page->fill(0);
+    }
+}
+
+ExecutionProfile ExecutionProfile::loadFolded(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Failed to open profile: " + path);
+    return parseFolded(in);
+}
+
+ExecutionProfile ExecutionProfile::parseFolded(std::istream& in) {
+    ExecutionProfile profile;
+    std::string line;
+    std::size_t lineNo = 0;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        if (line.empty()) continue;
+        const auto space = line.rfind(' ');
+        const auto semi = space == std::string::npos ? space : line.rfind(';', space);
+        const std::size_t frame = semi == std::string::npos ? 0 : semi + 1;
+        if (space == std::string::npos || line.compare(frame, 2, "0x") != 0) {
+            throw std::runtime_error("profile line " + std::to_string(lineNo) + ": expected \"[<label>;]0x<pc> <count>\"");
+        }
+        const u32 pc = static_cast<u32>(std::stoul(line.substr(frame, space - frame), nullptr, 16));
+        profile.counter(pc) += std::stoull(line.substr(space + 1));
+    }
+    return profile;
+}
+
+SymbolMap SymbolMap::load(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) throw std::runtime_error("Failed to open symbol map: " + path);
+    return parse(in);
+}
+
+SymbolMap SymbolMap::parse(std::istream& in) {
+    SymbolMap map;
+    std::string line;
+    std::size_t lineNo = 0;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        const auto hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        std::istringstream tokens(line);
+        std::string addr, name;
+        if (!(tokens >> addr)) continue;
+        if (!(tokens >> name)) throw std::runtime_error("symbol map line " + std::to_string(lineNo) + ": missing label");
+        map.add(static_cast<u32>(std::stoul(addr, nullptr, 16)), name);
+    }
+    return map;
+}
+
+std::string SymbolMap::labelFor(u32 pc) const {
+    auto it = m_symbols.upper_bound(pc);
+    if (it != m_symbols.begin()) return std::prev(it)->second;
+    std::ostringstream os;
+    os << "0x" << std::hex << pc;
+    return os.str();
+}
+
+std::vector<LabelCount> aggregateByLabel(const ExecutionProfile& profile, const SymbolMap& symbols) {
+    std::vector<LabelCount> out;
+    std::unordered_map<std::string, std::size_t> index;
+    for (const auto& [pc, count] : profile.entries()) {
+        const std::string label = symbols.labelFor(pc);
+        auto it = index.find(label);
+        if (it == index.end()) {
+            index.emplace(label, out.size());
+            out.push_back({label, count});
+        } else {
+            out[it->second].count += count;
+        }
+    }
+    std::stable_sort(out.begin(), out.end(), [](const LabelCount& a, const LabelCount& b) { return a.count > b.count; });
+    return out;
+}
+
+void writeFoldedStacks(std::ostream& out, const ExecutionProfile& profile, const SymbolMap& symbols) {
+    for (const auto& [pc, count] : profile.entries()) {
+        std::ostringstream frame;
+        frame << "0x" << std::hex << pc;
+        const std::string label = symbols.labelFor(pc);
+        if (label != frame.str()) out << label << ';'; // unlabelled code: just the PC
+        out << frame.str() << ' ' << count << '\n';
+    }
+}
+
+namespace {
+
+// Just enough protobuf encoding for profile.proto.
+class ProtoWriter {
+public:
+    void varint(u64 v) {
+        while (v >= 0x80) {
+            m_buf.push_back(static_cast<char>((v & 0x7F) | 0x80));
+            v >>= 7;
+        }
+        m_buf.push_back(static_cast<char>(v));
+    }
+    void tag(u32 field, u32 wireType) { varint((u64{field} << 3) | wireType); }
+    void uint(u32 field, u64 v) { tag(field, 0); varint(v); }
+    void bytes(u32 field, const std::string& data) {
+        tag(field, 2);
+        varint(data.size());
+        m_buf += data;
+    }
+    void message(u32 field, const ProtoWriter& msg) { bytes(field, msg.m_buf); }
+
+    const std::string& data() const { return m_buf; }
+
+private:
+    std::string m_buf;
+};
+
+} // namespace
+
+void writePprof(std::ostream& out, const ExecutionProfile& profile, const SymbolMap& symbols) {
+    // Field numbers from perftools.profiles.Profile.
+    std::vector<std::string> strings{""};
+    std::unordered_map<std::string, u64> stringIds;
+    auto str = [&](const std::string& s) -> u64 {
+        auto it = stringIds.find(s);
+        if (it != stringIds.end()) return it->second;
+        strings.push_back(s);
+        return stringIds[s] = strings.size() - 1;
+    };
+
+    ProtoWriter prof;
+    ProtoWriter sampleType;
+    sampleType.uint(1, str("instructions"));
+    sampleType.uint(2, str("count"));
+    prof.message(1, sampleType);
+
+    std::unordered_map<std::string, u64> functionIds;
+    u64 locationId = 0;
+    for (const auto& [pc, count] : profile.entries()) {
+        const std::string label = symbols.labelFor(pc);
+        auto fn = functionIds.find(label);
+        if (fn == functionIds.end()) {
+            fn = functionIds.emplace(label, functionIds.size() + 1).first;
+            ProtoWriter f;
+            f.uint(1, fn->second);
+            f.uint(2, str(label));
+            f.uint(3, str(label));
+            prof.message(5, f);
+        }
+        ++locationId;
+        ProtoWriter line;
+        line.uint(1, fn->second);
+        ProtoWriter loc;
+        loc.uint(1, locationId);
+        loc.uint(3, pc);
+        loc.message(4, line);
+        prof.message(4, loc);
+
+        ProtoWriter sample;
+        sample.uint(1, locationId);
+        sample.uint(2, count);
+        prof.message(2, sample);
+    }
+    for (const std::string& s : strings) prof.bytes(6, s);
+    out.write(prof.data().data(), static_cast<std::streamsize>(prof.data().size()));
+}
+
+} // namespace vm
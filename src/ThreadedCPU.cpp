@@ -0,0 +1,357 @@
+#include "vm/ThreadedCPU.hpp"
+#include "vm/Memory.hpp"
+#include "vm/Logger.hpp"
+#include "vm/Opcodes.hpp"
+#include "vm/Profiler.hpp"
+
+#include <cstdint>
+
+namespace vm {
+
+namespace {
+
+// Mirrors the diagnostics SimpleCPU::step() emits for out-of-range registers.
+const char* badRegMessage(Opcode op) {
+    switch (op) {
+        case Opcode::LOAD: return "Invalid register in LOAD";
+        case Opcode::STORE: return "Invalid register in STORE";
+        case Opcode::LOADI: return "Invalid register in LOADI";
+        case Opcode::CMP: return "Invalid register in CMP";
+        case Opcode::PUSH: return "Stack overflow in PUSH";
+        case Opcode::POP: return "Stack underflow in POP";
+        case Opcode::OUT: return "Invalid register in OUT";
+        case Opcode::IN: return "Invalid register in IN";
+        default: return "Invalid register in ALU op";
+    }
+}
+
+// Select the handler for a decoded instruction, folding register validation
+// into translation so handlers never re-check operands.
+ThreadedCPU::Handler handlerFor(const DecodedInst& di, std::size_t regCount) {
+    auto ok = [&](u8 r) { return r < regCount; };
+    switch (di.op) {
+        case Opcode::HALT: return ThreadedCPU::H_HALT;
+        case Opcode::LOADI: return ok(di.a) ? ThreadedCPU::H_LOADI : ThreadedCPU::H_BADREG;
+        case Opcode::LOAD: return ok(di.a) && ok(di.b) ? ThreadedCPU::H_LOAD : ThreadedCPU::H_BADREG;
+        case Opcode::STORE: return ok(di.a) && ok(di.b) ? ThreadedCPU::H_STORE : ThreadedCPU::H_BADREG;
+        case Opcode::ADD:
+        case Opcode::SUB:
+        case Opcode::AND:
+        case Opcode::OR:
+        case Opcode::XOR: {
+            if (!(ok(di.a) && ok(di.b) && ok(di.c))) return ThreadedCPU::H_BADREG;
+            if (di.op == Opcode::ADD) return ThreadedCPU::H_ADD;
+            if (di.op == Opcode::SUB) return ThreadedCPU::H_SUB;
+            if (di.op == Opcode::AND) return ThreadedCPU::H_AND;
+            if (di.op == Opcode::OR) return ThreadedCPU::H_OR;
+            return ThreadedCPU::H_XOR;
+        }
+        case Opcode::CMP: return ok(di.a) && ok(di.b) ? ThreadedCPU::H_CMP : ThreadedCPU::H_BADREG;
+        case Opcode::PUSH: return ok(di.a) ? ThreadedCPU::H_PUSH : ThreadedCPU::H_BADREG;
+        case Opcode::POP: return ok(di.a) ? ThreadedCPU::H_POP : ThreadedCPU::H_BADREG;
+        case Opcode::JMP: return ThreadedCPU::H_JMP;
+        case Opcode::JZ: return ThreadedCPU::H_JZ;
+        case Opcode::JNZ: return ThreadedCPU::H_JNZ;
+        case Opcode::CALL: return ThreadedCPU::H_CALL;
+        case Opcode::RET: return ThreadedCPU::H_RET;
+        case Opcode::OUT: return ok(di.a) ? ThreadedCPU::H_OUT : ThreadedCPU::H_BADREG;
+        case Opcode::IN: return ok(di.a) ? ThreadedCPU::H_IN : ThreadedCPU::H_BADREG;
+    }
+    return ThreadedCPU::H_BADREG; // unreachable: the decoder rejects unknown opcodes
+}
+
+} // namespace
+
+ThreadedCPU::ThreadedCPU(IMemory& mem, ILogger* logger)
+    : SimpleCPU(mem, logger) {
+    execute(0, &m_handlers);
+#if VM_COMPUTED_GOTO
+    m_miss.handler = m_handlers[H_TRANSLATE];
+#else
+    m_miss.handler = H_TRANSLATE;
+#endif
+    m_pages.resize((mem.size() + PAGE_SLOTS - 1) >> PAGE_BITS);
+}
+
+void ThreadedCPU::reset() {
+    SimpleCPU::reset();
+    flushTranslations();
+}
+
+RunOutcome ThreadedCPU::run(std::size_t maxSteps) {
+    if (m_halted) return outcome(false);
+    PerfRunClock clock(m_perf);
+    // Trace records are produced by the interpreter loop.
+    if (m_trace) return SimpleCPU::run(maxSteps);
+    return execute(maxSteps, nullptr);
+}
+
+void ThreadedCPU::invalidateCode(std::size_t addr, std::size_t len) {
+    SimpleCPU::invalidateCode(addr, len);
+    if (len >= PAGE_SLOTS) { flushTranslations(); return; }
+    const std::size_t first = addr >= DecodeCache::MAX_SPAN - 1 ? addr - (DecodeCache::MAX_SPAN - 1) : 0;
+    for (std::size_t p = first; p < addr + len; ++p) {
+        Slot* s = slotFor(static_cast<u32>(p));
+        if (s != &m_miss && s->handler != m_miss.handler && p + s->inst.size > addr) {
+            s->handler = m_miss.handler;
+        }
+    }
+}
+
+void ThreadedCPU::flushTranslations() {
+    for (auto& page : m_pages) page.reset();
+}
+
+ThreadedCPU::Slot& ThreadedCPU::translate(u32 pc) {
+    const DecodedInst di = decode(pc); // throws like SimpleCPU on bad PC/opcode
+    auto& page = m_pages[pc >> PAGE_BITS];
+    if (!page) {
+        page.reset(new Slot[PAGE_SLOTS]);
+        for (std::size_t i = 0; i < PAGE_SLOTS; ++i) page[i].handler = m_miss.handler;
+    }
+    Slot& slot = page[pc & (PAGE_SLOTS - 1)];
+    slot.inst = di;
+#if VM_COMPUTED_GOTO
+    slot.handler = m_handlers[handlerFor(di, REG_COUNT)];
+#else
+    slot.handler = handlerFor(di, REG_COUNT);
+#endif
+    markCode(pc, di.size);
+    return slot;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic" // computed goto is a GNU extension
+#endif
+
+RunOutcome ThreadedCPU::execute(std::size_t maxSteps, const HandlerRef** exportTable) {
+    std::size_t budget = maxSteps ? maxSteps : SIZE_MAX;
+    Slot* slot = nullptr;
+    // Checked at every dispatch after the first, so a run starting on a
+    // breakpoint executes it.
+    const bool debug = hasBreakpoints() || hasWatches();
+    ExecutionProfile* const profile = m_profile;
+    m_watchPending = false;
+
+    auto setZ = [&](u32 val) {
+        if (val == 0) m_flags |= 0x1; else m_flags &= ~0x1u;
+    };
+
+#define VM_LOG_INFO(msg) do { if (m_logger) log("info", msg); } while (0)
+
+#if VM_COMPUTED_GOTO
+    static const void* const table[H_COUNT] = {
+        &&L_H_TRANSLATE, &&L_H_BADREG,
+        &&L_H_HALT, &&L_H_LOADI, &&L_H_LOAD, &&L_H_STORE,
+        &&L_H_ADD, &&L_H_SUB, &&L_H_AND, &&L_H_OR, &&L_H_XOR, &&L_H_CMP,
+        &&L_H_PUSH, &&L_H_POP, &&L_H_JMP, &&L_H_JZ, &&L_H_JNZ, &&L_H_CALL, &&L_H_RET,
+        &&L_H_OUT, &&L_H_IN,
+    };
+    if (exportTable) { *exportTable = table; return RunOutcome::Halted; }
+#define VM_HANDLER(h) L_##h:
+#define VM_DISPATCH() do {                                                           \
+        perfRetired(slot->inst.op);                                                  \
+        if (budget-- == 0) return outcome(false);                                    \
+        if (debug && (m_watchPending || isBreakpoint(m_pc))) return outcome(true);   \
+        if (profile) profile->hit(m_pc);                                             \
+        slot = slotFor(m_pc);                                                        \
+        goto *slot->handler;                                                         \
+    } while (0)
+#define VM_REDISPATCH() goto *slot->handler
+    if (budget-- == 0) return outcome(false);
+    if (profile) profile->hit(m_pc);
+    slot = slotFor(m_pc);
+    goto *slot->handler;
+#else
+    if (exportTable) { *exportTable = nullptr; return RunOutcome::Halted; }
+#define VM_HANDLER(h) case h:
+#define VM_DISPATCH() continue
+#define VM_REDISPATCH() goto redispatch
+    for (bool first = true;; first = false) {
+        if (!first) perfRetired(slot->inst.op);
+        if (budget-- == 0) return outcome(false);
+        if (debug && !first && (m_watchPending || isBreakpoint(m_pc))) return outcome(true);
+        if (profile) profile->hit(m_pc);
+        slot = slotFor(m_pc);
+    redispatch:
+        switch (slot->handler) {
+#endif
+
+    VM_HANDLER(H_TRANSLATE) {
+        slot = &translate(m_pc);
+        VM_REDISPATCH();
+    }
+    VM_HANDLER(H_BADREG) {
+        fault(badRegMessage(slot->inst.op));
+        return outcome(false);
+    }
+    VM_HANDLER(H_HALT) {
+        m_halted = true;
+        m_pc += slot->inst.size;
+        perfRetired(Opcode::HALT);
+        VM_LOG_INFO("HALT");
+        return outcome(false);
+    }
+    VM_HANDLER(H_LOADI) {
+        const DecodedInst& di = slot->inst;
+        m_regs[di.a] = di.imm;
+        setZ(di.imm);
+        m_pc += di.size;
+        VM_LOG_INFO("LOADI");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_LOAD) {
+        const DecodedInst& di = slot->inst;
+        const u32 val = m_mem.read32(m_regs[di.b] + (di.imm & 0xFFFF));
+        m_regs[di.a] = val;
+        setZ(val);
+        m_pc += di.size;
+        VM_LOG_INFO("LOAD");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_STORE) {
+        const DecodedInst& di = slot->inst;
+        const u32 addr = m_regs[di.a] + (di.imm & 0xFFFF);
+        const u32 next = m_pc + di.size;
+        m_mem.write32(addr, m_regs[di.b]);
+        noteWrite(addr, 4);
+        m_pc = next;
+        VM_LOG_INFO("STORE");
+        VM_DISPATCH();
+    }
+#define VM_ALU(h, expr)                                         \
+    VM_HANDLER(h) {                                             \
+        const DecodedInst& di = slot->inst;                     \
+        const u32 a = m_regs[di.b];                             \
+        const u32 b = m_regs[di.c];                             \
+        const u32 res = (expr);                                 \
+        m_regs[di.a] = res;                                     \
+        setZ(res);                                              \
+        m_pc += di.size;                                        \
+        VM_LOG_INFO("ALU");                                     \
+        VM_DISPATCH();                                          \
+    }
+    VM_ALU(H_ADD, a + b)
+    VM_ALU(H_SUB, a - b)
+    VM_ALU(H_AND, a & b)
+    VM_ALU(H_OR, a | b)
+    VM_ALU(H_XOR, a ^ b)
+#undef VM_ALU
+    VM_HANDLER(H_CMP) {
+        const DecodedInst& di = slot->inst;
+        setZ(m_regs[di.a] == m_regs[di.b] ? 0 : 1); // Z=1 if equal
+        m_pc += di.size;
+        VM_LOG_INFO("CMP");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_PUSH) {
+        const DecodedInst& di = slot->inst;
+        if (m_sp < 4) {
+            fault("Stack overflow in PUSH");
+            return outcome(false);
+        }
+        const u32 next = m_pc + di.size;
+        m_sp -= 4;
+        m_mem.write32(m_sp, m_regs[di.a]);
+        noteWrite(m_sp, 4);
+        perfStack();
+        m_pc = next;
+        VM_LOG_INFO("PUSH");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_POP) {
+        const DecodedInst& di = slot->inst;
+        if (m_sp + 4 > m_mem.size()) {
+            fault("Stack underflow in POP");
+            return outcome(false);
+        }
+        m_regs[di.a] = m_mem.read32(m_sp);
+        m_sp += 4;
+        setZ(m_regs[di.a]);
+        m_pc += di.size;
+        VM_LOG_INFO("POP");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_JMP) {
+        m_pc = slot->inst.imm;
+        VM_LOG_INFO("JMP");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_JZ) {
+        perfBranch(m_flags & 0x1);
+        m_pc = (m_flags & 0x1) ? slot->inst.imm : m_pc + slot->inst.size;
+        VM_LOG_INFO("JZ");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_JNZ) {
+        perfBranch(!(m_flags & 0x1));
+        m_pc = !(m_flags & 0x1) ? slot->inst.imm : m_pc + slot->inst.size;
+        VM_LOG_INFO("JNZ");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_CALL) {
+        const DecodedInst& di = slot->inst;
+        if (m_sp < 4) {
+            fault("Stack overflow in CALL");
+            return outcome(false);
+        }
+        const u32 ret = m_pc + di.size;
+        const u32 target = di.imm;
+        m_sp -= 4;
+        m_mem.write32(m_sp, ret);
+        noteWrite(m_sp, 4);
+        perfStack();
+        m_pc = target;
+        VM_LOG_INFO("CALL");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_RET) {
+        if (m_sp + 4 > m_mem.size()) {
+            fault("Stack underflow in RET");
+            return outcome(false);
+        }
+        m_pc = m_mem.read32(m_sp);
+        m_sp += 4;
+        VM_LOG_INFO("RET");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_OUT) {
+        out(m_regs[slot->inst.a]);
+        m_pc += slot->inst.size;
+        VM_LOG_INFO("OUT");
+        VM_DISPATCH();
+    }
+    VM_HANDLER(H_IN) {
+        const DecodedInst& di = slot->inst;
+        u32 input = 0;
+        if (!in(input)) {
+            fault("IN failed to read from stdin");
+            return outcome(false);
+        }
+        m_regs[di.a] = input;
+        setZ(input);
+        m_pc += di.size;
+        VM_LOG_INFO("IN");
+        VM_DISPATCH();
+    }
+
+#if !VM_COMPUTED_GOTO
+        default:
+            fault("Unimplemented opcode encountered");
+            return outcome(false);
+        }
+    }
+#endif
+
+#undef VM_HANDLER
+#undef VM_DISPATCH
+#undef VM_REDISPATCH
+#undef VM_LOG_INFO
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+} // namespace vm
@@ -0,0 +1,114 @@
+#include "vm/Trace.hpp"
+#include "vm/Decoder.hpp"
+#include "vm/Memory.hpp"
+#include "vm/Opcodes.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+namespace vm {
+
+namespace {
+
+constexpr char TRACE_MAGIC[4] = {'V', 'M', 'T', 'R'};
+constexpr u32 TRACE_VERSION = 1;
+
+void encode(const TraceRecord& r, u8* out) {
+    storeLE32(out + 0, static_cast<u32>(r.seq));
+    storeLE32(out + 4, static_cast<u32>(r.seq >> 32));
+    storeLE32(out + 8, r.pc);
+    storeLE32(out + 12, r.imm);
+    out[16] = r.op; out[17] = r.a; out[18] = r.b; out[19] = r.c;
+    out[20] = r.dstReg; out[21] = r.flags; out[22] = r.halted; out[23] = r.reserved;
+    storeLE32(out + 24, r.dstValue);
+    storeLE32(out + 28, r.sp);
+}
+
+TraceRecord decode(const u8* in) {
+    TraceRecord r;
+    r.seq = static_cast<u64>(loadLE32(in + 0)) | (static_cast<u64>(loadLE32(in + 4)) << 32);
+    r.pc = loadLE32(in + 8);
+    r.imm = loadLE32(in + 12);
+    r.op = in[16]; r.a = in[17]; r.b = in[18]; r.c = in[19];
+    r.dstReg = in[20]; r.flags = in[21]; r.halted = in[22]; r.reserved = in[23];
+    r.dstValue = loadLE32(in + 24);
+    r.sp = loadLE32(in + 28);
+    return r;
+}
+
+} // namespace
+
+TraceBuffer::TraceBuffer(std::size_t capacity) {
+    std::size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    m_slots = std::make_unique<TraceRecord[]>(cap);
+    m_mask = cap - 1;
+}
+
+std::vector<TraceRecord> TraceBuffer::records() const {
+    const u64 head = written();
+    const u64 count = head < capacity() ? head : capacity();
+    std::vector<TraceRecord> out;
+    out.reserve(static_cast<std::size_t>(count));
+    for (u64 seq = head - count; seq < head; ++seq) out.push_back(m_slots[seq & m_mask]);
+    return out;
+}
+
+void writeTraceFile(const std::string& path, const std::vector<TraceRecord>& records) {
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs) throw std::runtime_error("Failed to open trace for write: " + path);
+    u8 header[20];
+    std::copy(TRACE_MAGIC, TRACE_MAGIC + 4, header);
+    storeLE32(header + 4, TRACE_VERSION);
+    storeLE32(header + 8, static_cast<u32>(sizeof(TraceRecord)));
+    storeLE32(header + 12, static_cast<u32>(records.size()));
+    storeLE32(header + 16, static_cast<u32>(static_cast<u64>(records.size()) >> 32));
+    ofs.write(reinterpret_cast<const char*>(header), sizeof(header));
+    std::vector<u8> buf(records.size() * sizeof(TraceRecord));
+    for (std::size_t i = 0; i < records.size(); ++i) encode(records[i], buf.data() + i * sizeof(TraceRecord));
+    ofs.write(reinterpret_cast<const char*>(buf.data()), static_cast<std::streamsize>(buf.size()));
+    if (!ofs) throw std::runtime_error("Failed to write trace: " + path);
+}
+
+std::vector<TraceRecord> readTraceFile(const std::string& path) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) throw std::runtime_error("Failed to open trace for read: " + path);
+    u8 header[20];
+    ifs.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (ifs.gcount() != static_cast<std::streamsize>(sizeof(header)) || !std::equal(TRACE_MAGIC, TRACE_MAGIC + 4, header)) {
+        throw std::runtime_error("Invalid trace magic");
+    }
+    if (loadLE32(header + 4) != TRACE_VERSION || loadLE32(header + 8) != sizeof(TraceRecord)) {
+        throw std::runtime_error("Unsupported trace version");
+    }
+    const u64 count = static_cast<u64>(loadLE32(header + 12)) | (static_cast<u64>(loadLE32(header + 16)) << 32);
+    std::vector<TraceRecord> records;
+    u8 rec[sizeof(TraceRecord)];
+    for (u64 i = 0; i < count; ++i) {
+        ifs.read(reinterpret_cast<char*>(rec), sizeof(rec));
+        if (ifs.gcount() != static_cast<std::streamsize>(sizeof(rec))) throw std::runtime_error("Truncated trace file");
+        records.push_back(decode(rec));
+    }
+    return records;
+}
+
+std::string formatTraceRecord(const TraceRecord& rec) {
+    DecodedInst di;
+    di.op = static_cast<Opcode>(rec.op);
+    di.a = rec.a;
+    di.b = rec.b;
+    di.c = rec.c;
+    di.imm = rec.imm;
+    std::ostringstream os;
+    os << '#' << rec.seq << " 0x" << std::hex << std::setw(4) << std::setfill('0') << rec.pc << std::dec
+       << "  " << std::left << std::setw(22) << std::setfill(' ') << disassemble(di) << std::right;
+    if (rec.dstReg != TraceRecord::NO_REG) os << " R" << static_cast<int>(rec.dstReg) << '=' << rec.dstValue;
+    os << " SP=0x" << std::hex << rec.sp << std::dec << " Z=" << (rec.flags & 0x1);
+    if (rec.halted) os << " HALTED";
+    return os.str();
+}
+
+} // namespace vm
@@ -1,13 +1,33 @@
 #include "vm/Instance.hpp"
+#include "vm/Assembler.hpp"
+#include "vm/Layout.hpp"
+#include "vm/Linker.hpp"
 #include "vm/Logger.hpp"
 #include "vm/Opcodes.hpp"
 #include "vm/Decoder.hpp"
 #include "vm/Memory.hpp"
+#include "vm/ThreadedCPU.hpp"
+#include "vm/JitCPU.hpp"
+#include "vm/Bus.hpp"
+#include "vm/Trace.hpp"
+#include "vm/ConsoleSink.hpp"
+#include "vm/BatchRunner.hpp"
+#include "vm/Checksum.hpp"
+#include "vm/MappedFile.hpp"
+#include "vm/ProgramLoader.hpp"
+#include "vm/Profiler.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cstdio>
+#include <sstream>
 #include <vector>
 #include <iostream>
 
 using namespace vm;
 
+static int g_failures = 0;
+
 static void emit32(std::vector<unsigned char>& out, unsigned v) {
     out.push_back(static_cast<unsigned char>(v & 0xFF));
     out.push_back(static_cast<unsigned char>((v >> 8) & 0xFF));
@@ -41,7 +61,7 @@ int main() {
         if (cpu->getReg(0) == 7) {
             std::cout << "[TEST] ✓ Test 1 passed" << std::endl;
         } else {
-            std::cout << "[TEST] ✗ Test 1 failed: R0=" << cpu->getReg(0) << std::endl;
+            ++g_failures; std::cout << "[TEST] ✗ Test 1 failed: R0=" << cpu->getReg(0) << std::endl;
         }
     }
     
@@ -76,7 +96,7 @@ int main() {
         if (cpu->getReg(2) == 15) {
             std::cout << "[TEST] ✓ Test 2 passed" << std::endl;
         } else {
-            std::cout << "[TEST] ✗ Test 2 failed: R2=" << cpu->getReg(2) << std::endl;
+            ++g_failures; std::cout << "[TEST] ✗ Test 2 failed: R2=" << cpu->getReg(2) << std::endl;
         }
     }
     
@@ -97,10 +117,1152 @@ int main() {
         if (disasm == "LOADI R0, 42") {
             std::cout << "[TEST] ✓ Test 3 passed: " << disasm << std::endl;
         } else {
-            std::cout << "[TEST] ✗ Test 3 failed: " << disasm << std::endl;
+            ++g_failures; std::cout << "[TEST] ✗ Test 3 failed: " << disasm << std::endl;
         }
     }
     
+    // Test 4: Decoded-instruction cache sees self-modifying code
+    {
+        std::cout << "[TEST] Test 4: Decode cache invalidation" << std::endl;
+        const unsigned target = 28;
+        std::vector<unsigned char> prog;
+        prog.push_back(static_cast<unsigned char>(Opcode::CALL)); emit32(prog, target);
+        prog.push_back(static_cast<unsigned char>(Opcode::LOADI)); prog.push_back(0x01); emit32(prog, 99);
+        prog.push_back(static_cast<unsigned char>(Opcode::LOADI)); prog.push_back(0x02); emit32(prog, 0);
+        // STORE [R2 + target+2], R1 -- patches the immediate of the LOADI at target
+        prog.push_back(static_cast<unsigned char>(Opcode::STORE)); prog.push_back(0x02); prog.push_back(0x01);
+        prog.push_back(static_cast<unsigned char>((target + 2) & 0xFF)); prog.push_back(static_cast<unsigned char>((target + 2) >> 8));
+        prog.push_back(static_cast<unsigned char>(Opcode::CALL)); emit32(prog, target);
+        prog.push_back(static_cast<unsigned char>(Opcode::HALT));
+        // target: LOADI R0, 1; RET
+        prog.push_back(static_cast<unsigned char>(Opcode::LOADI)); prog.push_back(0x00); emit32(prog, 1);
+        prog.push_back(static_cast<unsigned char>(Opcode::RET));
+
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded}) {
+            VMConfig cfg; cfg.memSize = 64 * 1024; cfg.name = "test4"; cfg.engine = engine;
+            VMInstance instance(cfg);
+            instance.powerOn();
+            instance.loadProgramBytes(prog);
+            instance.runUntilHalt();
+            const u32 afterStore = instance.cpu()->getReg(0);
+
+            // Patch again through the debugger path and re-run CALL target; LOADI.
+            instance.memWrite(target + 2, {7, 0, 0, 0});
+            instance.cpu()->setPC(22);
+            instance.runSteps(2);
+            const u32 afterMemWrite = instance.cpu()->getReg(0);
+
+            if (afterStore == 99 && afterMemWrite == 7) {
+                std::cout << "[TEST] ✓ Test 4 passed (engine " << static_cast<int>(engine) << ")" << std::endl;
+            } else {
+                ++g_failures; std::cout << "[TEST] ✗ Test 4 failed: R0=" << afterStore << "/" << afterMemWrite << std::endl;
+            }
+        }
+    }
+
+    // Test 5: Threaded engine matches the interpreter, including step budgets and errors
+    {
+        std::cout << "[TEST] Test 5: Threaded engine equivalence" << std::endl;
+        // R0 = 50; loop: R3 += R0 via CALL acc; store/load R3 at 0x2000; PUSH/POP; R0 -= 1 until 0
+        std::vector<unsigned char> prog;
+        auto op = [&](Opcode o) { prog.push_back(static_cast<unsigned char>(o)); };
+        auto reg = [&](unsigned char r) { prog.push_back(r); };
+        op(Opcode::LOADI); reg(0); emit32(prog, 50);
+        op(Opcode::LOADI); reg(1); emit32(prog, 1);
+        op(Opcode::LOADI); reg(2); emit32(prog, 0);
+        op(Opcode::LOADI); reg(5); emit32(prog, 0x2000);
+        const unsigned loop = static_cast<unsigned>(prog.size());
+        op(Opcode::CALL); const std::size_t callFix = prog.size(); emit32(prog, 0);
+        op(Opcode::STORE); reg(5); reg(3); prog.push_back(4); prog.push_back(0);
+        op(Opcode::LOAD); reg(4); reg(5); prog.push_back(4); prog.push_back(0);
+        op(Opcode::PUSH); reg(4);
+        op(Opcode::POP); reg(6);
+        op(Opcode::SUB); reg(0); reg(0); reg(1);
+        op(Opcode::CMP); reg(0); reg(2);
+        op(Opcode::JNZ); emit32(prog, loop);
+        prog.push_back(0x31); prog.push_back(9); // POP R9: invalid register -> error halt
+        const unsigned acc = static_cast<unsigned>(prog.size());
+        op(Opcode::ADD); reg(3); reg(3); reg(0);
+        op(Opcode::XOR); reg(7); reg(7); reg(3);
+        op(Opcode::RET);
+        for (int i = 0; i < 4; ++i) prog[callFix + i] = static_cast<unsigned char>((acc >> (8 * i)) & 0xFF);
+
+        auto snapshot = [&](CpuEngine engine, std::size_t steps) {
+            VMConfig cfg; cfg.memSize = 64 * 1024; cfg.name = "test5"; cfg.engine = engine;
+            VMInstance instance(cfg);
+            instance.powerOn();
+            instance.loadProgramBytes(prog);
+            if (steps) instance.runSteps(steps); else instance.runUntilHalt();
+            std::vector<u32> state;
+            const ICPU* cpu = instance.cpu();
+            for (std::size_t r = 0; r < cpu->regCount(); ++r) state.push_back(cpu->getReg(r));
+            state.push_back(cpu->getPC()); state.push_back(cpu->getSP()); state.push_back(cpu->getFlags());
+            return state;
+        };
+        bool same = true;
+        for (std::size_t steps : {std::size_t{0}, std::size_t{1}, std::size_t{37}, std::size_t{250}}) {
+            same = same && snapshot(CpuEngine::Interpreter, steps) == snapshot(CpuEngine::Threaded, steps);
+            same = same && snapshot(CpuEngine::Interpreter, steps) == snapshot(CpuEngine::Jit, steps);
+        }
+        {
+            RamMemory ram(64);
+            ThreadedCPU cpu(ram);
+            ram.write8(0, static_cast<u8>(Opcode::LOADI)); ram.write8(1, 3); ram.write32(2, 0);
+            cpu.run(0); // LOADI R3, 0 then HALT (zeroed memory)
+            same = same && cpu.getReg(3) == 0 && (cpu.getFlags() & 1) && cpu.getPC() == 7;
+        }
+        if (same) {
+            std::cout << "[TEST] ✓ Test 5 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 5 failed: engines diverged" << std::endl;
+        }
+    }
+
+    // Test 6: JIT tier matches the interpreter on hot loops, step budgets and self-modifying code
+    {
+        std::cout << "[TEST] Test 6: JIT equivalence" << std::endl;
+        auto build = [](bool patchCode) {
+            std::vector<unsigned char> prog;
+            auto op = [&](Opcode o) { prog.push_back(static_cast<unsigned char>(o)); };
+            auto reg = [&](unsigned char r) { prog.push_back(r); };
+            op(Opcode::LOADI); reg(0); emit32(prog, 100);
+            op(Opcode::LOADI); reg(1); emit32(prog, 1);
+            op(Opcode::LOADI); reg(2); emit32(prog, 0);
+            const unsigned loop = static_cast<unsigned>(prog.size());
+            op(Opcode::LOADI); reg(5); emit32(prog, 7);
+            op(Opcode::ADD); reg(6); reg(6); reg(5);
+            op(Opcode::PUSH); reg(6);
+            op(Opcode::POP); reg(4);
+            op(Opcode::CALL); const std::size_t callFix = prog.size(); emit32(prog, 0);
+            // Either patch the LOADI immediate above or write to a data word
+            const unsigned dst = patchCode ? loop + 2 : 0x2000;
+            op(Opcode::STORE); reg(2); reg(0);
+            prog.push_back(static_cast<unsigned char>(dst & 0xFF)); prog.push_back(static_cast<unsigned char>(dst >> 8));
+            op(Opcode::LOAD); reg(3); reg(2);
+            prog.push_back(static_cast<unsigned char>(dst & 0xFF)); prog.push_back(static_cast<unsigned char>(dst >> 8));
+            op(Opcode::SUB); reg(0); reg(0); reg(1);
+            op(Opcode::CMP); reg(0); reg(2);
+            op(Opcode::JNZ); emit32(prog, loop);
+            op(Opcode::HALT);
+            const unsigned fn = static_cast<unsigned>(prog.size());
+            op(Opcode::XOR); reg(7); reg(7); reg(6);
+            op(Opcode::RET);
+            for (int i = 0; i < 4; ++i) prog[callFix + i] = static_cast<unsigned char>((fn >> (8 * i)) & 0xFF);
+            return prog;
+        };
+        auto runOn = [](const std::vector<unsigned char>& prog, bool jit, std::size_t steps, std::size_t* compiled) {
+            RamMemory ram(64 * 1024);
+            BusMemory bus(ram);
+            for (std::size_t i = 0; i < prog.size(); ++i) ram.write8(i, prog[i]);
+            std::unique_ptr<SimpleCPU> cpu;
+            if (jit) cpu = std::make_unique<JitCPU>(bus); else cpu = std::make_unique<SimpleCPU>(bus);
+            cpu->run(steps);
+            std::vector<u32> state;
+            for (std::size_t r = 0; r < cpu->regCount(); ++r) state.push_back(cpu->getReg(r));
+            state.push_back(cpu->getPC()); state.push_back(cpu->getSP()); state.push_back(cpu->getFlags());
+            state.push_back(ram.read32(0x2000));
+            if (compiled && jit) *compiled = static_cast<JitCPU*>(cpu.get())->compiledBlocks();
+            return state;
+        };
+        bool same = true;
+        std::size_t compiled = 0;
+        for (bool patchCode : {false, true}) {
+            const auto prog = build(patchCode);
+            for (std::size_t steps : {std::size_t{0}, std::size_t{1}, std::size_t{57}, std::size_t{333}, std::size_t{1000}}) {
+                same = same && runOn(prog, false, steps, nullptr) == runOn(prog, true, steps, patchCode ? nullptr : &compiled);
+            }
+        }
+        const bool native = !VM_JIT_X86_64 || compiled > 0;
+        if (same && native) {
+            std::cout << "[TEST] ✓ Test 6 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 6 failed: same=" << same << " compiled=" << compiled << std::endl;
+        }
+    }
+
+    // Test 7: fused superinstructions leave the same state as single-stepping
+    {
+        std::cout << "[TEST] Test 7: Fused instruction pairs" << std::endl;
+        std::vector<unsigned char> prog;
+        auto op = [&](Opcode o) { prog.push_back(static_cast<unsigned char>(o)); };
+        auto reg = [&](unsigned char r) { prog.push_back(r); };
+        op(Opcode::LOADI); reg(0); emit32(prog, 10);
+        op(Opcode::LOADI); reg(2); emit32(prog, 0);
+        const unsigned loop = static_cast<unsigned>(prog.size());
+        op(Opcode::LOADI); reg(1); emit32(prog, 3);       // LOADI + ADD
+        op(Opcode::ADD); reg(3); reg(3); reg(1);
+        op(Opcode::PUSH); reg(3); op(Opcode::PUSH); reg(0); // PUSH + PUSH
+        op(Opcode::POP); reg(4); op(Opcode::POP); reg(5);   // POP + POP
+        op(Opcode::LOADI); reg(1); emit32(prog, 1);       // LOADI + SUB
+        op(Opcode::SUB); reg(0); reg(0); reg(1);
+        op(Opcode::CMP); reg(0); reg(2);                   // CMP + JZ (falls through)
+        op(Opcode::JZ); const std::size_t exitFix = prog.size(); emit32(prog, 0);
+        op(Opcode::CMP); reg(0); reg(2);                   // CMP + JNZ (taken)
+        op(Opcode::JNZ); emit32(prog, loop);
+        const unsigned done = static_cast<unsigned>(prog.size());
+        op(Opcode::HALT);
+        for (int i = 0; i < 4; ++i) prog[exitFix + i] = static_cast<unsigned char>((done >> (8 * i)) & 0xFF);
+
+        auto state = [](const SimpleCPU& cpu, const RamMemory& ram) {
+            std::vector<u32> s;
+            for (std::size_t r = 0; r < cpu.regCount(); ++r) s.push_back(cpu.getReg(r));
+            s.push_back(cpu.getPC()); s.push_back(cpu.getSP()); s.push_back(cpu.getFlags());
+            s.push_back(ram.read32(cpu.getSP() - 4)); s.push_back(ram.read32(cpu.getSP() - 8));
+            return s;
+        };
+        bool same = true;
+        bool counted = true;
+        for (std::size_t steps : {std::size_t{0}, std::size_t{1}, std::size_t{2}, std::size_t{3}, std::size_t{41}, std::size_t{96}}) {
+            RamMemory ramA(4096), ramB(4096);
+            for (std::size_t i = 0; i < prog.size(); ++i) { ramA.write8(i, prog[i]); ramB.write8(i, prog[i]); }
+            SimpleCPU fused(ramA), stepped(ramB);
+            fused.run(steps);
+            for (std::size_t n = 0; (steps == 0 || n < steps) && stepped.getPC() != done + 1; ++n) stepped.step();
+            same = same && state(fused, ramA) == state(stepped, ramB);
+            if (steps == 0) {
+                for (Fusion f : {Fusion::CmpJz, Fusion::CmpJnz, Fusion::LoadiAlu, Fusion::PushPush, Fusion::PopPop}) {
+                    counted = counted && fused.fusionCount(f) > 0;
+                }
+                counted = counted && stepped.fusionCount(Fusion::CmpJnz) == 0;
+            }
+        }
+        if (same && counted) {
+            std::cout << "[TEST] ✓ Test 7 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 7 failed: same=" << same << " counted=" << counted << std::endl;
+        }
+    }
+
+    // Test 8: specialised RAM path still routes device windows through the bus
+    {
+        std::cout << "[TEST] Test 8: Bus fast path and device windows" << std::endl;
+        struct Latch : IDevice {
+            u32 value{0};
+            const char* name() const override { return "Latch"; }
+            std::size_t size() const override { return 4; }
+            u8 read8(std::size_t) override { return static_cast<u8>(value); }
+            u16 read16(std::size_t) override { return static_cast<u16>(value); }
+            u32 read32(std::size_t) override { return value + 1; }
+            void write8(std::size_t, u8 v) override { value = v; }
+            void write16(std::size_t, u16 v) override { value = v; }
+            void write32(std::size_t, u32 v) override { value = v; }
+        };
+        RamMemory ram(4096);
+        BusMemory bus(ram);
+        auto latch = std::make_shared<Latch>();
+        bus.mapDevice(0x100, latch);
+        std::vector<unsigned char> prog;
+        prog.push_back(static_cast<unsigned char>(Opcode::LOADI)); prog.push_back(0); emit32(prog, 41);
+        prog.push_back(static_cast<unsigned char>(Opcode::LOADI)); prog.push_back(1); emit32(prog, 0xFE);
+        // STORE [R1 + 2], R0 -> device; LOAD R2, [R1 + 2] -> device; STORE/LOAD [R1 + 6] -> RAM
+        for (unsigned char off : {2, 6}) {
+            prog.push_back(static_cast<unsigned char>(Opcode::STORE)); prog.push_back(1); prog.push_back(0); prog.push_back(off); prog.push_back(0);
+            prog.push_back(static_cast<unsigned char>(Opcode::LOAD)); prog.push_back(off == 2 ? 2 : 3); prog.push_back(1); prog.push_back(off); prog.push_back(0);
+        }
+        prog.push_back(static_cast<unsigned char>(Opcode::HALT));
+        for (std::size_t i = 0; i < prog.size(); ++i) ram.write8(i, prog[i]);
+        SimpleCPU cpu(bus);
+        cpu.run();
+        // Page-table dispatch: a window straddling a page boundary and one owning whole pages
+        RamMemory bigRam(64 * 1024);
+        BusMemory bigBus(bigRam);
+        auto edge = std::make_shared<Latch>();
+        bigBus.mapDevice(0x1FFE, edge);
+        struct Window : Latch { std::size_t size() const override { return 2 * BusMemory::PAGE_SIZE; } };
+        auto window = std::make_shared<Window>();
+        bigBus.mapDevice(0x4000, window);
+        bigBus.write32(0x1FFA, 7);            // RAM just below the edge device
+        bigBus.write32(0x1FFE, 9);            // edge device
+        bigBus.write32(0x5000, 11);           // inside the large window
+        bigBus.write32(0x6000, 13);           // RAM right after it
+        const bool paged = bigRam.read32(0x1FFA) == 7 && bigBus.read32(0x1FFE) == 10 && edge->value == 9 &&
+                           window->value == 11 && bigRam.read32(0x5000) == 0 && bigBus.fastRead32(0x6000) == 13 &&
+                           bigBus.readPtr(0x1FF0, 4) != nullptr && bigBus.readPtr(0x1FFC, 4) == nullptr &&
+                           bigBus.readPtr(0x4800, 4) == nullptr && bigBus.writePtr(0x2002, 4) != nullptr &&
+                           bigBus.readPtr(0x2FFE, 4) == nullptr;
+        if (paged && latch->value == 41 && cpu.getReg(2) == 42 && cpu.getReg(3) == 41 && ram.read32(0x104) == 41 && ram.read32(0x100) == 0) {
+            std::cout << "[TEST] ✓ Test 8 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 8 failed" << std::endl;
+        }
+    }
+
+    // Test 9: binary trace ring records every retired instruction on all engines
+    {
+        std::cout << "[TEST] Test 9: Binary execution trace" << std::endl;
+        std::vector<unsigned char> prog;
+        auto op = [&](Opcode o) { prog.push_back(static_cast<unsigned char>(o)); };
+        op(Opcode::LOADI); prog.push_back(0); emit32(prog, 3);
+        op(Opcode::LOADI); prog.push_back(1); emit32(prog, 1);
+        const unsigned loop = static_cast<unsigned>(prog.size());
+        op(Opcode::SUB); prog.push_back(0); prog.push_back(0); prog.push_back(1);
+        op(Opcode::JNZ); emit32(prog, loop);
+        op(Opcode::HALT);
+        // 2 LOADI + 3 * (SUB + JNZ) + HALT = 9 instructions; a ring of 4 keeps the last 4
+        bool ok = true;
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit}) {
+            VMConfig cfg; cfg.memSize = 4096; cfg.engine = engine; cfg.traceRecords = 4;
+            VMInstance instance(cfg);
+            instance.powerOn();
+            instance.loadProgramBytes(prog);
+            instance.runUntilHalt();
+            const auto recs = instance.trace()->records();
+            ok = ok && instance.trace()->written() == 9 && recs.size() == 4 && recs.front().seq == 5;
+            ok = ok && recs[2].op == static_cast<u8>(Opcode::JNZ) && recs[2].dstReg == TraceRecord::NO_REG;
+            ok = ok && recs[1].dstReg == 0 && recs[1].dstValue == 0 && (recs[1].flags & 0x1);
+            ok = ok && recs[3].halted && recs[3].pc == loop + 9;
+        }
+        VMConfig cfg; cfg.memSize = 4096; cfg.traceRecords = 16;
+        VMInstance instance(cfg);
+        instance.powerOn();
+        instance.loadProgramBytes(prog);
+        instance.runSteps(3);
+        const char* path = "test_trace.vmtr";
+        instance.writeTrace(path);
+        const auto back = readTraceFile(path);
+        std::remove(path);
+        ok = ok && back.size() == 3 && back[2].pc == loop && back[2].dstValue == 2 && back[0].imm == 3 &&
+             formatTraceRecord(back[0]).find("LOADI R0, 3") != std::string::npos;
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 9 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 9 failed" << std::endl;
+        }
+    }
+
+    // Test 10: buffered console sink keeps ordering across writer hand-offs and syncs
+    {
+        std::cout << "[TEST] Test 10: Console sink ordering" << std::endl;
+        std::ostringstream expected;
+        std::ostringstream asyncOut, syncOut;
+        {
+            ConsoleSink async(asyncOut, ConsoleSink::Mode::Async);
+            ConsoleSink direct(syncOut, ConsoleSink::Mode::Sync);
+            // Enough output to fill several buffers and exercise queue back-pressure
+            for (u32 v = 0; v < 200000; ++v) {
+                async.writeValue(v * 2654435761u);
+                direct.writeValue(v * 2654435761u);
+                expected << v * 2654435761u << '\n';
+                if (v == 150000) async.sync();
+            }
+            async.writeValue(4294967295u);
+            direct.writeValue(4294967295u);
+            expected << 4294967295u << '\n';
+        } // destructor drains the queue
+        std::ostringstream smallOut;
+        ConsoleSink shortRun(smallOut);
+        shortRun.writeValue(7);
+        const bool pendingBeforeSync = smallOut.str().empty();
+        shortRun.sync();
+        if (asyncOut.str() == expected.str() && syncOut.str() == expected.str() && pendingBeforeSync && smallOut.str() == "7\n") {
+            std::cout << "[TEST] ✓ Test 10 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 10 failed" << std::endl;
+        }
+    }
+
+    // Test 11: batch runner isolates per-job console I/O across worker threads
+    {
+        std::cout << "[TEST] Test 11: Batch runner" << std::endl;
+        // IN R0; IN R1; ADD R2, R0, R1; OUT R2; HALT
+        const std::vector<unsigned char> prog = {
+            static_cast<unsigned char>(Opcode::IN), 0, static_cast<unsigned char>(Opcode::IN), 1,
+            static_cast<unsigned char>(Opcode::ADD), 2, 0, 1, static_cast<unsigned char>(Opcode::OUT), 2,
+            static_cast<unsigned char>(Opcode::HALT)};
+        const char* path = "test_batch.bin";
+        {
+            std::ofstream ofs(path, std::ios::binary);
+            ofs.write(reinterpret_cast<const char*>(prog.data()), static_cast<std::streamsize>(prog.size()));
+        }
+        // LOADI R9, 1: invalid register -> Fault
+        const char* faultPath = "test_batch_fault.bin";
+        {
+            std::vector<unsigned char> fault = {static_cast<unsigned char>(Opcode::LOADI), 9};
+            emit32(fault, 1);
+            fault.push_back(static_cast<unsigned char>(Opcode::HALT));
+            std::ofstream ofs(faultPath, std::ios::binary);
+            ofs.write(reinterpret_cast<const char*>(fault.data()), static_cast<std::streamsize>(fault.size()));
+        }
+        std::ostringstream manifest;
+        for (int i = 0; i < 64; ++i) manifest << path << " input=" << i << ',' << 1000 * i << (i % 3 == 0 ? " engine=jit" : "") << "\n";
+        manifest << "# comment line\n" << "missing_program.bin mem=4k\n";
+        for (const char* engine : {"interp", "threaded", "jit"}) manifest << faultPath << " engine=" << engine << "\n";
+        manifest << path << " input=1,2 steps=2\n";
+        std::istringstream mis(manifest.str());
+        const auto batch = parseBatchManifest(mis);
+        const BatchSummary summary = runBatch(batch, 4);
+        std::remove(path);
+        std::remove(faultPath);
+        bool ok = batch.size() == 69 && batch[64].memSize == 4096 && batch[3].engine == CpuEngine::Jit;
+        for (int i = 0; ok && i < 64; ++i) {
+            const BatchResult& r = summary.results[static_cast<std::size_t>(i)];
+            ok = r.ok && r.output == std::to_string(1001 * i) + "\n" && r.regs[2] == static_cast<u32>(1001 * i);
+        }
+        ok = ok && !summary.results[64].ok && summary.results[64].error.find("missing_program.bin") != std::string::npos;
+        for (std::size_t i = 65; i < 68; ++i) {
+            ok = ok && !summary.results[i].ok && summary.results[i].outcome == "fault" && summary.results[i].error == "fault";
+        }
+        ok = ok && !summary.results[68].ok && summary.results[68].outcome == "step_limit" &&
+             summary.results[68].error == "step limit reached" && summary.results[0].outcome == "halted";
+        std::ostringstream json;
+        writeBatchJson(json, batch, summary);
+        ok = ok && json.str().find("\"jobs\": 69") != std::string::npos && json.str().find("\"failed\": 5") != std::string::npos &&
+             json.str().find("\"outcome\": \"fault\"") != std::string::npos;
+        // A negative count must not wrap to an unlimited run or a huge RAM size.
+        auto manifestError = [](const std::string& text) {
+            std::istringstream in(text);
+            try { parseBatchManifest(in); } catch (const std::exception& ex) { return std::string(ex.what()); }
+            return std::string();
+        };
+        ok = ok && manifestError("a.bin\na.bin steps=-1\n") == "manifest line 2: invalid steps" &&
+             manifestError("a.bin mem=-4k\n") == "manifest line 1: invalid mem" &&
+             manifestError("a.bin steps=+5\n") == "manifest line 1: invalid steps" && manifestError("a.bin steps=5 mem=8k\n").empty();
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 11 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 11 failed" << std::endl;
+        }
+    }
+
+    // Test 12: copy-on-write fork of a warm instance
+    {
+        std::cout << "[TEST] Test 12: Instance fork" << std::endl;
+        RamMemory base(3 * RamMemory::PAGE_SIZE + 100);
+        base.write32(0x10, 1);
+        base.write32(RamMemory::PAGE_SIZE - 2, 0xA1B2C3D4); // straddles pages 0 and 1
+        auto child = base.fork();
+        const bool shared = base.sharedPages() == 4 && child->sharedPages() == 4;
+        child->write32(0x10, 2);
+        base.write32(2 * RamMemory::PAGE_SIZE, 3);
+        bool ok = shared && base.read32(0x10) == 1 && child->read32(0x10) == 2 &&
+                  child->read32(RamMemory::PAGE_SIZE - 2) == 0xA1B2C3D4 && child->read32(2 * RamMemory::PAGE_SIZE) == 0 &&
+                  base.read32(2 * RamMemory::PAGE_SIZE) == 3 && child->readPage(1) == base.readPage(1) &&
+                  child->readPage(0) != base.readPage(0);
+
+        // LOADI R1, 0x2000; LOADI R2, 5; STORE [R1+0], R2; IN R0;
+        // LOAD R3, [R1+0]; ADD R3, R3, R0; STORE [R1+0], R3; OUT R3; HALT
+        const std::vector<unsigned char> prog = {
+            static_cast<unsigned char>(Opcode::LOADI), 1, 0x00, 0x20, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 2, 5, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::STORE), 1, 2, 0, 0,
+            static_cast<unsigned char>(Opcode::IN), 0,
+            static_cast<unsigned char>(Opcode::LOAD), 3, 1, 0, 0,
+            static_cast<unsigned char>(Opcode::ADD), 3, 3, 0,
+            static_cast<unsigned char>(Opcode::STORE), 1, 3, 0, 0,
+            static_cast<unsigned char>(Opcode::OUT), 3,
+            static_cast<unsigned char>(Opcode::HALT)};
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit}) {
+            VMConfig cfg;
+            cfg.engine = engine;
+            std::ostringstream parentOut;
+            cfg.consoleOut = &parentOut;
+            VMInstance templ(cfg);
+            templ.powerOn();
+            templ.loadProgramBytes(prog);
+            templ.runSteps(3); // warm: stopped right before IN
+            templ.addBreakpoint(0x1000);
+            for (u32 in = 10; ok && in <= 30; in += 10) {
+                std::ostringstream out;
+                std::istringstream input(std::to_string(in));
+                auto vm = templ.fork(&out, &input);
+                ok = vm->cpu()->getPC() == 17 && vm->cpu()->getReg(1) == 0x2000 && vm->breakpoints().count(0x1000) == 1;
+                vm->runUntilHalt();
+                const auto cell = vm->memRead(0x2000, 4);
+                ok = ok && out.str() == std::to_string(5 + in) + "\n" && cell[0] == 5 + in;
+            }
+            const auto cell = templ.memRead(0x2000, 4);
+            ok = ok && templ.cpu()->getPC() == 17 && cell[0] == 5 && parentOut.str().empty();
+        }
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 12 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 12 failed" << std::endl;
+        }
+    }
+
+    // Test 13: mapped image loading with an in-place header check
+    {
+        std::cout << "[TEST] Test 13: Mapped program loading" << std::endl;
+        // HALT; LOADI R0, 77; OUT R0; HALT -- entry skips the leading HALT
+        const std::vector<unsigned char> payload = {
+            static_cast<unsigned char>(Opcode::HALT),
+            static_cast<unsigned char>(Opcode::LOADI), 0, 77, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::OUT), 0,
+            static_cast<unsigned char>(Opcode::HALT)};
+        ProgramHeaderV2 hdr{{'V', 'M', 'B', '1'}, 2, 1, static_cast<std::uint32_t>(payload.size()),
+                            adler32(payload.data(), payload.size())};
+        auto writeImage = [&](const char* path, const ProgramHeaderV2& h) {
+            std::ofstream ofs(path, std::ios::binary);
+            ofs.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            ofs.write(reinterpret_cast<const char*>(payload.data()), static_cast<std::streamsize>(payload.size()));
+        };
+        writeImage("test_image.bin", hdr);
+        std::ostringstream out;
+        VMConfig cfg;
+        cfg.consoleOut = &out;
+        VMInstance instance(cfg);
+        instance.powerOn();
+        instance.loadProgramFile("test_image.bin", /*verify=*/true);
+        const bool entryOk = instance.cpu()->getPC() == 1;
+        instance.runUntilHalt();
+        bool ok = entryOk && out.str() == "77\n" && instance.memRead(1, 1)[0] == static_cast<unsigned char>(Opcode::LOADI);
+
+        hdr.checksum ^= 1;
+        writeImage("test_image.bin", hdr);
+        bool rejected = false;
+        try {
+            instance.loadProgramFile("test_image.bin", /*verify=*/true);
+        } catch (const std::exception&) {
+            rejected = true;
+        }
+        instance.attachRamDisk("test_image.bin");
+        const auto disk = instance.memRead(static_cast<u32>(cfg.memSize - 256 - sizeof(hdr) - payload.size()), 4);
+        { std::ofstream empty("test_empty.bin", std::ios::binary); }
+        MappedFile emptyFile("test_empty.bin");
+        ok = ok && rejected && disk[0] == 'V' && disk[3] == '1' && emptyFile.size() == 0;
+        std::remove("test_image.bin");
+        std::remove("test_empty.bin");
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 13 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 13 failed" << std::endl;
+        }
+    }
+
+    // Test 14: SNP2 base + delta snapshots driven by dirty-page tracking
+    {
+        std::cout << "[TEST] Test 14: Incremental snapshots" << std::endl;
+        RamMemory ram(4 * RamMemory::PAGE_SIZE);
+        ram.clearDirty();
+        ram.write32(RamMemory::PAGE_SIZE + 8, 5);
+        ram.write8(3 * RamMemory::PAGE_SIZE, 1);
+        bool ok = ram.dirtyPages() == 2 && ram.isDirty(1) && ram.isDirty(3) && !ram.isDirty(0) &&
+                  ram.read32(RamMemory::PAGE_SIZE + 8) == 5;
+
+        auto fileSize = [](const char* path) {
+            std::ifstream f(path, std::ios::binary | std::ios::ate);
+            return static_cast<std::size_t>(f.tellg());
+        };
+        for (SnapshotEncoding enc : {SnapshotEncoding::Raw, SnapshotEncoding::Rle, SnapshotEncoding::Mappable}) {
+            const char* path = "test_snapshot.snp";
+            VMConfig cfg;
+            VMInstance vm1(cfg);
+            vm1.powerOn();
+            std::vector<unsigned char> pattern(300);
+            for (std::size_t i = 0; i < pattern.size(); ++i) pattern[i] = static_cast<unsigned char>(i * 7);
+            vm1.memWrite(0x3000, pattern);
+            vm1.saveSnapshot(path, enc);
+            const std::size_t baseSize = fileSize(path);
+            vm1.memWrite(0x5000, {1, 2, 3, 4});
+            vm1.cpu()->setReg(3, 9);
+            vm1.appendSnapshotDelta(path);
+            const std::size_t deltaSize = fileSize(path) - baseSize;
+            vm1.memWrite(0x3000, {0xEE});
+            vm1.appendSnapshotDelta(path);
+
+            VMInstance vm2(cfg);
+            vm2.powerOn();
+            vm2.memWrite(0x8000, {0x55}); // must be cleared by the base frame
+            vm2.loadSnapshot(path);
+            const auto a = vm2.memRead(0x3000, 300);
+            const auto b = vm2.memRead(0x5000, 4);
+            ok = ok && a[0] == 0xEE && std::equal(a.begin() + 1, a.end(), pattern.begin() + 1) && b[3] == 4 &&
+                 vm2.memRead(0x8000, 1)[0] == 0 && vm2.cpu()->getReg(3) == 9;
+            if (enc == SnapshotEncoding::Mappable) {
+                // Restored RAM may be the file mapping: writing it and saving over the same path must be safe.
+                ok = ok && baseSize % RamMemory::PAGE_SIZE == 0 && baseSize >= cfg.memSize;
+                vm2.memWrite(0x3001, {0x42});
+                vm2.saveSnapshot(path, enc);
+                auto child = vm2.fork();
+                ok = ok && child->memRead(0x3001, 1)[0] == 0x42 && vm2.memRead(0x5000, 4)[3] == 4;
+                vm1.loadSnapshot(path);
+                ok = ok && vm1.memRead(0x3000, 2)[1] == 0x42;
+
+                // A Mappable file cut short must be rejected, not mapped (SIGBUS on touch).
+                const char* cutPath = "test_snapshot_cut.snp";
+                vm2.saveSnapshot(cutPath, enc);
+                std::filesystem::resize_file(cutPath, fileSize(cutPath) - 8192);
+                VMInstance vm3(cfg);
+                vm3.powerOn();
+                std::string err;
+                try { vm3.loadSnapshot(cutPath); } catch (const std::exception& ex) { err = ex.what(); }
+                ok = ok && err == "Truncated snapshot";
+                std::remove(cutPath);
+            } else {
+                const bool compress = enc == SnapshotEncoding::Rle;
+                ok = ok && baseSize < (compress ? 600u : 4300u) && deltaSize < (compress ? 200u : 4200u);
+            }
+
+            // Deltas only go to the file last saved/appended/loaded, unchanged since.
+            const char* otherPath = "test_snapshot_other.snp";
+            auto appendRejected = [&](VMInstance& vm, const char* target) {
+                try { vm.appendSnapshotDelta(target); } catch (const std::exception&) { return true; }
+                return false;
+            };
+            VMInstance vm4(cfg);
+            vm4.powerOn();
+            ok = ok && appendRejected(vm4, path);
+            vm4.saveSnapshot(path, enc);
+            vm4.saveSnapshot(otherPath, enc);
+            vm4.memWrite(0x5000, {7});
+            ok = ok && appendRejected(vm4, path);
+            vm4.appendSnapshotDelta(otherPath);
+            { std::ofstream grow(otherPath, std::ios::binary | std::ios::app); grow.put(0); }
+            ok = ok && appendRejected(vm4, otherPath);
+            std::remove(otherPath);
+            std::remove(path);
+        }
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 14 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 14 failed" << std::endl;
+        }
+    }
+
+    // Test 15: vectorised, streamed, combined and parallel Adler-32 agree with the definition
+    {
+        std::cout << "[TEST] Test 15: Adler-32" << std::endl;
+        auto reference = [](const unsigned char* p, std::size_t n) {
+            std::uint32_t a = 1, b = 0;
+            for (std::size_t i = 0; i < n; ++i) {
+                a = (a + p[i]) % 65521;
+                b = (b + a) % 65521;
+            }
+            return (b << 16) | a;
+        };
+        std::vector<unsigned char> data(3 * 1024 * 1024 + 77);
+        std::uint32_t seed = 12345;
+        for (auto& byte : data) {
+            seed = seed * 1103515245u + 12345u;
+            byte = static_cast<unsigned char>(seed >> 16);
+        }
+        std::fill(data.begin() + 1000, data.begin() + 20000, 0xFF); // worst case for the deferred sums
+        bool ok = adler32(data.data(), 0) == 1 && adler32Combine(1, 1, 0) == 1;
+        for (std::size_t len : {1u, 15u, 16u, 31u, 33u, 5551u, 5552u, 5553u, 70001u}) {
+            for (std::size_t off : {0u, 1u, 7u}) {
+                ok = ok && adler32(data.data() + off, len) == reference(data.data() + off, len);
+            }
+        }
+        const std::uint32_t whole = reference(data.data(), data.size());
+        const std::size_t cut = 1234567;
+        ok = ok && adler32(data.data() + cut, data.size() - cut, adler32(data.data(), cut)) == whole &&
+             adler32Combine(adler32(data.data(), cut), adler32(data.data() + cut, data.size() - cut), data.size() - cut) == whole &&
+             adler32Parallel(data.data(), data.size(), 3) == whole && adler32Parallel(data.data(), data.size()) == whole;
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 15 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 15 failed" << std::endl;
+        }
+    }
+
+    // Test 16: sparse memory backend only materialises written pages
+    {
+        std::cout << "[TEST] Test 16: Sparse memory" << std::endl;
+        const std::size_t big = std::size_t{1} << 30;
+        RamMemory sparse(big, MemoryBackend::Sparse);
+        bool ok = sparse.residentPages() == 0 && sparse.read32(big - 4) == 0 && sparse.isZeroFill(7);
+        sparse.write32(big - 8, 0xCAFEF00D);
+        sparse.write32(RamMemory::PAGE_SIZE - 2, 0x01020304); // straddles pages 0 and 1
+        auto child = sparse.fork();
+        child->write8(12345 * RamMemory::PAGE_SIZE, 9);
+        ok = ok && sparse.residentPages() == 3 && child->residentPages() == 4 &&
+             sparse.read32(big - 8) == 0xCAFEF00D && child->read32(RamMemory::PAGE_SIZE - 2) == 0x01020304 &&
+             sparse.read8(12345 * RamMemory::PAGE_SIZE) == 0 && child->read8(12345 * RamMemory::PAGE_SIZE) == 9;
+        sparse.zero();
+        ok = ok && sparse.residentPages() == 0 && sparse.read32(big - 8) == 0 && child->read32(big - 8) == 0xCAFEF00D;
+
+        // Same guest run on both backends: PUSH/POP hit the top page, STORE a low one
+        // LOADI R0, 7; LOADI R1, 0x4000; STORE [R1+0], R0; PUSH R0; POP R2; LOAD R3, [R1+0]; OUT R3; HALT
+        const std::vector<unsigned char> prog = {
+            static_cast<unsigned char>(Opcode::LOADI), 0, 7, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 1, 0x00, 0x40, 0, 0,
+            static_cast<unsigned char>(Opcode::STORE), 1, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::PUSH), 0,
+            static_cast<unsigned char>(Opcode::POP), 2,
+            static_cast<unsigned char>(Opcode::LOAD), 3, 1, 0, 0,
+            static_cast<unsigned char>(Opcode::OUT), 3,
+            static_cast<unsigned char>(Opcode::HALT)};
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Jit}) {
+            std::ostringstream out;
+            VMConfig cfg;
+            cfg.memSize = 256 * 1024 * 1024;
+            cfg.memBackend = MemoryBackend::Sparse;
+            cfg.engine = engine;
+            cfg.consoleOut = &out;
+            VMInstance vm(cfg);
+            vm.powerOn();
+            vm.loadProgramBytes(prog);
+            vm.runUntilHalt();
+            ok = ok && out.str() == "7\n" && vm.cpu()->getReg(2) == 7;
+        }
+        std::istringstream manifest("a.bin mem=1g backend=sparse\n");
+        const auto jobs = parseBatchManifest(manifest);
+        ok = ok && jobs.size() == 1 && jobs[0].memBackend == MemoryBackend::Sparse && jobs[0].memSize == big;
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 16 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 16 failed" << std::endl;
+        }
+    }
+
+    // Test 17: breakpoints stop every engine's run loop; run() reports why it returned
+    {
+        std::cout << "[TEST] Test 17: Run outcomes and breakpoints" << std::endl;
+        // 0: LOADI R0,0; 6: LOADI R1,1; 12: LOADI R2,1000
+        // 18: ADD R0,R0,R1; 22: CMP R0,R2; 25: JNZ 18; 30: HALT
+        std::vector<unsigned char> prog = {
+            static_cast<unsigned char>(Opcode::LOADI), 0, 0, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 1, 1, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 2, 0xE8, 0x03, 0, 0,
+            static_cast<unsigned char>(Opcode::ADD), 0, 0, 1,
+            static_cast<unsigned char>(Opcode::CMP), 0, 2,
+            static_cast<unsigned char>(Opcode::JNZ), 18, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::HALT)};
+        bool ok = true;
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit}) {
+            VMConfig cfg;
+            cfg.memSize = 64 * 1024;
+            cfg.engine = engine;
+            VMInstance vm(cfg);
+            vm.powerOn();
+            vm.loadProgramBytes(prog);
+            ok = ok && vm.runSteps(3) == RunOutcome::StepLimit && vm.cpu()->getPC() == 18;
+            // JNZ is the second half of a fusable CMP+JNZ pair.
+            vm.addBreakpoint(25);
+            for (u32 i = 1; i <= 50; ++i) {
+                ok = ok && vm.runUntilHalt() == RunOutcome::Breakpoint && vm.cpu()->getPC() == 25 && vm.cpu()->getReg(0) == i;
+            }
+            vm.removeBreakpoint(25);
+            ok = ok && vm.runSteps(1000) == RunOutcome::StepLimit;
+            // Added while the loop is compiled / translated.
+            vm.addBreakpoint(18);
+            const u32 before = vm.cpu()->getReg(0);
+            ok = ok && vm.runUntilHalt() == RunOutcome::Breakpoint && vm.cpu()->getPC() == 18 && vm.cpu()->getReg(0) <= before + 1;
+            vm.removeBreakpoint(18);
+            ok = ok && vm.runUntilHalt() == RunOutcome::Halted && vm.cpu()->halted() && vm.cpu()->getReg(0) == 1000 &&
+                 vm.runUntilHalt() == RunOutcome::Halted;
+
+            prog[1] = 9; // LOADI R9: invalid register
+            vm.loadProgramBytes(prog);
+            ok = ok && vm.runUntilHalt() == RunOutcome::Fault && vm.cpu()->halted();
+            prog[1] = 0;
+            if (!ok) std::cout << "[TEST]   engine " << static_cast<int>(engine) << " failed" << std::endl;
+        }
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 17 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 17 failed" << std::endl;
+        }
+    }
+
+    // Test 18: watchpoints stop runs after the accessing instruction, on every engine
+    {
+        std::cout << "[TEST] Test 18: Watchpoints" << std::endl;
+        // 0: LOADI R0,0; 6: LOADI R1,1; 12: LOADI R2,100; 18: LOADI R5,0x4000
+        // 24: ADD R0,R0,R1; 28: STORE [R5+0],R0; 33: STORE [R5+4],R1; 38: CMP R0,R2; 41: JNZ 24
+        // 46: LOAD R3,[R5+0x10]; 51: HALT
+        const std::vector<unsigned char> prog = {
+            static_cast<unsigned char>(Opcode::LOADI), 0, 0, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 1, 1, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 2, 100, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 5, 0x00, 0x40, 0, 0,
+            static_cast<unsigned char>(Opcode::ADD), 0, 0, 1,
+            static_cast<unsigned char>(Opcode::STORE), 5, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::STORE), 5, 1, 4, 0,
+            static_cast<unsigned char>(Opcode::CMP), 0, 2,
+            static_cast<unsigned char>(Opcode::JNZ), 24, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOAD), 3, 5, 0x10, 0,
+            static_cast<unsigned char>(Opcode::HALT)};
+        bool ok = true;
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit}) {
+            VMConfig cfg;
+            cfg.memSize = 64 * 1024;
+            cfg.engine = engine;
+            VMInstance vm(cfg);
+            vm.powerOn();
+            vm.loadProgramBytes(prog);
+            // Only the first store to 0x4004 changes it.
+            vm.addWatch(0x4004, 4, WatchKind::Change);
+            ok = ok && vm.runUntilHalt() == RunOutcome::Watchpoint && vm.lastWatchHit().pc == 33 &&
+                 vm.lastWatchHit().oldValue == 0 && vm.lastWatchHit().newValue == 1 && vm.cpu()->getReg(0) == 1;
+            vm.addWatch(0x4000, 4, WatchKind::Write);
+            for (u32 i = 2; i <= 40; ++i) {
+                ok = ok && vm.runUntilHalt() == RunOutcome::Watchpoint && vm.lastWatchHit().pc == 28 &&
+                     vm.lastWatchHit().newValue == i && vm.lastWatchHit().kind == WatchKind::Write &&
+                     vm.cpu()->getPC() == 33;
+            }
+            vm.removeWatch(0x4000, 4, WatchKind::Write);
+            // Instruction fetches are not data reads.
+            vm.addWatch(24, 8, WatchKind::Read);
+            vm.addWatch(0x4010, 4, WatchKind::Read);
+            ok = ok && vm.runUntilHalt() == RunOutcome::Watchpoint && vm.lastWatchHit().pc == 46 &&
+                 vm.lastWatchHit().addr == 0x4010 && vm.cpu()->getReg(0) == 100;
+            ok = ok && vm.runUntilHalt() == RunOutcome::Halted;
+            if (!ok) std::cout << "[TEST]   engine " << static_cast<int>(engine) << " failed" << std::endl;
+        }
+
+        RamMemory ram(64 * 1024);
+        BusMemory bus(ram);
+        bus.addWatch(0x2002, 1, WatchKind::Read);
+        ok = ok && bus.readPtr(0x2000, 4) == nullptr && bus.readPtr(0x3000, 4) != nullptr && bus.readPtr(0x1FF0, 4) != nullptr;
+        bus.removeWatch(0x2002, 1, WatchKind::Read);
+        ok = ok && bus.readPtr(0x2000, 4) != nullptr;
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 18 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 18 failed" << std::endl;
+        }
+    }
+
+    // Test 19: per-PC execution profile, label aggregation and export formats
+    {
+        std::cout << "[TEST] Test 19: Execution profiler" << std::endl;
+        // 0: LOADI R0,0; 6: LOADI R1,1; 12: LOADI R2,1000
+        // 18: ADD R0,R0,R1; 22: CMP R0,R2; 25: JNZ 18; 30: HALT
+        const std::vector<unsigned char> prog = {
+            static_cast<unsigned char>(Opcode::LOADI), 0, 0, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 1, 1, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 2, 0xE8, 0x03, 0, 0,
+            static_cast<unsigned char>(Opcode::ADD), 0, 0, 1,
+            static_cast<unsigned char>(Opcode::CMP), 0, 2,
+            static_cast<unsigned char>(Opcode::JNZ), 18, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::HALT)};
+        std::istringstream symText("# generated by asm --symbols\n00000000 start\n00000012 loop # body\n0000001e done\n");
+        const SymbolMap symbols = SymbolMap::parse(symText);
+        bool ok = symbols.labelFor(0) == "start" && symbols.labelFor(25) == "loop" && symbols.labelFor(40) == "done";
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit}) {
+            VMConfig cfg;
+            cfg.memSize = 64 * 1024;
+            cfg.engine = engine;
+            cfg.profile = true;
+            VMInstance vm(cfg);
+            vm.powerOn();
+            vm.loadProgramBytes(prog);
+            ok = ok && vm.runSteps(7) == RunOutcome::StepLimit && vm.profile()->total() == 7;
+            ok = ok && vm.runUntilHalt() == RunOutcome::Halted;
+            const ExecutionProfile& profile = *vm.profile();
+            ok = ok && profile.count(0) == 1 && profile.count(12) == 1 && profile.count(18) == 1000 &&
+                 profile.count(22) == 1000 && profile.count(25) == 1000 && profile.count(30) == 1 &&
+                 profile.total() == 3004 && profile.entries().size() == 7;
+
+            const std::vector<LabelCount> labels = aggregateByLabel(profile, symbols);
+            ok = ok && labels.size() == 3 && labels[0].label == "loop" && labels[0].count == 3000 &&
+                 labels[1].label == "start" && labels[1].count == 3;
+            std::ostringstream folded;
+            writeFoldedStacks(folded, profile, symbols);
+            ok = ok && folded.str().find("loop;0x12 1000\n") != std::string::npos &&
+                 folded.str().find("done;0x1e 1\n") != std::string::npos;
+            std::ostringstream pprof;
+            writePprof(pprof, profile, symbols);
+            ok = ok && pprof.str().size() > 2 && pprof.str()[0] == 0x0A && pprof.str().find("loop") != std::string::npos;
+            if (!ok) std::cout << "[TEST]   engine " << static_cast<int>(engine) << " failed" << std::endl;
+        }
+        VMConfig plain;
+        plain.memSize = 64 * 1024;
+        VMInstance unprofiled(plain);
+        ok = ok && unprofiled.profile() == nullptr;
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 19 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 19 failed" << std::endl;
+        }
+    }
+
+    // Test 20: performance counters agree across engines
+    {
+        std::cout << "[TEST] Test 20: Performance counters" << std::endl;
+        // 0: LOADI R0,0; 6: LOADI R1,1; 12: LOADI R2,100; 18: LOADI R5,0xFF00 (console device)
+        // 24: CALL 47; 29: ADD R0,R0,R1; 33: CMP R0,R2; 36: JNZ 24; 41: STORE [R5+0],R0; 46: HALT
+        // 47: PUSH R0; 49: POP R3; 51: RET
+        const std::vector<unsigned char> prog = {
+            static_cast<unsigned char>(Opcode::LOADI), 0, 0, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 1, 1, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 2, 100, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::LOADI), 5, 0x00, 0xFF, 0, 0,
+            static_cast<unsigned char>(Opcode::CALL), 47, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::ADD), 0, 0, 1,
+            static_cast<unsigned char>(Opcode::CMP), 0, 2,
+            static_cast<unsigned char>(Opcode::JNZ), 24, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::STORE), 5, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::HALT),
+            static_cast<unsigned char>(Opcode::PUSH), 0,
+            static_cast<unsigned char>(Opcode::POP), 3,
+            static_cast<unsigned char>(Opcode::RET)};
+        auto retired = [](const PerfCounters& perf, Opcode op) { return perf.retired[static_cast<u8>(op)]; };
+        bool ok = true;
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit}) {
+            std::ostringstream out;
+            VMConfig cfg;
+            cfg.memSize = 64 * 1024;
+            cfg.engine = engine;
+            cfg.consoleOut = &out;
+            VMInstance vm(cfg);
+            vm.powerOn();
+            vm.loadProgramBytes(prog);
+            ok = ok && vm.runUntilHalt() == RunOutcome::Halted;
+            const PerfCounters perf = vm.cpu()->perfCounters();
+            if (PerfCounters::ENABLED) {
+                ok = ok && perf.totalRetired() == 706 && retired(perf, Opcode::LOADI) == 4 &&
+                     retired(perf, Opcode::CALL) == 100 && retired(perf, Opcode::RET) == 100 &&
+                     retired(perf, Opcode::JNZ) == 100 && retired(perf, Opcode::HALT) == 1;
+                ok = ok && perf.branchesTaken == 99 && perf.branchesNotTaken == 1 && perf.loads() == 200 &&
+                     perf.stores() == 201 && perf.maxStackDepth() == 8 && perf.runNanos > 0 && perf.mips() > 0.0;
+                ok = ok && perf.deviceAccesses.size() == vm.devices().size() && perf.deviceAccesses.at(0) == 1;
+            } else {
+                ok = ok && perf.totalRetired() == 0 && perf.branchesTaken == 0;
+            }
+            vm.powerOn();
+            const PerfCounters cleared = vm.cpu()->perfCounters();
+            ok = ok && cleared.totalRetired() == 0 &&
+                 std::all_of(cleared.deviceAccesses.begin(), cleared.deviceAccesses.end(), [](u64 n) { return n == 0; });
+            if (!ok) std::cout << "[TEST]   engine " << static_cast<int>(engine) << " failed" << std::endl;
+        }
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 20 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 20 failed" << std::endl;
+        }
+    }
+
+    // Test 21: in-process assembly
+    {
+        std::cout << "[TEST] Test 21: Assembler library and loadAssembly" << std::endl;
+        const std::string source =
+            "early:  HALT               ; skipped via the entry point\n"
+            "start:  LOADI R5, 0x1000\n"
+            "        LOADI R4, 100\n"
+            "        STORE [R5 + 0], R4  // spaced offset\n"
+            "        LOAD  R6, [R5+0]\n"
+            "        OUT   R6\n"
+            "        HALT\n";
+        std::ostringstream out;
+        VMConfig cfg;
+        cfg.consoleOut = &out;
+        VMInstance vm(cfg);
+        vm.powerOn();
+        const AssembledProgram prog = vm.loadAssembly(source, "start");
+        bool ok = vm.runUntilHalt() == RunOutcome::Halted && out.str() == "100\n";
+        ok = ok && prog.code.size() == 1 + 6 + 6 + 5 + 5 + 2 + 1 && prog.labels.at("start") == 1;
+        ok = ok && prog.symbolMap().labelFor(12) == "start" && prog.address("0x20") == 0x20;
+        // The image carries the entry point and checksum like asm_app --with-header.
+        std::vector<unsigned char> image = prog.image(prog.address("start"));
+        ok = ok && hasProgramHeader(image) && parseProgramImage(image.data(), image.size()).entry == 1;
+        verifyHeaderAndPayloadIfRequested(image, true);
+        std::ostringstream syms;
+        prog.writeSymbols(syms);
+        ok = ok && syms.str() == "00000000 early\n00000001 start\n";
+        std::size_t errLine = 0;
+        try {
+            assemble("        LOADI R1, 1\n\n        LOAD R2, [R9 + 0]\n");
+        } catch (const AssemblyError& ex) {
+            errLine = ex.line();
+        }
+        ok = ok && errLine == 3;
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 21 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 21 failed: " << out.str() << std::endl;
+        }
+    }
+
+    // Test 22: streaming assembler agrees across input forms
+    {
+        std::cout << "[TEST] Test 22: Streaming assembly and forward references" << std::endl;
+        // Over 64 KiB so the stream reader splits lines across blocks; every
+        // block jumps forward to the next one's label.
+        std::ostringstream src;
+        for (int i = 0; i < 3000; ++i) {
+            src << "b" << i << ":\tloadi r1, -" << i << "   # counter\n"
+                << "\tStore [R2 + 0x10], R1\n"
+                << "\tjmp b" << (i + 1) << "\n";
+        }
+        src << "b3000: HALT";
+        const std::string text = src.str();
+        const AssembledProgram fromText = assemble(text);
+        std::istringstream stream(text);
+        const AssembledProgram fromStream = assemble(stream);
+        bool ok = text.size() > 64 * 1024 && fromText.code == fromStream.code && fromText.labels == fromStream.labels;
+        ok = ok && fromText.code.size() == 3000 * 16 + 1 && fromText.labels.at("b3000") == 3000 * 16;
+        const std::vector<unsigned char> first(fromText.code.begin(), fromText.code.begin() + 16);
+        const std::vector<unsigned char> expect{
+            static_cast<unsigned char>(Opcode::LOADI), 1, 0, 0, 0, 0,
+            static_cast<unsigned char>(Opcode::STORE), 2, 1, 0x10, 0,
+            static_cast<unsigned char>(Opcode::JMP), 16, 0, 0, 0};
+        ok = ok && first == expect && fromText.code[18] == 0xFF && fromText.code[21] == 0xFF; // -1
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 22 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 22 failed" << std::endl;
+        }
+    }
+
+    // Test 23: object files, linking and the object cache
+    {
+        std::cout << "[TEST] Test 23: Relocatable objects and vm_ld linking" << std::endl;
+        const std::string mainSrc =
+            "        .global start\n"
+            "start:  LOADI R0, 2\n"
+            "        LOADI R1, 1\n"
+            "        LOADI R6, 0\n"
+            "loop:   CALL  show\n"
+            "        SUB   R0, R0, R1\n"
+            "        CMP   R0, R6\n"
+            "        JNZ   loop\n"
+            "        LOADI R2, value\n"
+            "        OUT   R2\n"
+            "        LOAD  R3, [R6 + value]\n"
+            "        HALT\n";
+        const std::string libSrc =
+            "        .global show, value\n"
+            "show:   OUT   R0\n"
+            "        JMP   loop\n"
+            "        HALT\n"
+            "loop:   RET             ; local: distinct from main's loop\n"
+            "value:  HALT\n";
+        const ObjectFile mainObj = assembleObject(mainSrc, "main");
+        const ObjectFile libObj = assembleObject(libSrc, "lib");
+        const auto& extRel = mainObj.relocations;
+        bool ok = std::count_if(extRel.begin(), extRel.end(), [](const Relocation& r) { return !r.symbol.empty(); }) == 3;
+
+        // Encoding round trip
+        const std::vector<unsigned char> bytes = encodeObject(libObj);
+        const ObjectFile back = decodeObject(bytes.data(), bytes.size());
+        ok = ok && back.code == libObj.code && back.sourceHash == libObj.sourceHash &&
+             back.symbols.size() == libObj.symbols.size() && back.relocations.size() == libObj.relocations.size();
+
+        // Link main after lib so both modules are relocated away from 0.
+        const AssembledProgram linked = link({libObj, mainObj});
+        const u32 mainBase = static_cast<u32>(libObj.code.size());
+        ok = ok && linked.labels.at("start") == mainBase && linked.labels.at("main:loop") == mainBase + 18 &&
+             linked.labels.at("lib:loop") == 8 && linked.labels.at("value") == 9 &&
+             linked.code[mainBase + 46] == 9 && linked.code[mainBase + 47] == 0; // LOAD's 16-bit offset
+        std::ostringstream out;
+        VMConfig cfg;
+        cfg.consoleOut = &out;
+        VMInstance vm(cfg);
+        vm.powerOn();
+        vm.loadProgramBytes(linked.image(linked.address("start")));
+        ok = ok && vm.runUntilHalt() == RunOutcome::Halted && out.str() == "2\n1\n9\n";
+
+        std::string undefinedErr, duplicateErr, sameNameErr;
+        ObjectFile libCopy = libObj;
+        libCopy.name = "lib2";
+        try { link({mainObj}); } catch (const std::exception& ex) { undefinedErr = ex.what(); }
+        try { link({libObj, mainObj, libCopy}); } catch (const std::exception& ex) { duplicateErr = ex.what(); }
+        // Same module name (a/lib.asm, b/lib.asm): local labels would collide.
+        try { link({libObj, mainObj, libObj}); } catch (const std::exception& ex) { sameNameErr = ex.what(); }
+        ok = ok && undefinedErr.find("Undefined symbol 'show'") != std::string::npos &&
+             duplicateErr.find("Duplicate global symbol 'show'") != std::string::npos &&
+             sameNameErr.find("Duplicate module name 'lib'") != std::string::npos;
+
+        // The cache assembles a source once; an edit is a new entry.
+        const std::string cacheDir = "test_objcache";
+        std::filesystem::remove_all(cacheDir);
+        ObjectCache cache(cacheDir);
+        cache.get(libSrc, "lib");
+        const ObjectFile cached = cache.get(libSrc, "lib");
+        ok = ok && cache.misses() == 1 && cache.hits() == 1 && cached.code == libObj.code && cached.name == "lib";
+        cache.get(libSrc + "; edited\n", "lib");
+        ok = ok && cache.misses() == 2 && std::filesystem::exists(cache.pathFor(libObj.sourceHash));
+        // An entry whose recorded source length differs is a collision or damage: a miss.
+        ObjectFile wrongSize = libObj;
+        wrongSize.sourceSize += 1;
+        writeObjectFile(cache.pathFor(libObj.sourceHash), wrongSize);
+        cache.get(libSrc, "lib");
+        ok = ok && cache.misses() == 3 && readObjectFile(cache.pathFor(libObj.sourceHash)).sourceSize == libSrc.size();
+        std::filesystem::remove_all(cacheDir);
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 23 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 23 failed: " << out.str() << undefinedErr << duplicateErr << sameNameErr << std::endl;
+        }
+    }
+
+    // Test 24: profile-guided layout
+    {
+        std::cout << "[TEST] Test 24: Profile-guided code layout" << std::endl;
+        const std::string src =
+            "start:  LOADI R0, 20\n"
+            "        LOADI R1, 1\n"
+            "        LOADI R6, 0\n"
+            "        LOADI R2, 0\n"
+            "loop:   CMP   R0, R6\n"
+            "        JNZ   body        ; usually taken\n"
+            "done:   OUT   R2\n"
+            "        HALT\n"
+            "cold:   OUT   R6          ; never runs\n"
+            "        HALT\n"
+            "body:   ADD   R2, R2, R0\n"
+            "        SUB   R0, R0, R1\n"
+            "        JMP   loop\n";
+        auto run = [](const AssembledProgram& prog, bool profiled, std::ostringstream& out) {
+            VMConfig cfg;
+            cfg.consoleOut = &out;
+            cfg.profile = profiled;
+            auto vm = std::make_unique<VMInstance>(cfg);
+            vm->powerOn();
+            vm->loadProgramBytes(prog.image());
+            vm->runUntilHalt();
+            return vm;
+        };
+        std::ostringstream before, after;
+        const AssembledProgram plain = assemble(src);
+        const auto profiled = run(plain, true, before);
+
+        // Round trip the profile through the folded format vm_app writes.
+        std::stringstream folded;
+        writeFoldedStacks(folded, *profiled->profile(), plain.symbolMap());
+        const ExecutionProfile profile = ExecutionProfile::parseFolded(folded);
+        LayoutReport report;
+        const AssembledProgram laid = assembleWithProfile(src, profile, &report);
+        run(laid, false, after);
+        bool ok = profile.total() == profiled->profile()->total() && before.str() == "210\n" && after.str() == before.str();
+        ok = ok && report.branchesInverted == 1 && report.takenBefore == 40 && report.takenAfter == 21;
+        // Hot code is contiguous: the never-executed block moved to the end.
+        ok = ok && laid.labels.at("start") == 0 && laid.labels.at("cold") > laid.labels.at("body") &&
+             laid.labels.at("body") < laid.labels.at("done") && laid.labels.at("cold") > laid.labels.at("done") &&
+             laid.code.size() == plain.code.size();
+
+        std::string numericErr;
+        try { assembleWithProfile("JMP 0\n", profile); } catch (const std::exception& ex) { numericErr = ex.what(); }
+        ok = ok && numericErr.find("numeric target") != std::string::npos;
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 24 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 24 failed: " << after.str() << numericErr << std::endl;
+        }
+    }
+
+    // Test 25: a jump to 0xFFFFFFFF is out of bounds on every engine (the
+    // decode cache's empty entries must not match it)
+    {
+        std::cout << "[TEST] Test 25: Jump to the last u32 address" << std::endl;
+        std::vector<unsigned char> prog;
+        prog.push_back(static_cast<unsigned char>(Opcode::JMP));
+        emit32(prog, 0xFFFFFFFFu);
+        bool ok = true;
+        std::string outcomes;
+        for (CpuEngine engine : {CpuEngine::Interpreter, CpuEngine::Threaded, CpuEngine::Jit}) {
+            VMConfig cfg;
+            cfg.engine = engine;
+            VMInstance instance(cfg);
+            instance.powerOn();
+            instance.loadProgramBytes(prog);
+            try {
+                const RunOutcome outcome = instance.runUntilHalt();
+                ok = ok && outcome != RunOutcome::Halted;
+                outcomes += std::to_string(static_cast<int>(outcome)) + " ";
+            } catch (const std::exception& ex) {
+                outcomes += std::string(ex.what()) + "; ";
+            }
+        }
+        if (ok) {
+            std::cout << "[TEST] ✓ Test 25 passed" << std::endl;
+        } else {
+            ++g_failures; std::cout << "[TEST] ✗ Test 25 failed: " << outcomes << std::endl;
+        }
+    }
+
     std::cout << "[TEST] All tests completed!" << std::endl;
-    return 0;
+    return g_failures == 0 ? 0 : 1;
 }